@@ -13,8 +13,6 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <time.h>
-#include <mutex>
-#include <thread>
 
 #ifdef _DEBUG
 #define EXIT __debugbreak()
@@ -22,18 +20,9 @@
 #define EXIT goto epilogue
 #endif
 
-enum DecodingState : uint32_t
-{
-  DS_None,
-  DS_FrameReady = 1 << 0,
-  DS_CanDecodeNextFrame = 1 << 1,
-};
-
-void asyncUpdate(std::mutex *pMutex, std::condition_variable *pConditionVariable, volatile uint32_t *pState, slapFileReader *pFileReader, volatile bool *pRunning);
-
 //////////////////////////////////////////////////////////////////////////
 
-// This is a modified version of the decoder example that pre-loads frames on a separate thread.
+// This is a modified version of the decoder example that pre-loads frames on a separate thread using `slapFileReaderAsync`.
 // Especially for single- (or-not-very-multi-) threaded applications with expensive update cycles this can be quite useful because it removes the cost of decoding the video from the main thread.
 // The more work you do apart from decoding the video, the greater the performance benefit will be.
 int main(int argc, char **pArgv)
@@ -48,26 +37,24 @@ int main(int argc, char **pArgv)
   SDL_Window *pWindow = nullptr;
   SDL_Surface *pSurface = nullptr;
   uint32_t *pPixels = nullptr;
-  slapFileReader *pFileReader = nullptr;
+  slapFileReaderAsync *pFileReader = nullptr;
   size_t resolutionX, resolutionY;
-  volatile bool running = true;
-  volatile uint32_t state = DS_CanDecodeNextFrame;
-  std::mutex mutex;
-  std::thread updateThread;
-  std::condition_variable conditionVariable;
-  bool updateFrame;
-
-  pFileReader = slapCreateFileReader(pArgv[1]);
+  size_t frameIndex = 0;
+  size_t frameCount = 0;
+  bool running = true;
+  clock_t time;
+
+  pFileReader = slapCreateFileReaderAsync(pArgv[1], 3, slapFileReaderAsync_DecodeBGRA | slapFileReaderAsync_Loop);
   
   if (!pFileReader)
     EXIT;
 
-  printf("Opened Video '%s' (%" PRIu64 " Frames, IntraFrameStep: %" PRIu64 ")\n", pArgv[1], (uint64_t)slapFileReader_GetFrameCount(pFileReader), (uint64_t)slapFileReader_GetIntraFrameStep(pFileReader));
+  printf("Opened Video '%s' (%" PRIu64 " Frames, IntraFrameStep: %" PRIu64 ")\n", pArgv[1], (uint64_t)slapFileReaderAsync_GetFrameCount(pFileReader), (uint64_t)slapFileReaderAsync_GetIntraFrameStep(pFileReader));
 
   if (0 != SDL_Init(SDL_INIT_VIDEO))
     goto epilogue;
 
-  if (slapSuccess != (result = slapFileReader_GetResolution(pFileReader, &resolutionX, &resolutionY)))
+  if (slapSuccess != (result = slapFileReaderAsync_GetResolution(pFileReader, &resolutionX, &resolutionY)))
     EXIT;
 
   pWindow = SDL_CreateWindow("Decoder", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, (int)resolutionX, (int)resolutionY, SDL_WINDOW_SHOWN);
@@ -82,35 +69,37 @@ int main(int argc, char **pArgv)
 
   pPixels = (uint32_t *)pSurface->pixels;
 
-  updateThread = std::thread(&asyncUpdate, &mutex, &conditionVariable, &state, pFileReader, &running);
+  time = clock();
 
   while (running)
   {
-    updateFrame = false;
+    const void *pFrameBGRA = nullptr;
 
-    {
-      mutex.lock();
+    // Wait for at most 1 ms, so the window stays responsive even if the decoder can't keep up.
+    result = slapFileReaderAsync_AcquireFrame(pFileReader, 1, nullptr, &pFrameBGRA, &frameIndex);
 
-      if (state & DS_FrameReady)
+    if (result == slapSuccess)
+    {
+      if (frameIndex == 0 && frameCount > 0)
       {
-        state &= ~DS_FrameReady;
-        updateFrame = true;
-      }
-
-      mutex.unlock();
-    }
+        time = clock() - time;
 
-    if (updateFrame)
-    {
-      slapMemcpy(pPixels, slapFileReader_GetBufferBGRA(pFileReader), resolutionX * resolutionY * sizeof(uint32_t));
+        printf("Decoded %" PRIu64 " Frames in %" PRIu64 " ms. (%f frames per second)\n", (uint64_t)frameCount, (uint64_t)time, frameCount / (time * 0.001));
 
-      mutex.lock();
+        time = clock();
+        frameCount = 0;
+      }
 
-      state |= DS_CanDecodeNextFrame;
+      frameCount++;
 
-      mutex.unlock();
+      slapMemcpy(pPixels, pFrameBGRA, resolutionX * resolutionY * sizeof(uint32_t));
 
-      conditionVariable.notify_one();
+      if (slapSuccess != (result = slapFileReaderAsync_ReleaseFrame(pFileReader)))
+        EXIT;
+    }
+    else if (result != slapError_Timeout)
+    {
+      EXIT;
     }
 
     if (0 != SDL_UpdateWindowSurface(pWindow))
@@ -121,15 +110,9 @@ int main(int argc, char **pArgv)
     while (SDL_PollEvent(&event))
       if (event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE))
         running = false;
-
-    std::unique_lock<std::mutex> lock(mutex);
-    conditionVariable.wait_for(lock, std::chrono::milliseconds(1));
   }
 
 epilogue:
-  running = false;
-  updateThread.join();
-
   if (pSurface)
   {
     SDL_FreeSurface(pSurface);
@@ -145,81 +128,7 @@ epilogue:
   SDL_Quit();
 
   if (pFileReader)
-    slapDestroyFileReader(&pFileReader);
+    slapDestroyFileReaderAsync(&pFileReader);
 
   return 0;
 }
-
-//////////////////////////////////////////////////////////////////////////
-
-void asyncUpdate(std::mutex *pMutex, std::condition_variable *pConditionVariable, volatile uint32_t *pState, slapFileReader *pFileReader, volatile bool *pRunning)
-{
-  size_t frameIndex = 0;
-  clock_t time = clock();
-  bool decodeNextFrame;
-
-  while (*pRunning)
-  {
-    decodeNextFrame = false;
-
-    {
-      pMutex->lock();
-
-      if (*pState & DS_CanDecodeNextFrame)
-      {
-        *pState &= ~DS_CanDecodeNextFrame;
-        decodeNextFrame = true;
-      }
-
-      pMutex->unlock();
-    }
-
-    if (decodeNextFrame)
-    {
-      frameIndex++;
-      slapResult result = slapFileReader_GetNextFrame(pFileReader);
-
-      if (result != slapSuccess)
-      {
-        if (result == slapError_EndOfStream)
-        {
-          time = clock() - time;
-
-          printf("Decoded %" PRIu64 " Frames in %" PRIu64 " ms. (%f frames per second)\n", frameIndex, (uint64_t)time, frameIndex / (time * 0.001));
-
-          time = clock();
-          frameIndex = 1;
-
-          if (slapSuccess != (result = slapFileReader_RestartVideoStream(pFileReader)))
-            EXIT;
-
-          if (slapSuccess != (result = slapFileReader_GetNextFrame(pFileReader)))
-            EXIT;
-        }
-        else
-        {
-          EXIT;
-        }
-      }
-
-      if (slapSuccess != (result = slapFileReader_TransformBufferToBGRA(pFileReader)))
-        EXIT;
-
-      {
-        pMutex->lock();
-
-        *pState |= DS_FrameReady;
-
-        pMutex->unlock();
-
-        pConditionVariable->notify_one();
-      }
-    }
-
-    std::unique_lock<std::mutex> lock(*pMutex);
-    pConditionVariable->wait_for(lock, std::chrono::milliseconds(1));
-  }
-
-epilogue:
-  *pRunning = false;
-}
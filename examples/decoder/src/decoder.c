@@ -94,11 +94,10 @@ int main(int argc, char **pArgv)
       }
     }
 
-    if (slapSuccess != (result = slapFileReader_TransformBufferToBGRA(pFileReader)))
+    // Convert straight into the window surface instead of copying the frame.
+    if (slapSuccess != (result = slapFileReader_TransformBufferToBGRAInto(pFileReader, pPixels, (size_t)pSurface->pitch)))
       EXIT;
 
-    slapMemcpy(pPixels, slapFileReader_GetBufferBGRA(pFileReader), resolutionX * resolutionY * sizeof(uint32_t));
-
     if (0 != SDL_UpdateWindowSurface(pWindow))
       EXIT;
 
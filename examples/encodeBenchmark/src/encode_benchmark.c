@@ -0,0 +1,132 @@
+// Copyright 2019 Christoph Stiller
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Encodes the same synthetic clip with every reconstruction strategy at an IntraFrameStep of 1 and above and prints the encoding throughput.
+
+#include "slapcodec2D.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIZE_X 1920
+#define SIZE_Y 1088
+#define FRAME_COUNT 64
+#define INTRA_FRAME_STEP 8
+
+// A slowly panning pattern, so intra frames have something to predict from.
+void GenerateFrame(uint8_t *pFrame, const size_t frameIndex)
+{
+  for (size_t y = 0; y < SIZE_Y; y++)
+    for (size_t x = 0; x < SIZE_X; x++)
+      pFrame[y * SIZE_X + x] = (uint8_t)(((x + frameIndex * 3) ^ (y + frameIndex)) + ((x + frameIndex * 3) * y >> 9));
+
+  for (size_t y = 0; y < SIZE_Y / 2; y++)
+  {
+    for (size_t x = 0; x < SIZE_X / 2; x++)
+    {
+      pFrame[SIZE_X * SIZE_Y + y * SIZE_X / 2 + x] = (uint8_t)(96 + ((x + frameIndex) >> 3));
+      pFrame[SIZE_X * SIZE_Y * 5 / 4 + y * SIZE_X / 2 + x] = (uint8_t)(96 + (y >> 3));
+    }
+  }
+}
+
+// Returns 0 if the combination isn't supported or encoding fails.
+int Benchmark(const char *filename, uint8_t **ppFrames, const slapReconstruction reconstruction, const char *name, const size_t intraFrameStep)
+{
+  int success = 0;
+  slapFileWriter *pFileWriter = NULL;
+  clock_t time = 0;
+  char filenameBuffer[0x100];
+
+  pFileWriter = slapCreateFileWriter(filename, SIZE_X, SIZE_Y, 0);
+
+  if (!pFileWriter)
+    goto epilogue;
+
+  // `slapReconstruction_None` is only allowed with an IntraFrameStep of 1.
+  if (slapSuccess != slapFileWriter_SetReconstruction(pFileWriter, reconstruction) || slapSuccess != slapFileWriter_SetIntraFrameStep(pFileWriter, intraFrameStep))
+  {
+    printf("%-10s IntraFrameStep %" PRIu64 ": not supported\n", name, (uint64_t)intraFrameStep);
+    success = 1;
+    goto epilogue;
+  }
+
+  time = clock();
+
+  for (size_t i = 0; i < FRAME_COUNT; i++)
+    if (slapSuccess != slapFileWriter_AddFrameYUV420(pFileWriter, ppFrames[i]))
+      goto epilogue;
+
+  if (slapSuccess != slapFinalizeFileWriter(pFileWriter))
+    goto epilogue;
+
+  time = clock() - time;
+
+  printf("%-10s IntraFrameStep %" PRIu64 ": %7.2f fps\n", name, (uint64_t)intraFrameStep, FRAME_COUNT / ((double)(time > 0 ? time : 1) / CLOCKS_PER_SEC));
+  success = 1;
+
+epilogue:
+  slapDestroyFileWriter(&pFileWriter);
+
+  // Writers that haven't been finalized leave their temporary files behind.
+  sprintf(filenameBuffer, "%s.video", filename);
+  remove(filenameBuffer);
+  sprintf(filenameBuffer, "%s.header", filename);
+  remove(filenameBuffer);
+  remove(filename);
+
+  return success;
+}
+
+int main(int argc, char **pArgv)
+{
+  if (argc != 2 || strlen(pArgv[1]) > 0xF0)
+  {
+    printf("Usage %s <TemporaryOutputFile>\n", pArgv[0]);
+    return 0;
+  }
+
+  const slapReconstruction reconstructions[] = { slapReconstruction_ClosedLoop, slapReconstruction_OpenLoop, slapReconstruction_None };
+  const char *names[] = { "ClosedLoop", "OpenLoop", "None" };
+  const size_t intraFrameSteps[] = { 1, INTRA_FRAME_STEP };
+
+  int success = 0;
+  uint8_t *pFrames[FRAME_COUNT] = { NULL };
+
+  // The clip is generated up front, so only the encoder is measured.
+  for (size_t i = 0; i < FRAME_COUNT; i++)
+  {
+    pFrames[i] = (uint8_t *)malloc(SIZE_X * SIZE_Y * 3 / 2);
+
+    if (!pFrames[i])
+      goto epilogue;
+
+    GenerateFrame(pFrames[i], i);
+  }
+
+  printf("Encoding %" PRIu64 " frames at %" PRIu64 "x%" PRIu64 " on a single thread.\n", (uint64_t)FRAME_COUNT, (uint64_t)SIZE_X, (uint64_t)SIZE_Y);
+
+  for (size_t i = 0; i < sizeof(reconstructions) / sizeof(reconstructions[0]); i++)
+    for (size_t j = 0; j < sizeof(intraFrameSteps) / sizeof(intraFrameSteps[0]); j++)
+      if (!Benchmark(pArgv[1], pFrames, reconstructions[i], names[i], intraFrameSteps[j]))
+        goto epilogue;
+
+  success = 1;
+
+epilogue:
+  for (size_t i = 0; i < FRAME_COUNT; i++)
+    free(pFrames[i]);
+
+  if (!success)
+    puts("Failed.");
+
+  return success ? 0 : 1;
+}
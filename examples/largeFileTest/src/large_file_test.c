@@ -0,0 +1,194 @@
+// Copyright 2019 Christoph Stiller
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// Writes a video that is larger than 4 GB and reads the frames behind the 4 GB boundary back with the regular and the mapped file reader.
+// Needs about twice the size of the video in free disk space, because the video is written to temporary files first.
+
+#include "slapcodec2D.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SIZE_X 4096
+#define SIZE_Y 2048
+#define MARKER_SIZE 64
+#define FOUR_GB ((uint64_t)1 << 32)
+#define MIN_FILE_SIZE (FOUR_GB + FOUR_GB / 4)
+
+// Noise barely compresses, so the frames are large. Every frame has a flat marker block in the top left corner, so the frames can be told apart after decoding.
+void GenerateFrame(uint8_t *pFrame, const size_t frameIndex)
+{
+  uint32_t state = 0x12345678;
+
+  for (size_t i = 0; i < SIZE_X * SIZE_Y * 3 / 2; i++)
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    pFrame[i] = (uint8_t)state;
+  }
+
+  for (size_t y = 0; y < MARKER_SIZE; y++)
+    for (size_t x = 0; x < MARKER_SIZE; x++)
+      pFrame[y * SIZE_X + x] = (uint8_t)(32 + frameIndex * 37 % 192);
+}
+
+int CheckFrame(const uint8_t *pY, const size_t frameIndex)
+{
+  const int expected = (int)(32 + frameIndex * 37 % 192);
+
+  // Only the center of the marker block, the edges are blurred by the noise around it.
+  for (size_t y = MARKER_SIZE / 4; y < MARKER_SIZE * 3 / 4; y++)
+  {
+    for (size_t x = MARKER_SIZE / 4; x < MARKER_SIZE * 3 / 4; x++)
+    {
+      const int difference = pY[y * SIZE_X + x] - expected;
+
+      if (difference < -4 || difference > 4)
+        return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Seeks to every frame that starts behind the 4 GB boundary (assuming frames of roughly equal size) and a few frames before it.
+int CheckFrames(slapFileReader *pFileReader, const size_t frameCount, const uint64_t fileSize, const char *name)
+{
+  const size_t firstFrame = (size_t)(frameCount * (FOUR_GB / 1024) / (fileSize / 1024)) + 1;
+  size_t checkedFrames = 0;
+
+  if (!pFileReader)
+  {
+    printf("Failed to open the video with the %s reader.\n", name);
+    return 0;
+  }
+
+  if (slapFileReader_GetFrameCount(pFileReader) != frameCount)
+  {
+    printf("The %s reader found %" PRIu64 " instead of %" PRIu64 " frames.\n", name, (uint64_t)slapFileReader_GetFrameCount(pFileReader), (uint64_t)frameCount);
+    return 0;
+  }
+
+  for (size_t frameIndex = firstFrame - 3; frameIndex < frameCount; frameIndex++)
+  {
+    if (slapSuccess != slapFileReader_SetFrameIndex(pFileReader, frameIndex) || slapSuccess != slapFileReader_GetNextFrame(pFileReader))
+    {
+      printf("The %s reader failed to decode frame %" PRIu64 ".\n", name, (uint64_t)frameIndex);
+      return 0;
+    }
+
+    if (!CheckFrame((const uint8_t *)slapFileReader_GetBufferYUV420(pFileReader), frameIndex))
+    {
+      printf("The %s reader decoded the wrong frame at index %" PRIu64 ".\n", name, (uint64_t)frameIndex);
+      return 0;
+    }
+
+    checkedFrames++;
+  }
+
+  printf("The %s reader decoded frames %" PRIu64 " to %" PRIu64 ".\n", name, (uint64_t)(firstFrame - 3), (uint64_t)(firstFrame - 3 + checkedFrames - 1));
+
+  return 1;
+}
+
+int main(int argc, char **pArgv)
+{
+  if (argc != 2)
+  {
+    printf("Usage %s <OutputFile>\n", pArgv[0]);
+    return 0;
+  }
+
+  int success = 0;
+  uint8_t *pFrame = NULL;
+  slapFileWriter *pFileWriter = NULL;
+  slapFileReader *pFileReader = NULL;
+  FILE *pFile = NULL;
+  size_t frameCount = 0;
+  int64_t fileSize = 0;
+
+  pFrame = (uint8_t *)malloc(SIZE_X * SIZE_Y * 3 / 2);
+
+  if (!pFrame)
+    goto epilogue;
+
+  pFileWriter = slapCreateFileWriter(pArgv[1], SIZE_X, SIZE_Y, 0);
+
+  if (!pFileWriter)
+    goto epilogue;
+
+  if (slapSuccess != slapFileWriter_SetEncoderFrameQuality(pFileWriter, 100))
+    goto epilogue;
+
+  // A single frame is about 20 MB large.
+  for (; frameCount < 320; frameCount++)
+  {
+    GenerateFrame(pFrame, frameCount);
+
+    if (slapSuccess != slapFileWriter_AddFrameYUV420(pFileWriter, pFrame))
+    {
+      printf("Failed to add frame %" PRIu64 ".\n", (uint64_t)frameCount);
+      goto epilogue;
+    }
+  }
+
+  if (slapSuccess != slapFinalizeFileWriter(pFileWriter))
+  {
+    puts("Failed to finalize the video.");
+    goto epilogue;
+  }
+
+  slapDestroyFileWriter(&pFileWriter);
+
+  pFile = fopen(pArgv[1], "rb");
+
+  if (!pFile || _fseeki64(pFile, 0, SEEK_END))
+    goto epilogue;
+
+  fileSize = _ftelli64(pFile);
+  fclose(pFile);
+  pFile = NULL;
+
+  printf("Wrote %" PRIu64 " frames (%" PRIi64 " bytes).\n", (uint64_t)frameCount, fileSize);
+
+  if (fileSize < (int64_t)MIN_FILE_SIZE)
+  {
+    puts("The video isn't large enough to test offsets beyond 4 GB.");
+    goto epilogue;
+  }
+
+  pFileReader = slapCreateFileReader(pArgv[1]);
+
+  if (!CheckFrames(pFileReader, frameCount, (uint64_t)fileSize, "regular"))
+    goto epilogue;
+
+  slapDestroyFileReader(&pFileReader);
+
+  pFileReader = slapCreateFileReaderMapped(pArgv[1]);
+
+  if (!CheckFrames(pFileReader, frameCount, (uint64_t)fileSize, "mapped"))
+    goto epilogue;
+
+  success = 1;
+
+epilogue:
+  if (pFile)
+    fclose(pFile);
+
+  slapDestroyFileWriter(&pFileWriter);
+  slapDestroyFileReader(&pFileReader);
+  free(pFrame);
+
+  remove(pArgv[1]);
+
+  puts(success ? "Success." : "Failed.");
+
+  return success ? 0 : 1;
+}
@@ -9,4 +9,6 @@ solution "slapcodec2D"
   group "examples"
     dofile "examples/advancedDecoder/project.lua"
     dofile "examples/decoder/project.lua"
-    dofile "examples/encoder/project.lua"
\ No newline at end of file
+    dofile "examples/encodeBenchmark/project.lua"
+    dofile "examples/encoder/project.lua"
+    dofile "examples/largeFileTest/project.lua"
\ No newline at end of file
@@ -40,16 +40,28 @@ extern "C" {
     slapError_FileError,
     slapError_EndOfStream,
     slapError_MemoryAllocation,
-    slapError_StateInvalid
+    slapError_StateInvalid,
+    slapError_Timeout
   } slapResult;
 
   slapResult slapWriteJpegFromYUV(const char *filename, IN const void *pData, const size_t resX, const size_t resY);
 
   typedef struct slapFileWriter slapFileWriter;
   typedef struct slapFileReader slapFileReader;
+  typedef struct slapVideo slapVideo;
 
   // Video Resolution has to be a multiple of 8.
   slapFileWriter * slapCreateFileWriter(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags);
+
+  // Writes the video straight into the final file instead of temporary `.video` and `.header` files. The header is appended after the video data on finalize.
+  // Video Resolution has to be a multiple of 8.
+  slapFileWriter * slapCreateFileWriterSinglePass(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags);
+
+  // Writes every frame as a self-delimiting packet and flushes it right away, so the video can be read while it's still being recorded and is recoverable after a crash.
+  // The header is appended after the video data on finalize like with `slapCreateFileWriterSinglePass`.
+  // Video Resolution has to be a multiple of 8.
+  slapFileWriter * slapCreateFileWriterStreaming(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags);
+
   void slapDestroyFileWriter(IN_OUT slapFileWriter **ppFileWriter);
 
   // Setting the intra frame step to 1 will disable intra frame coding.
@@ -57,6 +69,10 @@ extern "C" {
   // IntraFrameStep has to be be set before any frames are added.
   slapResult slapFileWriter_SetIntraFrameStep(slapFileWriter *pFileWriter, const size_t step);
 
+  // Encodes the Y, U and V planes of a frame in parallel on a pool of persistent worker threads.
+  // threadCount includes the calling thread. Default threadCount is 1. (Single threaded.)
+  slapResult slapFileWriter_SetThreadCount(slapFileWriter *pFileWriter, const size_t threadCount);
+
   // quality: 1 - 100. (default: 75)
   slapResult slapFileWriter_SetEncoderFrameQuality(slapFileWriter *pFileWriter, const size_t quality);
 
@@ -64,16 +80,134 @@ extern "C" {
   // Returns `slapError_StateInvalid` if IntraFrameStep is 1.
   slapResult slapFileWriter_SetEncoderIntraFrameQuality(slapFileWriter *pFileWriter, const size_t quality);
 
+  typedef enum slapRateControl
+  {
+    slapRateControl_None, // Every frame is coded with the encoder frame quality or intra frame quality. (default)
+    slapRateControl_AverageFrameSize, // The quality is adapted from frame to frame, so the average frame size approaches `bytesPerFrame`. Single frames may be larger.
+    slapRateControl_MaxFrameSize, // Planes that would make a frame larger than `bytesPerFrame` are coded again with a lower quality. Frames are only larger if even quality 1 doesn't fit.
+  } slapRateControl;
+
+  // Picks the quality of every plane per frame from the compressed sizes of the previous frames, starting with the encoder frame quality and intra frame quality.
+  slapResult slapFileWriter_SetRateControl(slapFileWriter *pFileWriter, const slapRateControl rateControl, const size_t bytesPerFrame);
+
+  typedef enum slapReconstruction
+  {
+    slapReconstruction_ClosedLoop, // Intra frames are encoded against the decoded previous frame, exactly like the decoder sees it. Frames are only decoded if the next frame is an intra frame. (default)
+    slapReconstruction_OpenLoop, // Intra frames are encoded against the previous source frame. Nothing is decoded, but the error accumulates until the next full frame.
+    slapReconstruction_None, // No reference frame is kept at all. Requires IntraFrameStep 1.
+  } slapReconstruction;
+
+  // Returns `slapError_StateInvalid` if `slapReconstruction_None` is combined with an IntraFrameStep > 1.
+  slapResult slapFileWriter_SetReconstruction(slapFileWriter *pFileWriter, const slapReconstruction reconstruction);
+
+  // Block skip coding: Intra frames only contain the 16x16 blocks whose sum of absolute differences to the previous frame (including the co-located 8x8 chroma blocks) exceeds `threshold`. All other blocks are copied from the previous frame.
+  // Video Resolution has to be a multiple of 16. Has to be set before any frames are added. Can't be combined with motion compensation.
+  slapResult slapFileWriter_SetBlockSkipThreshold(slapFileWriter *pFileWriter, const size_t threshold);
+
+  // Motion compensation: Every 16x16 block of an intra frame is predicted from the best matching block within 64 pixels in the previous frame instead of the co-located block. Helps with camera motion.
+  // Video Resolution has to be a multiple of 16. Has to be set before any frames are added. Can't be combined with block skip coding.
+  slapResult slapFileWriter_EnableMotionCompensation(slapFileWriter *pFileWriter);
+
+  // Scene change detection: A key frame is placed wherever the luma histograms of two consecutive frames differ by more than `threshold` percent. Key frames are still placed at least every IntraFrameStep frames.
+  // threshold: 1 - 100. Has to be set before any frames are added.
+  slapResult slapFileWriter_SetSceneChangeThreshold(slapFileWriter *pFileWriter, const size_t threshold);
+
+  // Tiled frames: Every plane is split into `columns` x `rows` independently compressed tiles, so a frame can be decoded on multiple threads and regions of it can be decoded on their own. (see `slapFileReader_GetNextFrameRegionInto`)
+  // columns, rows: 1 - 16, at most one tile per 16 pixels. Has to be set before any frames are added. Can't be combined with block skip coding or motion compensation.
+  slapResult slapFileWriter_SetTileCount(slapFileWriter *pFileWriter, const size_t columns, const size_t rows);
+
+  // Shared JPEG tables: Planes are stored as abbreviated JPEG datastreams without quantization and Huffman tables, which saves a few hundred bytes per plane (and tile). The decoder generates the tables once per quality instead of parsing them for every plane.
+  // Has to be set before any frames are added.
+  slapResult slapFileWriter_EnableSharedJpegTables(slapFileWriter *pFileWriter);
+
+  // YUV420 key frames: Key frames are stored as a single 4:2:0 JPEG instead of three grayscale JPEGs, so they're decoded in a single pass and can be decoded straight to BGRA (see `slapFileReader_GetNextFrameBGRAInto`) or handed to any JPEG decoder. (see `slapFileReader_GetKeyFrameJpeg`)
+  // Has to be set before any frames are added. Can't be combined with tiles or shared JPEG tables.
+  slapResult slapFileWriter_EnableYUV420KeyFrames(slapFileWriter *pFileWriter);
+
+  // Compact index: The offsets and sizes of the frames are stored as variable-length deltas with an absolute anchor every 64 frames (about 10 instead of 64 bytes per frame), so long videos open faster. Readers keep the index packed in memory, no matter how it has been stored.
+  // Has to be set before any frames are added. Videos with a compact index can't be read by versions of slapcodec2D that don't support it.
+  slapResult slapFileWriter_EnableCompactIndex(slapFileWriter *pFileWriter);
+
   slapResult slapFileWriter_AddFrameYUV420(IN slapFileWriter *pFileWriter, IN void *pData);
+
+  // Pipelined encoding: Every frame is copied and encoded on its own encoder on the worker threads. Frames are still written in order.
+  // If IntraFrameStep > 1, every group of IntraFrameStep frames (starting with a full frame) is encoded on its own encoder instead.
+  // Falls back to `slapFileWriter_AddFrameYUV420` if the threadCount is 1.
+  slapResult slapFileWriter_AddFrameYUV420Async(IN slapFileWriter *pFileWriter, IN const void *pData);
+
+  // Waits for all asynchronously added frames and writes them to disk.
+  slapResult slapFileWriter_FlushAsync(IN slapFileWriter *pFileWriter);
+
+  // The maximum amount of frames (or groups of IntraFrameStep frames) that are encoded asynchronously at the same time. (default: threadCount)
+  slapResult slapFileWriter_SetFramesInFlight(slapFileWriter *pFileWriter, const size_t framesInFlight);
   slapResult slapFinalizeFileWriter(IN slapFileWriter *pFileWriter);
 
   slapFileReader * slapCreateFileReader(const char *filename);
+
+  // Maps the whole file into memory once and decodes frames straight from the mapped view instead of reading every frame into a separate buffer.
+  slapFileReader * slapCreateFileReaderMapped(const char *filename);
+
   void slapDestroyFileReader(IN_OUT slapFileReader **ppFileReader);
 
+  // Maps a video into memory and reads its header once, so any number of readers can decode it without opening the file again (e.g. one reader per thread at different positions). (see `slapCreateFileReaderFromVideo`)
+  // Streaming videos that haven't been finalized are shared as they are when the video is created.
+  slapVideo * slapCreateVideo(const char *filename);
+
+  // Releases the reference of the caller. The video is destroyed once all readers created from it have been destroyed as well.
+  void slapDestroyVideo(IN_OUT slapVideo **ppVideo);
+
+  // Creates a reader that decodes straight from the mapped file of the video and shares its header, so it only owns a decoder and its frame buffers.
+  // The video is never modified, so readers of the same video can be used on different threads at the same time without any locking. (A single reader still must not be used by multiple threads at once.) `slapFileReader_Refresh` doesn't pick up new frames.
+  slapFileReader * slapCreateFileReaderFromVideo(IN slapVideo *pVideo);
+
+  // Decodes the Y, U and V planes of a frame in parallel on a pool of persistent worker threads.
+  // threadCount includes the calling thread. Default threadCount is 1. (Single threaded.)
+  slapResult slapFileReader_SetThreadCount(IN slapFileReader *pFileReader, const size_t threadCount);
+
+  // Decodes frames at 1 / `scale` of the resolution of the video with the scaled IDCT of libjpeg-turbo, which is a lot faster and needs a fraction of the memory (e.g. for previews and thumbnails). `slapFileReader_GetResolution` returns the decoded resolution, which all buffers, strides and regions refer to.
+  // scale: 1, 2, 4 or 8. (default: 1) The resolution of the video has to be a multiple of 2 * `scale`. Intra frames are reconstructed at the decoded resolution, so they can slightly drift from a downscaled full resolution frame until the next key frame.
+  // Decoding continues at the key frame prior to the next frame.
+  slapResult slapFileReader_SetDecodeScale(IN slapFileReader *pFileReader, const size_t scale);
+
+  // Only decodes the luma plane of every frame (e.g. for analytics or grayscale previews). Only the luma sub buffer of a frame is read and the chroma planes are neither decompressed nor reconstructed. Can be enabled at any frame.
+  // The luma plane is returned by `slapFileReader_GetBufferY`. `slapFileReader_GetBufferYUV420` returns NULL, converting to BGRA returns `slapError_StateInvalid` and `pU`, `pV` and `strideUV` of `slapFileReader_GetNextFrame(Region)Into` are ignored.
+  slapResult slapFileReader_EnableLumaOnly(IN slapFileReader *pFileReader);
+
+  // Keeps up to `size` bytes of frames decoded by `slapFileReader_GetNextFrame` in memory, so scrubbing back and forth doesn't read and decode them again (e.g. for editing and review tools). Frames are cached at the decoded resolution. (see `slapFileReader_SetDecodeScale`)
+  // A cached frame also is the reference of the next frame, so `slapFileReader_SetFrameIndexExact` continues decoding at the last cached frame prior to the target frame instead of the key frame.
+  // The least recently used frames are evicted first, key frames are kept preferentially. 0 disables the cache. (default)
+  slapResult slapFileReader_SetFrameCacheSize(IN slapFileReader *pFileReader, const size_t size);
+
   slapResult slapFileReader_GetNextFrame(IN slapFileReader *pFileReader);
   slapResult slapFileReader_RestartVideoStream(IN slapFileReader *pFileReader);
+
+  // Picks up frames that have been appended to a streaming video since it has been opened or last refreshed. (see `slapCreateFileWriterStreaming`)
+  // Readers opened before the first frame has been written also pick up the intra frame step and codec settings of the video with it.
+  // Does nothing if the video had already been finalized when it was opened.
+  slapResult slapFileReader_Refresh(IN slapFileReader *pFileReader);
+
   slapResult slapFileReader_TransformBufferToBGRA(IN slapFileReader *pFileReader);
 
+  // Reads and decodes the next frame straight into caller provided planes (e.g. a mapped texture) instead of the internal buffer. Strides are in bytes.
+  // The internal YUV420 buffer isn't updated, so `slapFileReader_TransformBufferToBGRA(Into)` can't be used for frames decoded this way.
+  slapResult slapFileReader_GetNextFrameInto(IN slapFileReader *pFileReader, OUT void *pY, const size_t strideY, OUT void *pU, OUT void *pV, const size_t strideUV);
+
+  // Like `slapFileReader_GetNextFrameInto`, but only decodes the tiles that intersect the luma rectangle `x`, `y`, `sizeX`, `sizeY`. The rest of the planes is left untouched. Videos that aren't tiled are decoded as a whole.
+  // Intra frames are only reconstructed within the decoded tiles, so the rectangle should only change on key frames. (see `slapFileReader_GetKeyFrameIndex`)
+  slapResult slapFileReader_GetNextFrameRegionInto(IN slapFileReader *pFileReader, const size_t x, const size_t y, const size_t sizeX, const size_t sizeY, OUT void *pY, const size_t strideY, OUT void *pU, OUT void *pV, const size_t strideUV);
+
+  // Converts the current frame to BGRA straight into a caller provided buffer (e.g. a window surface). `stride` is in bytes.
+  slapResult slapFileReader_TransformBufferToBGRAInto(IN slapFileReader *pFileReader, OUT void *pBGRA, const size_t stride);
+
+  // Reads and decodes the next frame to BGRA. YUV420 key frames (see `slapFileWriter_EnableYUV420KeyFrames`) that aren't referenced by the next frame are decoded straight to BGRA in a single call, all other frames are decoded into the internal YUV420 buffer and converted.
+  // The internal YUV420 buffer isn't updated for frames that have been decoded straight to BGRA. `stride` is in bytes.
+  slapResult slapFileReader_GetNextFrameBGRAInto(IN slapFileReader *pFileReader, OUT void *pBGRA, const size_t stride);
+
+  // Copies the 4:2:0 JPEG of the key frame `frameIndex` of a video with YUV420 key frames into `pJpeg`, so it can be used by any JPEG decoder (e.g. for thumbnails). Doesn't change the current frame.
+  // `*pSize` is the capacity of `pJpeg` and receives the size of the JPEG. Only the size is returned if `pJpeg` is NULL.
+  // Returns `slapError_StateInvalid` if the frame isn't a key frame or the video hasn't been encoded with YUV420 key frames.
+  slapResult slapFileReader_GetKeyFrameJpeg(IN slapFileReader *pFileReader, const size_t frameIndex, OUT void *pJpeg, IN_OUT size_t *pSize);
+
   slapResult slapFileReader_GetResolution(IN slapFileReader *pFileReader, OUT size_t *pResolutionX, OUT size_t *pResolutionY);
   size_t slapFileReader_GetFrameCount(IN slapFileReader *pFileReader);
   size_t slapFileReader_GetIntraFrameStep(IN slapFileReader *pFileReader);
@@ -82,11 +216,46 @@ extern "C" {
   // If intra frame step = 1: Set the frame index to the specified frame index.
   slapResult slapFileReader_SetFrameIndex(IN slapFileReader *pFileReader, const size_t frameIndex);
 
+  // Set the frame index to exactly the specified frame index, so the next call to `slapFileReader_GetNextFrame` (or any of the `...Into` functions) returns that frame.
+  // The frames from the closest full frame up to the specified frame are decoded into the internal buffer. If the specified frame is ahead of the current frame and no full frame lies in between, decoding continues at the current frame.
+  slapResult slapFileReader_SetFrameIndexExact(IN slapFileReader *pFileReader, const size_t frameIndex);
+
+  // Returns the index of the closest full frame at or prior to the specified frame index, or (size_t)-1 if the frame doesn't exist.
+  // Full frames are placed every IntraFrameStep frames, unless scene change detection has been enabled while encoding.
+  size_t slapFileReader_GetKeyFrameIndex(IN slapFileReader *pFileReader, const size_t frameIndex);
+
   size_t slapFileReader_GetFrameIndex(IN slapFileReader *pFileReader);
 
   const void * slapFileReader_GetBufferYUV420(IN slapFileReader *pFileReader);
+  const void * slapFileReader_GetBufferY(IN slapFileReader *pFileReader);
   const void * slapFileReader_GetBufferBGRA(IN slapFileReader *pFileReader);
 
+  typedef struct slapFileReaderAsync slapFileReaderAsync;
+
+  typedef enum slapFileReaderAsyncFlags
+  {
+    slapFileReaderAsync_DecodeBGRA = 1 << 0, // Also converts every frame to BGRA on the decoding thread.
+    slapFileReaderAsync_Loop = 1 << 1, // Restarts the video stream once the end of the stream has been reached.
+    slapFileReaderAsync_MemoryMapped = 1 << 2, // Reads the file through `slapCreateFileReaderMapped`.
+    slapFileReaderAsync_Reverse = 1 << 3, // Plays the video backwards. Every group of frames from a key frame to the next one is decoded forward once and handed over in reverse order, while the previous group is decoded in the meantime. Needs 2 * IntraFrameStep additional frames of memory.
+    slapFileReaderAsync_PingPong = 1 << 4, // Plays the video forward and then backwards (or the other way around with `slapFileReaderAsync_Reverse`) without repeating the frames at the turning points. Loops with `slapFileReaderAsync_Loop`. Needs the same memory as `slapFileReaderAsync_Reverse`.
+  } slapFileReaderAsyncFlags;
+
+  // Decodes up to `bufferedFrameCount` frames ahead on a separate thread.
+  // flags: combination of `slapFileReaderAsyncFlags`.
+  slapFileReaderAsync * slapCreateFileReaderAsync(const char *filename, const size_t bufferedFrameCount, const uint64_t flags);
+  void slapDestroyFileReaderAsync(IN_OUT slapFileReaderAsync **ppFileReaderAsync);
+
+  // Waits up to `timeoutMs` milliseconds for the next decoded frame. ((uint32_t)-1: wait indefinitely, 0: don't wait.)
+  // Returns `slapError_Timeout` if no frame has been decoded in time and `slapError_EndOfStream` at the end of a non-looping video.
+  // The buffers remain valid until the frame is released. `ppDecodedFrameBGRA` requires `slapFileReaderAsync_DecodeBGRA`. Any OUT parameter may be NULL.
+  slapResult slapFileReaderAsync_AcquireFrame(IN slapFileReaderAsync *pFileReaderAsync, const uint32_t timeoutMs, OUT const void **ppDecodedFrameYUV, OUT const void **ppDecodedFrameBGRA, OUT size_t *pFrameIndex);
+  slapResult slapFileReaderAsync_ReleaseFrame(IN slapFileReaderAsync *pFileReaderAsync);
+
+  slapResult slapFileReaderAsync_GetResolution(IN slapFileReaderAsync *pFileReaderAsync, OUT size_t *pResolutionX, OUT size_t *pResolutionY);
+  size_t slapFileReaderAsync_GetFrameCount(IN slapFileReaderAsync *pFileReaderAsync);
+  size_t slapFileReaderAsync_GetIntraFrameStep(IN slapFileReaderAsync *pFileReaderAsync);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,10 +15,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <setjmp.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
 
 #include "slapcodec2D.h"
 
 #include "turbojpeg.h"
+#include "jpeglib.h"
 
 #include "apex_memmove/apex_memmove.h"
 #include "apex_memmove/apex_memmove.c"
@@ -33,6 +38,8 @@
 #define slapRealloc(ptr, Type, count) (*ptr = (Type *)realloc(*ptr, sizeof(Type) * (count)))
 #define slapFreePtr(ptr)  do { if (ptr && *ptr) { free(*ptr); *ptr = NULL; } } while (0)
 #define slapSetZero(ptr, Type) memset(ptr, 0, sizeof(Type))
+#define slapFSeek(pFile, offset, origin) _fseeki64(pFile, (int64_t)(offset), origin)
+#define slapFTell(pFile) _ftelli64(pFile)
 #define slapStrCpy(target, source) do { size_t size = strlen(source) + 1; target = slapAlloc(char, size); if (target) { memcpy(target, source, size); } } while (0)
 
 #ifdef _DEBUG
@@ -52,6 +59,17 @@
 #define SLAP_PRE_HEADER_FRAME_SIZEY_INDEX 3
 #define SLAP_PRE_HEADER_IFRAME_STEP_INDEX 4
 #define SLAP_PRE_HEADER_CODEC_FLAGS_INDEX 5
+#define SLAP_PRE_HEADER_INDEX_OFFSET_INDEX 6
+#define SLAP_PRE_HEADER_CONTAINER_FLAGS_INDEX 7
+
+#define SLAP_CONTAINER_FLAG_STREAMING 1
+#define SLAP_CONTAINER_FLAG_COMPACT_INDEX 2 // The header is a compact index (see `_slapFrameIndex`) instead of `SLAP_HEADER_PER_FRAME_SIZE` values per frame.
+
+#define SLAP_PACKET_MAGIC 0x544B435050414C53 // "SLAPPCKT"
+#define SLAP_PACKET_MAGIC_INDEX 0
+#define SLAP_PACKET_FRAME_INDEX_INDEX 1
+#define SLAP_PACKET_SUB_FRAME_SIZE_OFFSET 2
+#define SLAP_PACKET_HEADER_SIZE (SLAP_PACKET_SUB_FRAME_SIZE_OFFSET + SLAP_SUB_BUFFER_COUNT)
 
 #define SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET 2
 #define SLAP_HEADER_PER_FRAME_SIZE (SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + SLAP_SUB_BUFFER_COUNT * 2)
@@ -59,19 +77,126 @@
 #define SLAP_HEADER_FRAME_OFFSET_INDEX 0
 #define SLAP_HEADER_FRAME_DATA_SIZE_INDEX 1
 
+#define SLAP_KEY_FRAME_FLAG ((uint64_t)1 << 63) // Set in the frame data size (and the packet frame index) of key frames if key frames are placed adaptively.
+
+// Compact index: Every group of `SLAP_FRAME_INDEX_ANCHOR_INTERVAL` frames starts at an anchor, so a frame is found by decoding at most one group of records.
+#define SLAP_FRAME_INDEX_ANCHOR_INTERVAL 64 // The key frames of a group are a bit mask in its anchor.
+#define SLAP_FRAME_INDEX_ANCHOR_SIZE 3
+#define SLAP_FRAME_INDEX_ANCHOR_RECORD_POSITION_INDEX 0
+#define SLAP_FRAME_INDEX_ANCHOR_FRAME_OFFSET_INDEX 1 // The end of the frame before the group.
+#define SLAP_FRAME_INDEX_ANCHOR_KEY_FRAME_MASK_INDEX 2
+#define SLAP_FRAME_INDEX_RECORD_MAX_SIZE ((SLAP_HEADER_PER_FRAME_SIZE + 1) * 10) // Every value of a record takes up at most 10 bytes.
+
 #define SLAP_IFRAME_STEP 1
 
+#define SLAP_SKIP_BLOCK_SIZE 16 // Chroma blocks are half the size.
+
+#define SLAP_MOTION_BLOCK_SIZE 16 // Chroma blocks are half the size and use half the motion vector.
+#define SLAP_MOTION_VECTOR_MAX 64
+#define SLAP_MOTION_SEARCH_STEP 8
+
+#define SLAP_SCENE_CHANGE_HISTOGRAM_SIZE 64
+
+#define SLAP_JPEG_QUALITY_MARKER (JPEG_APP0 + 15) // Stores the quality of abbreviated JPEG datastreams, so the decoder can generate the tables they've been compressed with.
+
+#define SLAP_TILE_ALIGNMENT 16 // Tiles start at multiples of this many luma pixels, so the chroma planes share the tile grid.
+#define SLAP_TILE_COUNT_MAX 16 // Per row and column.
+
+#define SLAP_DECODE_SCALE_MAX 8 // The smallest IDCT scaling factor of libjpeg-turbo is 1/8.
+
+// Values of `mode.flags.encoder`. Older videos have been written with 0 or 1 (whatever has been passed as `flags` to the file writer), which both stand for planes.
+#define SLAP_FRAME_ENCODER_PLANES 1 // Every plane is compressed into a grayscale JPEG of its own.
+#define SLAP_FRAME_ENCODER_YUV420_KEY_FRAMES 2 // Key frames are compressed into a single 4:2:0 JPEG, which is stored in the luma sub buffer. The chroma sub buffers of key frames are empty.
+
+#define SLAP_RATE_CONTROL_WINDOW 32 // Average frame size rate control pays back the bytes it has saved or overspent over this many frames.
+
 typedef union mode
 {
   uint64_t flagsPack;
 
   struct flags
   {
-    unsigned int encoder : 4;
+    unsigned int encoder : 4; // `SLAP_FRAME_ENCODER_*`
+    unsigned int blockSkip : 1;
+    unsigned int motionCompensation : 1;
+    unsigned int adaptiveKeyFrames : 1;
+    unsigned int tileColumns : 8; // 0 if the frames aren't tiled.
+    unsigned int tileRows : 8;
+    unsigned int sharedJpegTables : 1;
   } flags;
 
 } mode;
 
+// `jmp_buf` is 16 byte aligned on x64, so these structs are padded (C4324).
+#pragma warning(push)
+#pragma warning(disable: 4324)
+
+typedef struct _slapJpegErrorManager
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf jumpBuffer;
+} _slapJpegErrorManager;
+
+// Shared JPEG tables: Planes are compressed as abbreviated JPEG datastreams without any tables through the `jpeglib.h` API instead of turbojpeg. The quantization and Huffman tables only depend on the quality, which is stored in a `SLAP_JPEG_QUALITY_MARKER` marker.
+typedef struct _slapJpegCompressor
+{
+  struct jpeg_compress_struct info;
+  _slapJpegErrorManager error;
+} _slapJpegCompressor;
+
+typedef struct _slapJpegDecompressor
+{
+  struct jpeg_decompress_struct info;
+  _slapJpegErrorManager error;
+  struct jpeg_compress_struct tables; // Only used to generate the tables for a quality.
+  int quality; // The quality that the tables of `info` have been generated for, 0 if none.
+} _slapJpegDecompressor;
+
+#pragma warning(pop)
+
+typedef void (*_slapTaskFunc)(void *pUserData);
+
+typedef struct _slapTask
+{
+  _slapTaskFunc pFunc;
+  void *pUserData;
+  size_t *pPendingCount;
+} _slapTask;
+
+#define SLAP_THREAD_POOL_MAX_TASKS 64
+
+typedef struct _slapThreadPool
+{
+  HANDLE *pThreads;
+  size_t threadCount;
+  bool_t running;
+
+  CRITICAL_SECTION lock;
+  CONDITION_VARIABLE taskAvailable;
+  CONDITION_VARIABLE taskCompleted;
+
+  _slapTask tasks[SLAP_THREAD_POOL_MAX_TASKS];
+  size_t taskStartIndex;
+  size_t taskCount;
+} _slapThreadPool;
+
+typedef struct _slapRateControlState
+{
+  slapRateControl mode;
+  size_t targetFrameSize;
+  int64_t balance; // Bytes that have been saved (or overspent if negative) compared to the average target frame size so far.
+
+  // Indexed by frame type (0: full frame, 1: intra frame) and plane. The quality is 0 if no frame of that type has been coded yet.
+  int planeQuality[2][SLAP_SUB_BUFFER_COUNT];
+  size_t planeSize[2][SLAP_SUB_BUFFER_COUNT]; // Scaled up to the whole frame for block skip coded frames.
+  size_t intraFrameRows; // The amount of luma rows the last intra frame has been coded with.
+
+  // Picked for the current frame.
+  int subFrameQuality[SLAP_SUB_BUFFER_COUNT];
+  size_t subFrameSizeLimit[SLAP_SUB_BUFFER_COUNT];
+  size_t subFrameSize[SLAP_SUB_BUFFER_COUNT];
+} _slapRateControlState;
+
 typedef struct slapEncoder
 {
   size_t frameIndex;
@@ -80,16 +205,94 @@ typedef struct slapEncoder
   size_t resY;
   uint8_t *pLastFrame;
 
+  bool_t isKeyFrame;
+  size_t nextKeyFrameIndex; // Frames are key frames from here on at the latest.
+
+  // Scene change detection: Key frames are also placed wherever the luma histogram changes too much from one frame to the next.
+  size_t sceneChangeThreshold;
+  uint32_t lumaHistogram[SLAP_SCENE_CHANGE_HISTOGRAM_SIZE];
+  bool_t hasLumaHistogram;
+
   mode mode;
 
   int quality;
   int iframeQuality;
+  slapReconstruction reconstruction;
   void *pEncoderInternal[SLAP_SUB_BUFFER_COUNT];
   void *pDecoderInternal[SLAP_SUB_BUFFER_COUNT];
   void *pCompressedBuffers[SLAP_SUB_BUFFER_COUNT];
   size_t compressedSubBufferSizes[SLAP_SUB_BUFFER_COUNT];
+
+  // Block skip coding: Intra frames only contain the blocks that changed since the last frame, packed one after another into `pBlockFrame`.
+  size_t blockSkipThreshold;
+  bool_t isBlockSkipFrame;
+  uint8_t *pBlockFrame;
+  uint8_t *pChangedBlockBitmap;
+  uint8_t *pBlockSkipReference; // The source every block has last been coded from. Closed loop only: Blocks are compared against it instead of the reconstructed last frame, so the coding error doesn't count as change.
+  size_t blockRows;
+
+  // Motion compensation: Intra frames are predicted from motion compensated 16x16 blocks of the last frame.
+  bool_t isMotionCompensatedFrame;
+  int8_t *pMotionVectors;
+  uint8_t *pMotionSourceFrame; // Open loop only: The current source frame, which becomes the last frame once the frame has been encoded.
+
+  // Side data (the changed block bitmap or the motion vectors) is stored in front of the compressed luma plane.
+  uint8_t *pSideDataSubFrame;
+  size_t sideDataSubFrameCapacity;
+
+  // Tiled frames: Every tile is compressed into `pCompressedBuffers` and appended to the tiled sub buffer of its plane.
+  uint8_t *pTiledSubBuffers[SLAP_SUB_BUFFER_COUNT];
+  size_t tiledSubBufferSizes[SLAP_SUB_BUFFER_COUNT];
+  size_t tiledSubBufferCapacities[SLAP_SUB_BUFFER_COUNT];
+
+  _slapRateControlState rateControl;
 } slapEncoder;
 
+typedef struct _slapFrameEncoderBlock
+{
+  size_t frameSize;
+  void *pFrameData;
+} _slapFrameEncoderBlock;
+
+typedef struct _slapAsyncGroup
+{
+  slapEncoder *pEncoder;
+  uint8_t *pFrameData;
+  size_t frameCount;
+  size_t firstFrameIndex;
+  size_t *pSubFrameSizes;
+  bool_t *pKeyFrames;
+  uint8_t *pCompressedData;
+  size_t compressedDataSize;
+  size_t compressedDataCapacity;
+  size_t pendingTasks;
+  slapResult result;
+  int64_t rateControlBalance; // The rate control balance of the main encoder when the group has been enqueued.
+} _slapAsyncGroup;
+
+// Frames are stored as variable-length records (LEB128) without the key frame flag.
+// A frame that starts at the end of the last frame (or after a gap, like the packet headers of streaming videos) and whose sub buffers follow each other is stored as the gap shifted left by one bit followed by the sizes of its sub buffers.
+// Any other frame is stored as 1 followed by its offset, its size and the offsets and sizes of its sub buffers.
+// Videos with a compact index store the anchors followed by the records, padded to a multiple of 8 bytes.
+typedef struct _slapFrameIndex
+{
+  uint64_t frameCount;
+  uint64_t frameOffset; // The end of the last frame.
+  uint64_t *pAnchors; // `SLAP_FRAME_INDEX_ANCHOR_SIZE` values per group.
+  size_t anchorCapacity;
+  uint8_t *pRecords;
+  size_t recordsSize;
+  size_t recordsCapacity;
+  bool_t isMapped; // `pAnchors` and `pRecords` point into a mapped file, so frames can't be added.
+} _slapFrameIndex;
+
+typedef enum _slapFileWriterContainer
+{
+  _slapFileWriterContainer_TempFiles,
+  _slapFileWriterContainer_SinglePass,
+  _slapFileWriterContainer_Streaming,
+} _slapFileWriterContainer;
+
 typedef struct slapFileWriter
 {
   FILE *pMainFile;
@@ -101,6 +304,20 @@ typedef struct slapFileWriter
   uint64_t frameSizeOffsets[SLAP_HEADER_BLOCK_SIZE];
   size_t frameSizeOffsetIndex;
   char *filename;
+  _slapThreadPool *pThreadPool;
+  _slapAsyncGroup *pAsyncGroups;
+  size_t maxGroupsInFlight;
+  size_t groupsInFlight;
+  size_t asyncGroupStartIndex;
+
+  // Single-pass and streaming writers write the payload straight into the final file and keep full header blocks in memory until the header is appended on finalize.
+  _slapFileWriterContainer container;
+  uint64_t payloadOffset;
+  uint64_t *pHeaderBlocks;
+  size_t headerBlocksSize;
+  size_t headerBlocksCapacity;
+
+  _slapFrameIndex *pIndex; // Only used if the compact index is enabled: Frames are added to the index instead of the header. (see `slapFileWriter_EnableCompactIndex`)
 } slapFileWriter;
 
 typedef struct slapDecoder
@@ -110,12 +327,55 @@ typedef struct slapDecoder
   size_t resX;
   size_t resY;
 
+  // Frames are decoded at `1 / scale` of the resolution of the video. `pLastFrame` and `pBlockFrame` have the decoded resolution.
+  size_t scale;
+  size_t decodedResX;
+  size_t decodedResY;
+
+  // Only the luma plane is decoded. `pLastFrame` and `pBlockFrame` only hold the luma plane.
+  bool_t lumaOnly;
+
   mode mode;
 
   void *pDecoders[SLAP_SUB_BUFFER_COUNT];
   uint8_t *pLastFrame;
+  bool_t isKeyFrame; // Set by the file reader for the frame that is being decoded.
+
+  // Only used for block skip coded videos. `pChangedBlockBitmap` points into the current frame.
+  uint8_t *pBlockFrame;
+  const uint8_t *pChangedBlockBitmap;
+  size_t blockRows;
+
+  // Only used for motion compensated videos. Points into the current frame.
+  const int8_t *pMotionVectors;
+
+  // Only used for tiled videos that are decoded on multiple threads: One decompressor per tile of every plane.
+  void **ppTileDecoders;
+
+  // Converts frames to BGRA and decodes 4:2:0 key frames straight to BGRA. The plane decompressors aren't turbojpeg handles if the video uses shared JPEG tables.
+  tjhandle bgraDecoder;
 } slapDecoder;
 
+typedef struct _slapDecodeTileTask
+{
+  slapDecoder *pDecoder;
+  size_t subFrameIndex;
+  size_t tileIndex;
+  const uint8_t *pCompressedData;
+  size_t length;
+  uint8_t *pPlane;
+  size_t stride;
+  slapResult result;
+} _slapDecodeTileTask;
+
+typedef struct _slapCachedFrame
+{
+  size_t frameIndex;
+  uint64_t lastAccess;
+  bool_t isKeyFrame;
+  uint8_t *pData; // The decoded frame, which also is the reference of the next frame.
+} _slapCachedFrame;
+
 typedef struct slapFileReader
 {
   FILE *pFile;
@@ -127,13 +387,87 @@ typedef struct slapFileReader
   void *pDecodedFrameBGRA;
 
   uint64_t preHeaderBlock[SLAP_PRE_HEADER_SIZE];
-  uint64_t *pHeader;
-  size_t headerOffset;
+  _slapFrameIndex *pIndex;
+  uint64_t headerOffset;
   size_t frameIndex;
+  uint64_t currentFrameHeader[SLAP_HEADER_PER_FRAME_SIZE]; // The header of the frame that has been read last.
 
   slapDecoder *pDecoder;
+  _slapThreadPool *pThreadPool;
+  _slapDecodeTileTask *pTileTasks; // Only used for tiled videos that are decoded on multiple threads.
+
+  // Only used by readers created with `slapCreateFileReaderMapped`. `pCurrentFrame` (and compact indices) point into the mapped file.
+  // Readers created with `slapCreateFileReaderFromVideo` share the mapped file and the index of `pVideo` and don't own any handles.
+  slapVideo *pVideo;
+  HANDLE mappedFile;
+  HANDLE fileMapping;
+  uint8_t *pMappedFile;
+  uint64_t mappedFileSize;
+
+  // Only used for streaming videos that haven't been finalized: The index is recovered from the frame packets up to `streamPosition`.
+  uint64_t streamPosition;
+
+  // Only used if a frame cache size has been set: Frames decoded into the internal buffer, keyed by frame index. (see `slapFileReader_SetFrameCacheSize`)
+  _slapCachedFrame *pCachedFrames;
+  size_t cachedFrameCount;
+  size_t cachedFrameCapacity;
+  uint64_t cacheAccessCount;
+  size_t frameCacheSize;
 } slapFileReader;
 
+typedef struct slapVideo
+{
+  slapFileReader *pFileReader; // Owns the mapped file and the index. Doesn't have a decoder.
+  volatile LONG referenceCount; // The creator and every reader created from the video hold a reference.
+} slapVideo;
+
+typedef struct _slapAsyncDecodedFrame
+{
+  void *pDecodedFrameYUV;
+  void *pDecodedFrameBGRA;
+  size_t frameIndex;
+  slapResult result;
+} _slapAsyncDecodedFrame;
+
+// A group of frames from a key frame up to the next key frame that is decoded forward and handed to the consumer in reverse order.
+typedef struct _slapAsyncFrameGroup
+{
+  void **ppDecodedFramesYUV; // `IntraFrameStep` frames. Handed over frames are swapped with the buffers of the ring buffer.
+  size_t firstFrameIndex;
+  size_t frameCount;
+  size_t decodedFrameCount;
+  size_t remainingFrameCount; // Decoded frames that haven't been handed to the consumer yet.
+  bool_t failed;
+} _slapAsyncFrameGroup;
+
+typedef struct slapFileReaderAsync
+{
+  slapFileReader *pFileReader;
+  void *pOwnDecodedFrameYUV;
+  void *pOwnDecodedFrameBGRA;
+  uint64_t flags;
+
+  _slapAsyncDecodedFrame *pFrames;
+  size_t frameCount;
+
+  // Only used for reverse and ping-pong playback: The current group is handed to the consumer while the previous group is decoded.
+  _slapAsyncFrameGroup groups[2];
+  size_t groupCapacity;
+  size_t currentGroup;
+  bool_t reverse;
+  bool_t secondPass; // Ping-pong playback without looping ends after the second pass.
+
+  // Single producer, single consumer: `writeIndex` is only modified by the decoding thread, `readIndex` only by the consumer.
+  volatile LONG writeIndex;
+  volatile LONG readIndex;
+  volatile LONG running;
+  bool_t frameAcquired;
+
+  HANDLE frameAvailableEvent;
+  HANDLE frameReleasedEvent;
+  HANDLE thread;
+} slapFileReaderAsync;
+
 slapEncoder * slapCreateEncoder(const size_t sizeX, const size_t sizeY, const uint64_t flags);
 void slapDestroyEncoder(IN_OUT slapEncoder **ppEncoder);
 
@@ -148,30 +482,188 @@ slapResult slapEncoder_EndSubFrame(IN slapEncoder *pEncoder, IN void *pData, con
 
 slapResult slapEncoder_EndFrame(IN slapEncoder *pEncoder, IN void *pData);
 
+bool_t _slapEncoder_NeedsReconstruction(IN slapEncoder *pEncoder);
+bool_t _slapEncoder_IsYUV420Frame(IN slapEncoder *pEncoder);
+slapResult _slapEncoder_AllocateBlockSkipBuffers(IN slapEncoder *pEncoder);
+slapResult _slapEncoder_BeginBlockSkipFrame(IN slapEncoder *pEncoder, IN void *pData);
+slapResult _slapEncoder_BeginMotionCompensatedFrame(IN slapEncoder *pEncoder, IN void *pData);
+bool_t _slapEncoder_DetectSceneChange(IN slapEncoder *pEncoder, IN const uint8_t *pData);
+slapResult _slapEncoder_PrependSideData(IN slapEncoder *pEncoder, IN const void *pSideData, const size_t sideDataSize, IN_OUT void **ppCompressedData, IN_OUT size_t *pSize);
+slapResult _slapEncoder_CompressSubFrame(IN slapEncoder *pEncoder, IN uint8_t *pSource, const size_t sizeY, const int quality, const size_t subFrameIndex);
+slapResult _slapEncoder_CompressTiledSubFrame(IN slapEncoder *pEncoder, IN uint8_t *pPlane, const int quality, const size_t subFrameIndex);
+size_t _slapEncoder_GetCompressedSubFrameSize(IN slapEncoder *pEncoder, const size_t subFrameIndex);
+size_t _slapEncoder_GetIntraFrameSideDataSize(IN slapEncoder *pEncoder);
+void _slapEncoder_BeginRateControlFrame(IN slapEncoder *pEncoder);
+void _slapEncoder_EndRateControlFrame(IN slapEncoder *pEncoder);
+
 slapDecoder * slapCreateDecoder(const size_t sizeX, const size_t sizeY, const uint64_t flags);
 void slapDestroyDecoder(IN_OUT slapDecoder **ppDecoder);
 
 slapResult slapDecoder_DecodeSubFrame(IN slapDecoder *pDecoder, const size_t decoderIndex, IN void **ppCompressedData, IN size_t *pLength, IN_OUT void *pYUVData);
 slapResult slapDecoder_FinalizeFrame(IN slapDecoder *pDecoder, IN void *pData, const size_t length, IN_OUT void *pYUVData);
+slapResult _slapDecoder_DecodeSubFrameToPlane(IN slapDecoder *pDecoder, const size_t decoderIndex, IN void **ppCompressedData, IN size_t *pLength, OUT void *pPlane, const size_t stride);
+// Only the luma region `x`, `y`, `sizeX`, `sizeY` (and the co-located chroma region) of the planes is finalized. (see `_slapDecoder_GetTileAlignedRegion`)
+slapResult _slapDecoder_FinalizeFramePlanes(IN slapDecoder *pDecoder, IN_OUT uint8_t **ppPlanes, const size_t *pStrides, const size_t x, const size_t y, const size_t sizeX, const size_t sizeY);
+// Expands the luma region (in decoded pixels) to the tiles that it intersects. Frames that aren't tiled can only be decoded as a whole.
+void _slapDecoder_GetTileAlignedRegion(IN slapDecoder *pDecoder, IN_OUT size_t *pX, IN_OUT size_t *pY, IN_OUT size_t *pSizeX, IN_OUT size_t *pSizeY);
+slapResult _slapDecoder_AllocateTileDecoders(IN slapDecoder *pDecoder);
+bool_t _slapDecoder_IsScaleSupported(IN slapDecoder *pDecoder, const size_t scale);
+slapResult _slapDecoder_SetScale(IN slapDecoder *pDecoder, const size_t scale);
+slapResult _slapDecoder_EnableLumaOnly(IN slapDecoder *pDecoder);
+size_t _slapDecoder_GetPlaneCount(IN slapDecoder *pDecoder);
+size_t _slapDecoder_GetDecodedFrameSize(IN slapDecoder *pDecoder);
+bool_t _slapDecoder_IsBlockSkipFrame(IN slapDecoder *pDecoder);
+bool_t _slapDecoder_IsYUV420Frame(IN slapDecoder *pDecoder);
+slapResult _slapDecoder_ReadChangedBlockBitmap(IN slapDecoder *pDecoder, IN_OUT void **ppCompressedData, IN_OUT size_t *pLength);
+bool_t _slapDecoder_IsMotionCompensatedFrame(IN slapDecoder *pDecoder);
+slapResult _slapDecoder_ReadMotionVectors(IN slapDecoder *pDecoder, IN_OUT void **ppCompressedData, IN_OUT size_t *pLength);
 
 slapResult slapFileReader_ReadNextFrame(IN slapFileReader *pFileReader);
+bool_t _slapFileReader_IsKeyFrame(IN slapFileReader *pFileReader, const size_t frameIndex);
+
+// Returns NULL if the frame isn't cached.
+_slapCachedFrame * _slapFileReader_GetCachedFrame(IN slapFileReader *pFileReader, const size_t frameIndex);
+// Copies the internal buffer into the cache. Evicts the least recently used frame, preferring frames that aren't key frames as long as key frames take up at most half of the cache.
+// Leaves the cache as it is if it runs out of memory.
+slapResult _slapFileReader_CacheDecodedFrame(IN slapFileReader *pFileReader, const size_t frameIndex);
+// Copies the cached frame into the internal buffer and the last frame as if it had just been decoded.
+void _slapFileReader_RestoreCachedFrame(IN slapFileReader *pFileReader, IN _slapCachedFrame *pCachedFrame);
+void _slapFileReader_ClearFrameCache(IN slapFileReader *pFileReader);
+
+// Starts a reverse pass at `frameIndex`.
+void _slapFileReaderAsync_BeginReverse(IN slapFileReaderAsync *pFileReaderAsync, const size_t frameIndex);
+// Decodes the next frame of the group. Groups are decoded one after another, so the reader is only positioned at the start of a group.
+slapResult _slapFileReaderAsync_DecodeGroupFrame(IN slapFileReaderAsync *pFileReaderAsync, IN _slapAsyncFrameGroup *pGroup);
+// Decodes a frame of the group prior to the current group. Returns 0 if there's nothing to decode.
+bool_t _slapFileReaderAsync_DecodePreviousGroupFrame(IN slapFileReaderAsync *pFileReaderAsync);
+// Hands the next frame of a reverse pass to `pFrame`. Returns `slapError_EndOfStream` once the first frame has been handed over.
+slapResult _slapFileReaderAsync_GetPreviousFrame(IN slapFileReaderAsync *pFileReaderAsync, IN _slapAsyncDecodedFrame *pFrame);
+bool_t _slapFileReader_IsUnfinalizedStream(IN slapFileReader *pFileReader);
+slapResult _slapFileReader_BeginStream(IN slapFileReader *pFileReader);
+// Maps the file and reads the pre-header and the index.
+slapResult _slapFileReader_MapFile(IN slapFileReader *pFileReader, const char *filename);
+// Reads the header (or the compact index) into `pIndex`. Expects the file to be positioned at it.
+slapResult _slapFileReader_ReadIndex(IN slapFileReader *pFileReader);
+// Creates the decoder and the internal YUV420 buffer once the pre-header has been read.
+slapResult _slapFileReader_CreateDecoder(IN slapFileReader *pFileReader);
+slapResult _slapFileReader_ScanStream(IN slapFileReader *pFileReader);
+// Picks up the codec flags and the intra frame step of a streaming video that didn't have any frames yet.
+slapResult _slapFileReader_UpdateStreamPreHeader(IN slapFileReader *pFileReader);
 slapResult slapFileReader_DecodeCurrentFrame(IN slapFileReader *pFileReader);
 
 //////////////////////////////////////////////////////////////////////////
 
-slapResult _slapCompressChannel(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pCompressor);
+// `pCompressor` and `pDecompressor` are `_slapJpegCompressor` and `_slapJpegDecompressor` if `sharedJpegTables` is set and turbojpeg handles otherwise.
+void * _slapCreateCompressor(const bool_t sharedJpegTables);
+bool_t _slapJpegCompressor_Initialize(IN_OUT _slapJpegCompressor *pCompressor);
+bool_t _slapJpegDecompressor_Initialize(IN_OUT _slapJpegDecompressor *pDecompressor);
+void _slapDestroyCompressor(IN void *pCompressor, const bool_t sharedJpegTables);
+void * _slapCreateDecompressor(const bool_t sharedJpegTables);
+void _slapDestroyDecompressor(IN void *pDecompressor, const bool_t sharedJpegTables);
+
+slapResult _slapCompressChannel(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const size_t pitch, const int quality, IN void *pCompressor, const bool_t sharedJpegTables);
+slapResult _slapCompressChannelAbbreviated(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const size_t pitch, const int quality, IN _slapJpegCompressor *pCompressor);
 slapResult _slapCompressYUV420(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pCompressor);
-slapResult _slapDecompressChannel(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pDecompressor);
-slapResult _slapDecompressYUV420(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pDecompressor);
+slapResult _slapDecompressChannel(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t pitch, const size_t scale, IN void *pDecompressor, const bool_t sharedJpegTables);
+slapResult _slapDecompressChannelAbbreviated(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t pitch, const size_t scale, IN _slapJpegDecompressor *pDecompressor);
+// Fails for anything but 4:2:0 JPEGs of exactly `width` x `height`, so corrupted frames can't overflow the planes.
+bool_t _slapIsYUV420Jpeg(IN void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pDecompressor);
+slapResult _slapDecompressYUV420(OUT uint8_t **ppPlanes, const size_t *pStrides, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t scale, IN void *pDecompressor);
+// Only decodes the luma component of a 4:2:0 JPEG. The chroma components are skipped by libjpeg-turbo.
+slapResult _slapDecompressYUV420Luma(OUT uint8_t *pPlane, const size_t stride, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t scale, IN void *pDecompressor);
+slapResult _slapDecompressYUV420ToBGRA(OUT void *pBGRA, const size_t stride, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t scale, IN void *pDecompressor);
 void _slapEncodeLastFrameDiff(IN_OUT void *pLastFrame, IN_OUT void *pData, const size_t resX, const size_t resY);
+void _slapEncodeLastFrameDiffOpenLoop(IN_OUT void *pLastFrame, IN_OUT void *pData, const size_t resX, const size_t resY);
 void _slapCopyToLastFrame(IN_OUT void *pData, OUT void *pLastFrame, const size_t resX, const size_t resY);
 void _slapDecodeLastFrameDiff(IN_OUT void *pData, OUT void *pLastFrame, const size_t resX, const size_t resY);
+void _slapDecodeLastFrameDiffPlane(IN_OUT uint8_t *pData, const size_t stride, OUT uint8_t *pLastFrame, const size_t lastFrameStride, const size_t sizeX, const size_t sizeY, const uint8_t half);
 
-typedef struct _slapFrameEncoderBlock
+// Tiled frames: Every plane is split into `tileColumns` x `tileRows` independently compressed tiles. The sub buffer of a plane starts with a table of the `uint32_t` compressed tile sizes, followed by the tiles in row major order.
+// The last column and row of tiles takes up the remainder of the frame.
+size_t _slapGetTileOffset(const size_t resolution, const size_t tileCount, const size_t tileIndex);
+void _slapGetTileRect(const size_t resX, const size_t resY, const size_t tileColumns, const size_t tileRows, const size_t subFrameIndex, const size_t tileIndex, OUT size_t *pX, OUT size_t *pY, OUT size_t *pSizeX, OUT size_t *pSizeY);
+slapResult _slapDecompressTile(OUT uint8_t *pPlane, const size_t stride, IN const uint8_t *pSubFrame, const size_t subFrameSize, const size_t resX, const size_t resY, const size_t tileColumns, const size_t tileRows, const size_t subFrameIndex, const size_t tileIndex, const size_t scale, IN void *pDecompressor, const bool_t sharedJpegTables);
+
+// Block skip coding: A set bit in the changed block bitmap marks a 16x16 luma block (and the co-located 8x8 chroma blocks) that is coded. Changed blocks are stored one after another in rows of `resX / SLAP_SKIP_BLOCK_SIZE` blocks.
+size_t _slapGetChangedBlockBitmapSize(const size_t resX, const size_t resY);
+size_t _slapDetectChangedBlocks(IN const uint8_t *pData, IN const uint8_t *pLastFrame, OUT uint8_t *pChangedBlockBitmap, const size_t resX, const size_t resY, const size_t threshold);
+// Also stores the changed blocks of the source frame in `pReference`, which may alias `pLastFrame`.
+void _slapEncodeChangedBlocksDiff(IN const uint8_t *pLastFrame, IN const uint8_t *pData, OUT uint8_t *pBlockFrame, OUT uint8_t *pReference, IN const uint8_t *pChangedBlockBitmap, const size_t changedBlockCount, const size_t resX, const size_t resY);
+void _slapDecodeChangedBlocksDiff(IN const uint8_t *pBlockFrame, IN_OUT uint8_t *pLastFrame, IN const uint8_t *pChangedBlockBitmap, const size_t resX, const size_t resY, const size_t lumaBlockSize, const size_t planeCount);
+
+uint32_t _slapGetBlockSAD(IN const uint8_t *pA, IN const uint8_t *pB, const size_t stride);
+
+// Motion compensation: Every 16x16 luma block has a motion vector of two `int8_t` (x, y) pointing to its prediction in the last frame. Chroma blocks use half the motion vector.
+size_t _slapGetMotionVectorsSize(const size_t resX, const size_t resY);
+void _slapSearchMotionVectors(IN const uint8_t *pData, IN const uint8_t *pLastFrame, OUT int8_t *pMotionVectors, const size_t resX, const size_t resY);
+void _slapEncodeLastFrameDiffMotion(IN const uint8_t *pLastFrame, IN_OUT uint8_t *pData, IN const int8_t *pMotionVectors, const size_t resX, const size_t resY);
+void _slapDecodeLastFrameDiffMotionPlane(IN_OUT uint8_t *pData, const size_t stride, IN const uint8_t *pLastFramePlane, IN const int8_t *pMotionVectors, const size_t sizeX, const size_t sizeY, const size_t blockSize, const size_t scale, const uint8_t half);
+
+// Returns the quality at which a plane that is `size` bytes large at `quality` is expected to be `targetSize` bytes large. Changes the size by a factor of 4 at most.
+int _slapScaleQuality(const int quality, const size_t size, const size_t targetSize);
+
+// libjpeg scales its quantization tables by this percentage. The compressed size is roughly inversely proportional to it.
+uint64_t _slapGetQuantizationScale(const int quality);
+
+_slapThreadPool * _slapCreateThreadPool(const size_t threadCount);
+void _slapDestroyThreadPool(IN_OUT _slapThreadPool **ppThreadPool);
+
+// Increments `*pPendingCount` and executes the task on one of the worker threads. `*pPendingCount` is decremented once the task is done.
+void _slapThreadPool_Enqueue(IN _slapThreadPool *pThreadPool, IN _slapTaskFunc pFunc, IN void *pUserData, IN_OUT size_t *pPendingCount);
+
+// Waits for `*pPendingCount` to reach zero. The calling thread participates in executing queued tasks while waiting.
+void _slapThreadPool_Wait(IN _slapThreadPool *pThreadPool, IN_OUT size_t *pPendingCount);
+
+typedef struct _slapSubFrameTask
 {
-  size_t frameSize;
-  void *pFrameData;
-} _slapFrameEncoderBlock;
+  slapEncoder *pEncoder;
+  void *pData;
+  size_t subFrameIndex;
+  _slapFrameEncoderBlock *pSubFrame;
+  slapResult result;
+} _slapSubFrameTask;
+
+void _slapEncoder_BeginSubFrameTask(IN void *pUserData);
+void _slapEncoder_EndSubFrameTask(IN void *pUserData);
+void _slapEncoder_EncodeAsyncGroupTask(IN void *pUserData);
+
+typedef struct _slapDecodeSubFrameTask
+{
+  slapDecoder *pDecoder;
+  size_t subFrameIndex;
+  void **ppCompressedData;
+  size_t *pLength;
+  void *pPlane;
+  size_t stride;
+  slapResult result;
+} _slapDecodeSubFrameTask;
+
+void _slapDecoder_DecodeSubFrameTask(IN void *pUserData);
+void _slapDecoder_DecodeTileTask(IN void *pUserData);
+
+slapFileWriter * _slapCreateFileWriter(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags, const _slapFileWriterContainer container);
+slapResult _slapFileWriter_FinalizeSinglePass(IN slapFileWriter *pFileWriter);
+slapResult _slapFileWriter_WriteStreamingPreHeader(IN slapFileWriter *pFileWriter);
+slapResult _slapFileWriter_WriteFrame(IN slapFileWriter *pFileWriter, IN _slapFrameEncoderBlock *pSubFrames, const bool_t isKeyFrame);
+void _slapFileWriter_DestroyAsyncGroups(IN slapFileWriter *pFileWriter);
+
+_slapFrameIndex * _slapCreateFrameIndex(void);
+void _slapDestroyFrameIndex(IN_OUT _slapFrameIndex **ppIndex);
+// `pFrameHeader` has `SLAP_HEADER_PER_FRAME_SIZE` values like the header of a frame.
+slapResult _slapFrameIndex_AddFrame(IN _slapFrameIndex *pIndex, IN const uint64_t *pFrameHeader);
+slapResult _slapFrameIndex_AddFrames(IN _slapFrameIndex *pIndex, IN const uint64_t *pHeader, const size_t frameCount);
+slapResult _slapFrameIndex_GetFrame(IN const _slapFrameIndex *pIndex, const uint64_t frameIndex, OUT uint64_t *pFrameHeader);
+bool_t _slapFrameIndex_IsKeyFrame(IN const _slapFrameIndex *pIndex, const uint64_t frameIndex);
+void _slapFrameIndex_WriteVarInt(IN _slapFrameIndex *pIndex, const uint64_t value);
+slapResult _slapFrameIndex_ReadVarInt(IN const _slapFrameIndex *pIndex, IN_OUT size_t *pPosition, OUT uint64_t *pValue);
+size_t _slapFrameIndex_GetAnchorCount(const uint64_t frameCount);
+// In `uint64_t`s.
+uint64_t _slapFrameIndex_GetSerializedSize(IN const _slapFrameIndex *pIndex);
+slapResult _slapFrameIndex_Write(IN const _slapFrameIndex *pIndex, IN FILE *pFile);
+// Reads a compact index of `headerSize` `uint64_t`s.
+slapResult _slapFrameIndex_Read(IN _slapFrameIndex *pIndex, IN FILE *pFile, const uint64_t headerSize, const uint64_t frameCount);
+// Uses a compact index of `headerSize` `uint64_t`s in place. `pHeader` has to outlive the index.
+slapResult _slapFrameIndex_Map(IN _slapFrameIndex *pIndex, IN const uint64_t *pHeader, const uint64_t headerSize, const uint64_t frameCount);
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -272,12 +764,12 @@ slapEncoder * slapCreateEncoder(const size_t sizeX, const size_t sizeY, const ui
 
   for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
   {
-    pEncoder->pEncoderInternal[i] = tjInitCompress();
+    pEncoder->pEncoderInternal[i] = _slapCreateCompressor(pEncoder->mode.flags.sharedJpegTables);
 
     if (!pEncoder->pEncoderInternal[i])
       goto epilogue;
 
-    pEncoder->pDecoderInternal[i] = tjInitDecompress();
+    pEncoder->pDecoderInternal[i] = _slapCreateDecompressor(pEncoder->mode.flags.sharedJpegTables);
 
     if (!pEncoder->pDecoderInternal[i])
       goto epilogue;
@@ -290,12 +782,10 @@ epilogue:
   for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
   {
     if (pEncoder->pEncoderInternal[i])
-      if (pEncoder->pEncoderInternal[i])
-        tjDestroy(pEncoder->pEncoderInternal[i]);
+      _slapDestroyCompressor(pEncoder->pEncoderInternal[i], pEncoder->mode.flags.sharedJpegTables);
 
     if (pEncoder->pDecoderInternal[i])
-      if (pEncoder->pDecoderInternal[i])
-        tjDestroy(pEncoder->pDecoderInternal[i]);
+      _slapDestroyDecompressor(pEncoder->pDecoderInternal[i], pEncoder->mode.flags.sharedJpegTables);
   }
 
   if ((pEncoder)->pLastFrame)
@@ -313,19 +803,26 @@ void slapDestroyEncoder(IN_OUT slapEncoder **ppEncoder)
     for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
     {
       if ((*ppEncoder)->pEncoderInternal[i])
-        if ((*ppEncoder)->pEncoderInternal[i])
-          tjDestroy((*ppEncoder)->pEncoderInternal[i]);
+        _slapDestroyCompressor((*ppEncoder)->pEncoderInternal[i], (*ppEncoder)->mode.flags.sharedJpegTables);
 
       if ((*ppEncoder)->pDecoderInternal[i])
-        if ((*ppEncoder)->pDecoderInternal[i])
-          tjDestroy((*ppEncoder)->pDecoderInternal[i]);
+        _slapDestroyDecompressor((*ppEncoder)->pDecoderInternal[i], (*ppEncoder)->mode.flags.sharedJpegTables);
 
       if ((*ppEncoder)->pCompressedBuffers[i])
         slapFreePtr(&(*ppEncoder)->pCompressedBuffers[i]);
+
+      slapFreePtr(&(*ppEncoder)->pTiledSubBuffers[i]);
     }
 
     if ((*ppEncoder)->pLastFrame)
       slapFreePtr(&(*ppEncoder)->pLastFrame);
+
+    slapFreePtr(&(*ppEncoder)->pBlockFrame);
+    slapFreePtr(&(*ppEncoder)->pChangedBlockBitmap);
+    slapFreePtr(&(*ppEncoder)->pBlockSkipReference);
+    slapFreePtr(&(*ppEncoder)->pMotionVectors);
+    slapFreePtr(&(*ppEncoder)->pMotionSourceFrame);
+    slapFreePtr(&(*ppEncoder)->pSideDataSubFrame);
   }
 
   slapFreePtr(ppEncoder);
@@ -348,872 +845,5165 @@ slapResult slapEncoder_BeginFrame(IN slapEncoder *pEncoder, IN void *pData)
     goto epilogue;
   }
 
+  pEncoder->isKeyFrame = pEncoder->frameIndex >= pEncoder->nextKeyFrameIndex;
+
+  if (pEncoder->mode.flags.adaptiveKeyFrames && pEncoder->iframeStep > 1 && _slapEncoder_DetectSceneChange(pEncoder, (const uint8_t *)pData))
+    pEncoder->isKeyFrame = 1;
+
+  if (pEncoder->isKeyFrame)
+    pEncoder->nextKeyFrameIndex = pEncoder->frameIndex + pEncoder->iframeStep;
+
+  pEncoder->isBlockSkipFrame = pEncoder->mode.flags.blockSkip && pEncoder->iframeStep > 1 && !pEncoder->isKeyFrame;
+  pEncoder->isMotionCompensatedFrame = pEncoder->mode.flags.motionCompensation && pEncoder->iframeStep > 1 && !pEncoder->isKeyFrame;
+
+  if (pEncoder->mode.flags.blockSkip && pEncoder->iframeStep > 1)
+    if ((result = _slapEncoder_AllocateBlockSkipBuffers(pEncoder)) != slapSuccess)
+      goto epilogue;
+
   if (pEncoder->iframeStep > 1)
   {
-    if (pEncoder->frameIndex % pEncoder->iframeStep != 0)
-      _slapEncodeLastFrameDiff(pEncoder->pLastFrame, pData, pEncoder->resX, pEncoder->resY);
-    else
+    if (pEncoder->isKeyFrame)
+    {
       _slapCopyToLastFrame(pData, pEncoder->pLastFrame, pEncoder->resX, pEncoder->resY);
+
+      if (pEncoder->mode.flags.blockSkip && pEncoder->reconstruction == slapReconstruction_ClosedLoop)
+        _slapCopyToLastFrame(pData, pEncoder->pBlockSkipReference, pEncoder->resX, pEncoder->resY);
+    }
+    else if (pEncoder->isBlockSkipFrame)
+      result = _slapEncoder_BeginBlockSkipFrame(pEncoder, pData);
+    else if (pEncoder->isMotionCompensatedFrame)
+      result = _slapEncoder_BeginMotionCompensatedFrame(pEncoder, pData);
+    else if (pEncoder->reconstruction == slapReconstruction_OpenLoop)
+      _slapEncodeLastFrameDiffOpenLoop(pEncoder->pLastFrame, pData, pEncoder->resX, pEncoder->resY);
+    else
+      _slapEncodeLastFrameDiff(pEncoder->pLastFrame, pData, pEncoder->resX, pEncoder->resY);
+
+    if (result != slapSuccess)
+      goto epilogue;
   }
 
+  if (pEncoder->rateControl.mode != slapRateControl_None)
+    _slapEncoder_BeginRateControlFrame(pEncoder);
+
 epilogue:
   return result;
 }
 
-slapResult slapEncoder_BeginSubFrame(IN slapEncoder *pEncoder, IN void *pData, OUT void **ppCompressedData, OUT size_t *pSize, const size_t subFrameIndex)
+slapResult _slapEncoder_AllocateBlockSkipBuffers(IN slapEncoder *pEncoder)
 {
   slapResult result = slapSuccess;
 
-  if (!pEncoder || !pData || !ppCompressedData || !pSize)
+  if (!pEncoder->pBlockFrame)
   {
-    result = slapError_ArgumentNull;
-    goto epilogue;
+    pEncoder->pBlockFrame = slapAlloc(uint8_t, pEncoder->resX * pEncoder->resY * 3 / 2);
+
+    if (!pEncoder->pBlockFrame)
+    {
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
   }
 
-  const int quality = (pEncoder->frameIndex % pEncoder->iframeStep == 0) ? pEncoder->quality : pEncoder->iframeQuality;
+  if (!pEncoder->pChangedBlockBitmap)
+  {
+    pEncoder->pChangedBlockBitmap = slapAlloc(uint8_t, _slapGetChangedBlockBitmapSize(pEncoder->resX, pEncoder->resY));
 
-  if (subFrameIndex == 0)
-    result = _slapCompressChannel(((uint8_t *)pData), &pEncoder->pCompressedBuffers[subFrameIndex], &pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX, pEncoder->resY, quality, pEncoder->pEncoderInternal[subFrameIndex]);
-  else if (subFrameIndex == 1)
-    result = _slapCompressChannel(((uint8_t *)pData) + pEncoder->resX * pEncoder->resY, &pEncoder->pCompressedBuffers[subFrameIndex], &pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX >> 1, pEncoder->resY >> 1, quality, pEncoder->pEncoderInternal[subFrameIndex]);
-  else if (subFrameIndex == 2)
-    result = _slapCompressChannel(((uint8_t *)pData) + pEncoder->resX * pEncoder->resY * 5 / 4, &pEncoder->pCompressedBuffers[subFrameIndex], &pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX >> 1, pEncoder->resY >> 1, quality, pEncoder->pEncoderInternal[subFrameIndex]);
+    if (!pEncoder->pChangedBlockBitmap)
+    {
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
+  }
 
-  if (result != slapSuccess)
-    goto epilogue;
+  if (!pEncoder->pBlockSkipReference && pEncoder->reconstruction == slapReconstruction_ClosedLoop)
+  {
+    pEncoder->pBlockSkipReference = slapAlloc(uint8_t, pEncoder->resX * pEncoder->resY * 3 / 2);
 
-  *pSize = pEncoder->compressedSubBufferSizes[subFrameIndex];
-  *ppCompressedData = pEncoder->pCompressedBuffers[subFrameIndex];
+    if (!pEncoder->pBlockSkipReference)
+    {
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
+  }
 
 epilogue:
   return result;
 }
 
-slapResult slapEncoder_EndSubFrame(IN slapEncoder *pEncoder, IN void *pData, const size_t subFrameIndex)
+slapResult _slapEncoder_BeginBlockSkipFrame(IN slapEncoder *pEncoder, IN void *pData)
 {
-  slapResult result = slapSuccess;
-
-  uint8_t *pDestination = NULL;
+  const size_t blocksPerRow = pEncoder->resX / SLAP_SKIP_BLOCK_SIZE;
 
-  if (pEncoder->frameIndex % pEncoder->iframeStep != 0)
-    pDestination = (uint8_t *)pData;
-  else
-    pDestination = (uint8_t *)pEncoder->pLastFrame;
+  // The last frame already is the last source frame in open loop reconstruction.
+  uint8_t *pReference = pEncoder->reconstruction == slapReconstruction_ClosedLoop ? pEncoder->pBlockSkipReference : pEncoder->pLastFrame;
 
-  if (subFrameIndex == 0)
-    result = _slapDecompressChannel(pDestination, pEncoder->pCompressedBuffers[subFrameIndex], pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX, pEncoder->resY, pEncoder->pDecoderInternal[subFrameIndex]);
-  else if (subFrameIndex == 1)
-    result = _slapDecompressChannel(pDestination + pEncoder->resX * pEncoder->resY, pEncoder->pCompressedBuffers[subFrameIndex], pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX >> 1, pEncoder->resY >> 1, pEncoder->pDecoderInternal[subFrameIndex]);
-  else if (subFrameIndex == 2)
-    result = _slapDecompressChannel(pDestination + pEncoder->resX * pEncoder->resY * 5 / 4, pEncoder->pCompressedBuffers[subFrameIndex], pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX >> 1, pEncoder->resY >> 1, pEncoder->pDecoderInternal[subFrameIndex]);
+  const size_t changedBlockCount = _slapDetectChangedBlocks((uint8_t *)pData, pReference, pEncoder->pChangedBlockBitmap, pEncoder->resX, pEncoder->resY, pEncoder->blockSkipThreshold);
+  _slapEncodeChangedBlocksDiff(pEncoder->pLastFrame, (uint8_t *)pData, pEncoder->pBlockFrame, pReference, pEncoder->pChangedBlockBitmap, changedBlockCount, pEncoder->resX, pEncoder->resY);
 
-  if (result != slapSuccess)
-    goto epilogue;
+  pEncoder->blockRows = (changedBlockCount + blocksPerRow - 1) / blocksPerRow;
 
-epilogue:
-  return result;
+  return slapSuccess;
 }
 
-slapResult slapEncoder_EndFrame(IN slapEncoder *pEncoder, IN void *pData)
+slapResult _slapEncoder_BeginMotionCompensatedFrame(IN slapEncoder *pEncoder, IN void *pData)
 {
   slapResult result = slapSuccess;
+  const size_t frameSize = pEncoder->resX * pEncoder->resY * 3 / 2;
 
-  if (!pEncoder)
+  if (!pEncoder->pMotionVectors)
   {
-    result = slapError_ArgumentNull;
-    goto epilogue;
-  }
+    pEncoder->pMotionVectors = slapAlloc(int8_t, _slapGetMotionVectorsSize(pEncoder->resX, pEncoder->resY));
 
-  if (pEncoder->iframeStep > 1)
-  {
-    if (pEncoder->frameIndex % pEncoder->iframeStep != 0)
-      _slapDecodeLastFrameDiff(pData, pEncoder->pLastFrame, pEncoder->resX, pEncoder->resY);
+    if (!pEncoder->pMotionVectors)
+    {
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
   }
 
-  pEncoder->frameIndex++;
+  _slapSearchMotionVectors((uint8_t *)pData, pEncoder->pLastFrame, pEncoder->pMotionVectors, pEncoder->resX, pEncoder->resY);
 
-epilogue:
-  return result;
-}
+  // Blocks are predicted from anywhere in the last frame, so it can't be replaced while the difference is being calculated.
+  if (pEncoder->reconstruction == slapReconstruction_OpenLoop)
+  {
+    if (!pEncoder->pMotionSourceFrame)
+    {
+      pEncoder->pMotionSourceFrame = slapAlloc(uint8_t, frameSize);
 
-slapResult _slapWriteToHeader(IN slapFileWriter *pFileWriter, const uint64_t data)
-{
-  slapResult result = slapSuccess;
+      if (!pEncoder->pMotionSourceFrame)
+      {
+        result = slapError_MemoryAllocation;
+        goto epilogue;
+      }
+    }
 
-  pFileWriter->frameSizeOffsets[pFileWriter->frameSizeOffsetIndex++] = data;
-  pFileWriter->headerPosition++;
+    slapMemcpy(pEncoder->pMotionSourceFrame, pData, frameSize);
+  }
 
-  if (pFileWriter->frameSizeOffsetIndex >= (uint64_t)SLAP_HEADER_BLOCK_SIZE)
+  _slapEncodeLastFrameDiffMotion(pEncoder->pLastFrame, (uint8_t *)pData, pEncoder->pMotionVectors, pEncoder->resX, pEncoder->resY);
+
+  if (pEncoder->reconstruction == slapReconstruction_OpenLoop)
   {
-    if ((size_t)SLAP_HEADER_BLOCK_SIZE != fwrite(pFileWriter->frameSizeOffsets, sizeof(uint64_t), SLAP_HEADER_BLOCK_SIZE, pFileWriter->pHeaderFile))
-    {
-      result = slapError_FileError;
-      goto epilogue;
-    }
+    uint8_t *pLastFrame = pEncoder->pLastFrame;
 
-    pFileWriter->frameSizeOffsetIndex = 0;
+    pEncoder->pLastFrame = pEncoder->pMotionSourceFrame;
+    pEncoder->pMotionSourceFrame = pLastFrame;
   }
 
 epilogue:
   return result;
 }
 
-slapFileWriter * slapCreateFileWriter(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags)
+// Compares the luma histogram of every other row of the frame to the one of the last frame.
+bool_t _slapEncoder_DetectSceneChange(IN slapEncoder *pEncoder, IN const uint8_t *pData)
 {
-  slapFileWriter *pFileWriter = slapAlloc(slapFileWriter, 1);
-  char filenameBuffer[0xFF];
-  char headerFilenameBuffer[0xFF];
+  uint32_t histogram[SLAP_SCENE_CHANGE_HISTOGRAM_SIZE];
+  const size_t sampleCount = pEncoder->resX * ((pEncoder->resY + 1) / 2);
+  size_t difference = 0;
+  bool_t isSceneChange = 0;
 
-  if (!pFileWriter)
-    goto epilogue;
-
-  slapSetZero(pFileWriter, slapFileWriter);
-  slapStrCpy(pFileWriter->filename, filename);
+  memset(histogram, 0, sizeof(histogram));
 
-  if (!pFileWriter->filename)
-    goto epilogue;
+  for (size_t y = 0; y < pEncoder->resY; y += 2)
+  {
+    const uint8_t *pLine = pData + y * pEncoder->resX;
 
-  pFileWriter->pEncoder = slapCreateEncoder(sizeX, sizeY, flags);
+    for (size_t x = 0; x < pEncoder->resX; x++)
+      histogram[pLine[x] / (256 / SLAP_SCENE_CHANGE_HISTOGRAM_SIZE)]++;
+  }
 
-  if (!pFileWriter->pEncoder)
-    goto epilogue;
+  if (pEncoder->hasLumaHistogram)
+  {
+    for (size_t i = 0; i < SLAP_SCENE_CHANGE_HISTOGRAM_SIZE; i++)
+      difference += histogram[i] > pEncoder->lumaHistogram[i] ? histogram[i] - pEncoder->lumaHistogram[i] : pEncoder->lumaHistogram[i] - histogram[i];
 
-  sprintf_s(filenameBuffer, 0xFF, "%s.video", filename);
-  sprintf_s(headerFilenameBuffer, 0xFF, "%s.header", filename);
+    // Every sample that has moved to another bin is counted twice.
+    isSceneChange = difference * 100 > pEncoder->sceneChangeThreshold * 2 * sampleCount;
+  }
 
-  pFileWriter->pMainFile = fopen(filenameBuffer, "wb");
+  memcpy(pEncoder->lumaHistogram, histogram, sizeof(histogram));
+  pEncoder->hasLumaHistogram = 1;
 
-  if (!pFileWriter->pMainFile)
-    goto epilogue;
+  return isSceneChange;
+}
 
-  pFileWriter->pHeaderFile = fopen(headerFilenameBuffer, "wb");
+slapResult slapEncoder_BeginSubFrame(IN slapEncoder *pEncoder, IN void *pData, OUT void **ppCompressedData, OUT size_t *pSize, const size_t subFrameIndex)
+{
+  slapResult result = slapSuccess;
 
-  if (!pFileWriter->pHeaderFile)
+  if (!pEncoder || !pData || !ppCompressedData || !pSize)
+  {
+    result = slapError_ArgumentNull;
     goto epilogue;
+  }
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
+  if (subFrameIndex >= SLAP_SUB_BUFFER_COUNT)
+  {
+    result = slapError_InvalidParameter;
     goto epilogue;
+  }
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
-    goto epilogue;
+  _slapRateControlState *pRateControl = &pEncoder->rateControl;
+  const size_t frameType = pEncoder->isKeyFrame ? 0 : 1;
+  int quality = frameType == 0 ? pEncoder->quality : pEncoder->iframeQuality;
+  uint8_t *pSource = pEncoder->isBlockSkipFrame ? pEncoder->pBlockFrame : (uint8_t *)pData;
+  const size_t sizeY = pEncoder->isBlockSkipFrame ? pEncoder->blockRows * SLAP_SKIP_BLOCK_SIZE : pEncoder->resY;
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->resX))
-    goto epilogue;
+  if (pRateControl->mode != slapRateControl_None)
+    quality = pRateControl->subFrameQuality[subFrameIndex];
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->resY))
-    goto epilogue;
+  *pSize = 0;
+  *ppCompressedData = NULL;
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->iframeStep))
-    goto epilogue;
+  // Block skip coded frames without any changed blocks don't contain any image data.
+  if (sizeY > 0)
+  {
+    if ((result = _slapEncoder_CompressSubFrame(pEncoder, pSource, sizeY, quality, subFrameIndex)) != slapSuccess)
+      goto epilogue;
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->mode.flagsPack))
-    goto epilogue;
+    // Planes exceeding their share of the maximum frame size are coded again with a lower quality.
+    if (pRateControl->mode == slapRateControl_MaxFrameSize)
+    {
+      while (_slapEncoder_GetCompressedSubFrameSize(pEncoder, subFrameIndex) > pRateControl->subFrameSizeLimit[subFrameIndex] && quality > 1)
+      {
+        const int lowerQuality = _slapScaleQuality(quality, _slapEncoder_GetCompressedSubFrameSize(pEncoder, subFrameIndex), pRateControl->subFrameSizeLimit[subFrameIndex] * 7 / 8);
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
-    goto epilogue;
+        quality = lowerQuality < quality ? lowerQuality : quality - 1;
 
-  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
-    goto epilogue;
+        if ((result = _slapEncoder_CompressSubFrame(pEncoder, pSource, sizeY, quality, subFrameIndex)) != slapSuccess)
+          goto epilogue;
+      }
+    }
 
-  if (pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE)
-    goto epilogue;
+    if (pRateControl->mode != slapRateControl_None)
+    {
+      pRateControl->planeQuality[frameType][subFrameIndex] = quality;
+      pRateControl->planeSize[frameType][subFrameIndex] = _slapEncoder_GetCompressedSubFrameSize(pEncoder, subFrameIndex) * pEncoder->resY / sizeY;
+    }
 
-  return pFileWriter;
+    *pSize = _slapEncoder_GetCompressedSubFrameSize(pEncoder, subFrameIndex);
+    *ppCompressedData = pEncoder->mode.flags.tileColumns ? pEncoder->pTiledSubBuffers[subFrameIndex] : pEncoder->pCompressedBuffers[subFrameIndex];
+  }
+
+  if (pEncoder->isBlockSkipFrame && subFrameIndex == 0)
+    result = _slapEncoder_PrependSideData(pEncoder, pEncoder->pChangedBlockBitmap, _slapGetChangedBlockBitmapSize(pEncoder->resX, pEncoder->resY), ppCompressedData, pSize);
+  else if (pEncoder->isMotionCompensatedFrame && subFrameIndex == 0)
+    result = _slapEncoder_PrependSideData(pEncoder, pEncoder->pMotionVectors, _slapGetMotionVectorsSize(pEncoder->resX, pEncoder->resY), ppCompressedData, pSize);
+
+  pRateControl->subFrameSize[subFrameIndex] = *pSize;
 
 epilogue:
+  return result;
+}
 
-  if (pFileWriter)
+slapResult _slapEncoder_CompressSubFrame(IN slapEncoder *pEncoder, IN uint8_t *pSource, const size_t sizeY, const int quality, const size_t subFrameIndex)
+{
+  // The whole frame is compressed with the luma plane.
+  if (_slapEncoder_IsYUV420Frame(pEncoder))
   {
-    slapDestroyEncoder(&pFileWriter->pEncoder);
+    if (subFrameIndex != 0)
+    {
+      pEncoder->compressedSubBufferSizes[subFrameIndex] = 0;
+      return slapSuccess;
+    }
 
-    if (pFileWriter->pMainFile)
-      fclose(pFileWriter->pMainFile);
+    return _slapCompressYUV420(pSource, &pEncoder->pCompressedBuffers[subFrameIndex], &pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX, pEncoder->resY, quality, pEncoder->pEncoderInternal[subFrameIndex]);
+  }
 
-    if (pFileWriter->pHeaderFile)
-      fclose(pFileWriter->pHeaderFile);
+  // Tiled frames can't be block skip coded, so they always contain the whole plane.
+  if (pEncoder->mode.flags.tileColumns)
+    return _slapEncoder_CompressTiledSubFrame(pEncoder, pSource + (subFrameIndex == 0 ? 0 : pEncoder->resX * pEncoder->resY * (subFrameIndex + 3) / 4), quality, subFrameIndex);
 
-    if (pFileWriter->filename)
+  if (subFrameIndex == 0)
+    return _slapCompressChannel(pSource, &pEncoder->pCompressedBuffers[subFrameIndex], &pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX, sizeY, pEncoder->resX, quality, pEncoder->pEncoderInternal[subFrameIndex], pEncoder->mode.flags.sharedJpegTables);
+  else if (subFrameIndex == 1)
+    return _slapCompressChannel(pSource + pEncoder->resX * pEncoder->resY, &pEncoder->pCompressedBuffers[subFrameIndex], &pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX >> 1, sizeY >> 1, pEncoder->resX >> 1, quality, pEncoder->pEncoderInternal[subFrameIndex], pEncoder->mode.flags.sharedJpegTables);
+  else
+    return _slapCompressChannel(pSource + pEncoder->resX * pEncoder->resY * 5 / 4, &pEncoder->pCompressedBuffers[subFrameIndex], &pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX >> 1, sizeY >> 1, pEncoder->resX >> 1, quality, pEncoder->pEncoderInternal[subFrameIndex], pEncoder->mode.flags.sharedJpegTables);
+}
+
+slapResult _slapEncoder_CompressTiledSubFrame(IN slapEncoder *pEncoder, IN uint8_t *pPlane, const int quality, const size_t subFrameIndex)
+{
+  slapResult result = slapSuccess;
+  const size_t tileCount = pEncoder->mode.flags.tileColumns * pEncoder->mode.flags.tileRows;
+  const size_t stride = subFrameIndex == 0 ? pEncoder->resX : pEncoder->resX >> 1;
+  size_t size = sizeof(uint32_t) * tileCount;
+
+  for (size_t tile = 0; tile < tileCount; tile++)
+  {
+    size_t x, y, sizeX, sizeY;
+    _slapGetTileRect(pEncoder->resX, pEncoder->resY, pEncoder->mode.flags.tileColumns, pEncoder->mode.flags.tileRows, subFrameIndex, tile, &x, &y, &sizeX, &sizeY);
+
+    if ((result = _slapCompressChannel(pPlane + y * stride + x, &pEncoder->pCompressedBuffers[subFrameIndex], &pEncoder->compressedSubBufferSizes[subFrameIndex], sizeX, sizeY, stride, quality, pEncoder->pEncoderInternal[subFrameIndex], pEncoder->mode.flags.sharedJpegTables)) != slapSuccess)
+      goto epilogue;
+
+    const size_t tileSize = pEncoder->compressedSubBufferSizes[subFrameIndex];
+    const uint32_t tileSize32 = (uint32_t)tileSize;
+
+    if (pEncoder->tiledSubBufferCapacities[subFrameIndex] < size + tileSize)
+    {
+      pEncoder->tiledSubBufferCapacities[subFrameIndex] = (size + tileSize) * 2;
+      slapRealloc(&pEncoder->pTiledSubBuffers[subFrameIndex], uint8_t, pEncoder->tiledSubBufferCapacities[subFrameIndex]);
+
+      if (!pEncoder->pTiledSubBuffers[subFrameIndex])
+      {
+        pEncoder->tiledSubBufferCapacities[subFrameIndex] = 0;
+        result = slapError_MemoryAllocation;
+        goto epilogue;
+      }
+    }
+
+    memcpy(pEncoder->pTiledSubBuffers[subFrameIndex] + tile * sizeof(uint32_t), &tileSize32, sizeof(uint32_t));
+    slapMemcpy(pEncoder->pTiledSubBuffers[subFrameIndex] + size, pEncoder->pCompressedBuffers[subFrameIndex], tileSize);
+    size += tileSize;
+  }
+
+  pEncoder->tiledSubBufferSizes[subFrameIndex] = size;
+
+epilogue:
+  return result;
+}
+
+size_t _slapEncoder_GetCompressedSubFrameSize(IN slapEncoder *pEncoder, const size_t subFrameIndex)
+{
+  return pEncoder->mode.flags.tileColumns ? pEncoder->tiledSubBufferSizes[subFrameIndex] : pEncoder->compressedSubBufferSizes[subFrameIndex];
+}
+
+size_t _slapEncoder_GetIntraFrameSideDataSize(IN slapEncoder *pEncoder)
+{
+  if (pEncoder->mode.flags.blockSkip)
+    return _slapGetChangedBlockBitmapSize(pEncoder->resX, pEncoder->resY);
+  else if (pEncoder->mode.flags.motionCompensation)
+    return _slapGetMotionVectorsSize(pEncoder->resX, pEncoder->resY);
+  else
+    return 0;
+}
+
+void _slapEncoder_BeginRateControlFrame(IN slapEncoder *pEncoder)
+{
+  _slapRateControlState *pRateControl = &pEncoder->rateControl;
+  const size_t frameType = pEncoder->isKeyFrame ? 0 : 1;
+  const size_t codedRows = pEncoder->isBlockSkipFrame ? pEncoder->blockRows * SLAP_SKIP_BLOCK_SIZE : pEncoder->resY;
+  const size_t sideDataSize = frameType == 0 ? 0 : _slapEncoder_GetIntraFrameSideDataSize(pEncoder);
+  size_t frameSize[2] = { 0, 0 };
+  size_t size = 0;
+  size_t targetSize = 0;
+
+  for (size_t type = 0; type < 2; type++)
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+      frameSize[type] += pRateControl->planeSize[type][i];
+
+  if (pRateControl->mode == slapRateControl_AverageFrameSize)
+  {
+    int64_t targetFrameSize = (int64_t)pRateControl->targetFrameSize + pRateControl->balance / SLAP_RATE_CONTROL_WINDOW;
+
+    if (targetFrameSize < (int64_t)pRateControl->targetFrameSize / 4)
+      targetFrameSize = (int64_t)pRateControl->targetFrameSize / 4;
+
+    // Full frames are a lot larger than intra frames, so all planes are scaled by the same factor to make a whole group of frames match the target on average.
+    if (pRateControl->planeQuality[0][0] != 0 && (pEncoder->iframeStep == 1 || pRateControl->planeQuality[1][0] != 0))
+    {
+      const int64_t groupSize = (int64_t)(frameSize[0] + frameSize[1] * pRateControl->intraFrameRows / pEncoder->resY * (pEncoder->iframeStep - 1));
+      const int64_t targetGroupSize = targetFrameSize * (int64_t)pEncoder->iframeStep - (int64_t)(_slapEncoder_GetIntraFrameSideDataSize(pEncoder) * (pEncoder->iframeStep - 1));
+
+      size = (size_t)groupSize;
+      targetSize = targetGroupSize > 0 ? (size_t)targetGroupSize : 1;
+    }
+  }
+  else
+  {
+    const size_t sizeLimit = pRateControl->targetFrameSize > sideDataSize ? pRateControl->targetFrameSize - sideDataSize : 1;
+
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      // Every plane gets the share of the limit it has taken up in the last frame of the same type.
+      if (frameSize[frameType] > 0)
+        pRateControl->subFrameSizeLimit[i] = sizeLimit * pRateControl->planeSize[frameType][i] / frameSize[frameType];
+      else if (_slapEncoder_IsYUV420Frame(pEncoder))
+        pRateControl->subFrameSizeLimit[i] = i == 0 ? sizeLimit : 0;
+      else
+        pRateControl->subFrameSizeLimit[i] = sizeLimit * (i == 0 ? 4 : 1) / 6;
+
+      if (pRateControl->subFrameSizeLimit[i] == 0)
+        pRateControl->subFrameSizeLimit[i] = 1;
+    }
+
+    // Aim a bit below the limit, so planes rarely have to be coded twice.
+    if (pRateControl->planeQuality[frameType][0] != 0)
+    {
+      size = frameSize[frameType] * codedRows / pEncoder->resY;
+      targetSize = sizeLimit * 7 / 8;
+    }
+  }
+
+  for (size_t type = 0; type < 2; type++)
+  {
+    // Average frame size rate control scales the planes of both frame types, so they keep their relation.
+    if (type != frameType && pRateControl->mode != slapRateControl_AverageFrameSize)
+      continue;
+
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      int quality = pRateControl->planeQuality[type][i];
+
+      if (quality == 0)
+      {
+        quality = type == 0 ? pEncoder->quality : pEncoder->iframeQuality;
+      }
+      else if (size > 0)
+      {
+        const int scaledQuality = _slapScaleQuality(quality, size, targetSize);
+
+        // Keep the expected size in line with the new quality for the next frame.
+        pRateControl->planeSize[type][i] = pRateControl->planeSize[type][i] * _slapGetQuantizationScale(quality) / _slapGetQuantizationScale(scaledQuality);
+        pRateControl->planeQuality[type][i] = quality = scaledQuality;
+      }
+
+      if (type == frameType)
+        pRateControl->subFrameQuality[i] = quality;
+    }
+  }
+}
+
+void _slapEncoder_EndRateControlFrame(IN slapEncoder *pEncoder)
+{
+  _slapRateControlState *pRateControl = &pEncoder->rateControl;
+  const int64_t maxBalance = (int64_t)(pRateControl->targetFrameSize * SLAP_RATE_CONTROL_WINDOW);
+  size_t frameSize = 0;
+
+  if (!pEncoder->isKeyFrame)
+    pRateControl->intraFrameRows = pEncoder->isBlockSkipFrame ? pEncoder->blockRows * SLAP_SKIP_BLOCK_SIZE : pEncoder->resY;
+
+  if (pRateControl->mode != slapRateControl_AverageFrameSize)
+    return;
+
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    frameSize += pRateControl->subFrameSize[i];
+
+  pRateControl->balance += (int64_t)pRateControl->targetFrameSize - (int64_t)frameSize;
+
+  if (pRateControl->balance > maxBalance)
+    pRateControl->balance = maxBalance;
+  else if (pRateControl->balance < -maxBalance)
+    pRateControl->balance = -maxBalance;
+}
+
+// The compressed buffer itself is left untouched for the reconstruction.
+slapResult _slapEncoder_PrependSideData(IN slapEncoder *pEncoder, IN const void *pSideData, const size_t sideDataSize, IN_OUT void **ppCompressedData, IN_OUT size_t *pSize)
+{
+  slapResult result = slapSuccess;
+
+  if (pEncoder->sideDataSubFrameCapacity < sideDataSize + *pSize)
+  {
+    pEncoder->sideDataSubFrameCapacity = sideDataSize + *pSize;
+    slapRealloc(&pEncoder->pSideDataSubFrame, uint8_t, pEncoder->sideDataSubFrameCapacity);
+
+    if (!pEncoder->pSideDataSubFrame)
+    {
+      pEncoder->sideDataSubFrameCapacity = 0;
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
+  }
+
+  slapMemcpy(pEncoder->pSideDataSubFrame, pSideData, sideDataSize);
+
+  if (*pSize > 0)
+    slapMemcpy(pEncoder->pSideDataSubFrame + sideDataSize, *ppCompressedData, *pSize);
+
+  *ppCompressedData = pEncoder->pSideDataSubFrame;
+  *pSize += sideDataSize;
+
+epilogue:
+  return result;
+}
+
+bool_t _slapEncoder_IsYUV420Frame(IN slapEncoder *pEncoder)
+{
+  return pEncoder->mode.flags.encoder == SLAP_FRAME_ENCODER_YUV420_KEY_FRAMES && pEncoder->isKeyFrame;
+}
+
+bool_t _slapEncoder_NeedsReconstruction(IN slapEncoder *pEncoder)
+{
+  // The decoded frame is only ever used as reference for the next frame, if that is an intra frame. (Unless the next frame turns out to be a scene change.)
+  return pEncoder->reconstruction == slapReconstruction_ClosedLoop && pEncoder->iframeStep > 1 && pEncoder->frameIndex + 1 < pEncoder->nextKeyFrameIndex;
+}
+
+slapResult slapEncoder_EndSubFrame(IN slapEncoder *pEncoder, IN void *pData, const size_t subFrameIndex)
+{
+  slapResult result = slapSuccess;
+
+  uint8_t *pDestination = NULL;
+  const size_t sizeY = pEncoder->isBlockSkipFrame ? pEncoder->blockRows * SLAP_SKIP_BLOCK_SIZE : pEncoder->resY;
+
+  if (!_slapEncoder_NeedsReconstruction(pEncoder) || sizeY == 0)
+    goto epilogue;
+
+  if (pEncoder->isBlockSkipFrame)
+    pDestination = pEncoder->pBlockFrame;
+  else if (!pEncoder->isKeyFrame)
+    pDestination = (uint8_t *)pData;
+  else
+    pDestination = (uint8_t *)pEncoder->pLastFrame;
+
+  if (_slapEncoder_IsYUV420Frame(pEncoder))
+  {
+    if (subFrameIndex == 0)
+    {
+      uint8_t *planes[SLAP_SUB_BUFFER_COUNT];
+      size_t strides[SLAP_SUB_BUFFER_COUNT];
+
+      planes[0] = pDestination;
+      planes[1] = pDestination + pEncoder->resX * pEncoder->resY;
+      planes[2] = pDestination + pEncoder->resX * pEncoder->resY * 5 / 4;
+      strides[0] = pEncoder->resX;
+      strides[1] = strides[2] = pEncoder->resX >> 1;
+
+      result = _slapDecompressYUV420(planes, strides, pEncoder->pCompressedBuffers[subFrameIndex], pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX, pEncoder->resY, 1, pEncoder->pDecoderInternal[subFrameIndex]);
+    }
+  }
+  else if (pEncoder->mode.flags.tileColumns)
+  {
+    const size_t tileCount = pEncoder->mode.flags.tileColumns * pEncoder->mode.flags.tileRows;
+
+    for (size_t tile = 0; tile < tileCount; tile++)
+    {
+      if (subFrameIndex == 0)
+        result = _slapDecompressTile(pDestination, pEncoder->resX, pEncoder->pTiledSubBuffers[subFrameIndex], pEncoder->tiledSubBufferSizes[subFrameIndex], pEncoder->resX, pEncoder->resY, pEncoder->mode.flags.tileColumns, pEncoder->mode.flags.tileRows, subFrameIndex, tile, 1, pEncoder->pDecoderInternal[subFrameIndex], pEncoder->mode.flags.sharedJpegTables);
+      else
+        result = _slapDecompressTile(pDestination + pEncoder->resX * pEncoder->resY * (subFrameIndex + 3) / 4, pEncoder->resX >> 1, pEncoder->pTiledSubBuffers[subFrameIndex], pEncoder->tiledSubBufferSizes[subFrameIndex], pEncoder->resX, pEncoder->resY, pEncoder->mode.flags.tileColumns, pEncoder->mode.flags.tileRows, subFrameIndex, tile, 1, pEncoder->pDecoderInternal[subFrameIndex], pEncoder->mode.flags.sharedJpegTables);
+
+      if (result != slapSuccess)
+        goto epilogue;
+    }
+  }
+  else if (subFrameIndex == 0)
+    result = _slapDecompressChannel(pDestination, pEncoder->pCompressedBuffers[subFrameIndex], pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX, sizeY, pEncoder->resX, 1, pEncoder->pDecoderInternal[subFrameIndex], pEncoder->mode.flags.sharedJpegTables);
+  else if (subFrameIndex == 1)
+    result = _slapDecompressChannel(pDestination + pEncoder->resX * pEncoder->resY, pEncoder->pCompressedBuffers[subFrameIndex], pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX >> 1, sizeY >> 1, pEncoder->resX >> 1, 1, pEncoder->pDecoderInternal[subFrameIndex], pEncoder->mode.flags.sharedJpegTables);
+  else if (subFrameIndex == 2)
+    result = _slapDecompressChannel(pDestination + pEncoder->resX * pEncoder->resY * 5 / 4, pEncoder->pCompressedBuffers[subFrameIndex], pEncoder->compressedSubBufferSizes[subFrameIndex], pEncoder->resX >> 1, sizeY >> 1, pEncoder->resX >> 1, 1, pEncoder->pDecoderInternal[subFrameIndex], pEncoder->mode.flags.sharedJpegTables);
+
+  if (result != slapSuccess)
+    goto epilogue;
+
+epilogue:
+  return result;
+}
+
+slapResult slapEncoder_EndFrame(IN slapEncoder *pEncoder, IN void *pData)
+{
+  slapResult result = slapSuccess;
+
+  if (!pEncoder)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (_slapEncoder_NeedsReconstruction(pEncoder) && !pEncoder->isKeyFrame)
+  {
+    if (pEncoder->isBlockSkipFrame)
+    {
+      _slapDecodeChangedBlocksDiff(pEncoder->pBlockFrame, pEncoder->pLastFrame, pEncoder->pChangedBlockBitmap, pEncoder->resX, pEncoder->resY, SLAP_SKIP_BLOCK_SIZE, SLAP_SUB_BUFFER_COUNT);
+    }
+    else if (pEncoder->isMotionCompensatedFrame)
+    {
+      uint8_t *pPlane = (uint8_t *)pData;
+      const uint8_t *pLastFramePlane = pEncoder->pLastFrame;
+
+      for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+      {
+        const size_t sizeX = i == 0 ? pEncoder->resX : pEncoder->resX >> 1;
+        const size_t sizeY = i == 0 ? pEncoder->resY : pEncoder->resY >> 1;
+
+        _slapDecodeLastFrameDiffMotionPlane(pPlane, sizeX, pLastFramePlane, pEncoder->pMotionVectors, sizeX, sizeY, i == 0 ? SLAP_MOTION_BLOCK_SIZE : SLAP_MOTION_BLOCK_SIZE / 2, 1, i == 0 ? 129 : 130);
+
+        pPlane += sizeX * sizeY;
+        pLastFramePlane += sizeX * sizeY;
+      }
+
+      _slapCopyToLastFrame(pData, pEncoder->pLastFrame, pEncoder->resX, pEncoder->resY);
+    }
+    else
+    {
+      _slapDecodeLastFrameDiff(pData, pEncoder->pLastFrame, pEncoder->resX, pEncoder->resY);
+    }
+  }
+
+  if (pEncoder->rateControl.mode != slapRateControl_None)
+    _slapEncoder_EndRateControlFrame(pEncoder);
+
+  pEncoder->frameIndex++;
+
+epilogue:
+  return result;
+}
+
+slapResult _slapWriteToHeader(IN slapFileWriter *pFileWriter, const uint64_t data)
+{
+  slapResult result = slapSuccess;
+
+  pFileWriter->frameSizeOffsets[pFileWriter->frameSizeOffsetIndex++] = data;
+  pFileWriter->headerPosition++;
+
+  if (pFileWriter->frameSizeOffsetIndex >= (uint64_t)SLAP_HEADER_BLOCK_SIZE)
+  {
+    if (pFileWriter->container != _slapFileWriterContainer_TempFiles)
+    {
+      if (pFileWriter->headerBlocksCapacity < pFileWriter->headerBlocksSize + SLAP_HEADER_BLOCK_SIZE)
+      {
+        pFileWriter->headerBlocksCapacity = (pFileWriter->headerBlocksSize + SLAP_HEADER_BLOCK_SIZE) * 2;
+        slapRealloc(&pFileWriter->pHeaderBlocks, uint64_t, pFileWriter->headerBlocksCapacity);
+
+        if (!pFileWriter->pHeaderBlocks)
+        {
+          pFileWriter->headerBlocksCapacity = 0;
+          result = slapError_MemoryAllocation;
+          goto epilogue;
+        }
+      }
+
+      slapMemcpy(pFileWriter->pHeaderBlocks + pFileWriter->headerBlocksSize, pFileWriter->frameSizeOffsets, sizeof(pFileWriter->frameSizeOffsets));
+      pFileWriter->headerBlocksSize += SLAP_HEADER_BLOCK_SIZE;
+    }
+    else if ((size_t)SLAP_HEADER_BLOCK_SIZE != fwrite(pFileWriter->frameSizeOffsets, sizeof(uint64_t), SLAP_HEADER_BLOCK_SIZE, pFileWriter->pHeaderFile))
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
+
+    pFileWriter->frameSizeOffsetIndex = 0;
+  }
+
+epilogue:
+  return result;
+}
+
+slapFileWriter * slapCreateFileWriter(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags)
+{
+  return _slapCreateFileWriter(filename, sizeX, sizeY, flags, _slapFileWriterContainer_TempFiles);
+}
+
+slapFileWriter * slapCreateFileWriterSinglePass(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags)
+{
+  return _slapCreateFileWriter(filename, sizeX, sizeY, flags, _slapFileWriterContainer_SinglePass);
+}
+
+slapFileWriter * slapCreateFileWriterStreaming(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags)
+{
+  return _slapCreateFileWriter(filename, sizeX, sizeY, flags, _slapFileWriterContainer_Streaming);
+}
+
+slapFileWriter * _slapCreateFileWriter(const char *filename, const size_t sizeX, const size_t sizeY, const uint64_t flags, const _slapFileWriterContainer container)
+{
+  slapFileWriter *pFileWriter = slapAlloc(slapFileWriter, 1);
+  char filenameBuffer[0xFF];
+  char headerFilenameBuffer[0xFF];
+
+  if (!pFileWriter)
+    goto epilogue;
+
+  slapSetZero(pFileWriter, slapFileWriter);
+  slapStrCpy(pFileWriter->filename, filename);
+
+  if (!pFileWriter->filename)
+    goto epilogue;
+
+  pFileWriter->pEncoder = slapCreateEncoder(sizeX, sizeY, flags);
+
+  if (!pFileWriter->pEncoder)
+    goto epilogue;
+
+  pFileWriter->container = container;
+
+  if (container != _slapFileWriterContainer_TempFiles)
+  {
+    pFileWriter->pMainFile = fopen(filename, "wb");
+
+    if (!pFileWriter->pMainFile)
+      goto epilogue;
+
+    // Reserve space for the pre-header. It's patched in place once the video is finalized.
+    if (SLAP_PRE_HEADER_SIZE != fwrite(pFileWriter->frameSizeOffsets, sizeof(uint64_t), SLAP_PRE_HEADER_SIZE, pFileWriter->pMainFile))
+      goto epilogue;
+
+    pFileWriter->payloadOffset = SLAP_PRE_HEADER_SIZE * sizeof(uint64_t);
+  }
+  else
+  {
+    sprintf_s(filenameBuffer, 0xFF, "%s.video", filename);
+    sprintf_s(headerFilenameBuffer, 0xFF, "%s.header", filename);
+
+    pFileWriter->pMainFile = fopen(filenameBuffer, "wb");
+
+    if (!pFileWriter->pMainFile)
+      goto epilogue;
+
+    pFileWriter->pHeaderFile = fopen(headerFilenameBuffer, "wb");
+
+    if (!pFileWriter->pHeaderFile)
+      goto epilogue;
+  }
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->resX))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->resY))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->iframeStep))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, (uint64_t)pFileWriter->pEncoder->mode.flagsPack))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, 0))
+    goto epilogue;
+
+  if (slapSuccess != _slapWriteToHeader(pFileWriter, container == _slapFileWriterContainer_Streaming ? SLAP_CONTAINER_FLAG_STREAMING : 0))
+    goto epilogue;
+
+  if (pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE)
+    goto epilogue;
+
+  // Readers may open a streaming video before its first frame has been written.
+  if (container == _slapFileWriterContainer_Streaming)
+    if (slapSuccess != _slapFileWriter_WriteStreamingPreHeader(pFileWriter) || fflush(pFileWriter->pMainFile) != 0)
+      goto epilogue;
+
+  return pFileWriter;
+
+epilogue:
+
+  if (pFileWriter)
+  {
+    slapDestroyEncoder(&pFileWriter->pEncoder);
+
+    if (pFileWriter->pMainFile)
+      fclose(pFileWriter->pMainFile);
+
+    if (pFileWriter->pHeaderFile)
+      fclose(pFileWriter->pHeaderFile);
+
+    if (pFileWriter->filename)
       slapFreePtr(&pFileWriter->filename);
   }
 
-  slapFreePtr(&pFileWriter);
-  return NULL;
+  slapFreePtr(&pFileWriter);
+  return NULL;
+}
+
+void slapDestroyFileWriter(IN_OUT slapFileWriter **ppFileWriter)
+{
+  if (ppFileWriter && *ppFileWriter)
+  {
+    slapDestroyEncoder(&(*ppFileWriter)->pEncoder);
+    _slapFileWriter_DestroyAsyncGroups(*ppFileWriter);
+    _slapDestroyThreadPool(&(*ppFileWriter)->pThreadPool);
+
+    if ((*ppFileWriter)->pData)
+      tjFree((*ppFileWriter)->pData);
+
+    slapFreePtr(&(*ppFileWriter)->pHeaderBlocks);
+    _slapDestroyFrameIndex(&(*ppFileWriter)->pIndex);
+
+    if ((*ppFileWriter)->filename)
+      slapFreePtr(&(*ppFileWriter)->filename);
+  }
+
+  slapFreePtr(ppFileWriter);
+}
+
+slapResult slapFileWriter_SetIntraFrameStep(slapFileWriter *pFileWriter, const size_t step)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (step == 0)
+    return slapError_InvalidParameter;
+
+  if (pFileWriter->pEncoder->frameIndex != 0 || pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE)
+    return slapError_StateInvalid;
+
+  if (step > 1 && pFileWriter->pEncoder->reconstruction == slapReconstruction_None)
+    return slapError_StateInvalid;
+
+  pFileWriter->frameSizeOffsets[SLAP_PRE_HEADER_IFRAME_STEP_INDEX] = pFileWriter->pEncoder->iframeStep = step;
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_SetReconstruction(slapFileWriter *pFileWriter, const slapReconstruction reconstruction)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (reconstruction != slapReconstruction_ClosedLoop && reconstruction != slapReconstruction_OpenLoop && reconstruction != slapReconstruction_None)
+    return slapError_InvalidParameter;
+
+  if (reconstruction == slapReconstruction_None && pFileWriter->pEncoder->iframeStep > 1)
+    return slapError_StateInvalid;
+
+  pFileWriter->pEncoder->reconstruction = reconstruction;
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_SetBlockSkipThreshold(slapFileWriter *pFileWriter, const size_t threshold)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (pFileWriter->pEncoder->resX % SLAP_SKIP_BLOCK_SIZE || pFileWriter->pEncoder->resY % SLAP_SKIP_BLOCK_SIZE)
+    return slapError_InvalidParameter;
+
+  if (pFileWriter->pEncoder->frameIndex != 0 || pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE || pFileWriter->pEncoder->mode.flags.motionCompensation || pFileWriter->pEncoder->mode.flags.tileColumns)
+    return slapError_StateInvalid;
+
+  pFileWriter->pEncoder->blockSkipThreshold = threshold;
+  pFileWriter->pEncoder->mode.flags.blockSkip = 1;
+  pFileWriter->frameSizeOffsets[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX] = pFileWriter->pEncoder->mode.flagsPack;
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_EnableMotionCompensation(slapFileWriter *pFileWriter)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (pFileWriter->pEncoder->resX % SLAP_MOTION_BLOCK_SIZE || pFileWriter->pEncoder->resY % SLAP_MOTION_BLOCK_SIZE)
+    return slapError_InvalidParameter;
+
+  if (pFileWriter->pEncoder->frameIndex != 0 || pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE || pFileWriter->pEncoder->mode.flags.blockSkip || pFileWriter->pEncoder->mode.flags.tileColumns)
+    return slapError_StateInvalid;
+
+  pFileWriter->pEncoder->mode.flags.motionCompensation = 1;
+  pFileWriter->frameSizeOffsets[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX] = pFileWriter->pEncoder->mode.flagsPack;
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_SetSceneChangeThreshold(slapFileWriter *pFileWriter, const size_t threshold)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (threshold == 0 || threshold > 100)
+    return slapError_InvalidParameter;
+
+  if (pFileWriter->pEncoder->frameIndex != 0 || pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE)
+    return slapError_StateInvalid;
+
+  pFileWriter->pEncoder->sceneChangeThreshold = threshold;
+  pFileWriter->pEncoder->mode.flags.adaptiveKeyFrames = 1;
+  pFileWriter->frameSizeOffsets[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX] = pFileWriter->pEncoder->mode.flagsPack;
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_SetTileCount(slapFileWriter *pFileWriter, const size_t columns, const size_t rows)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (columns == 0 || rows == 0 || columns > SLAP_TILE_COUNT_MAX || rows > SLAP_TILE_COUNT_MAX || columns > pFileWriter->pEncoder->resX / SLAP_TILE_ALIGNMENT || rows > pFileWriter->pEncoder->resY / SLAP_TILE_ALIGNMENT)
+    return slapError_InvalidParameter;
+
+  if (pFileWriter->pEncoder->frameIndex != 0 || pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE || pFileWriter->pEncoder->mode.flags.blockSkip || pFileWriter->pEncoder->mode.flags.motionCompensation || pFileWriter->pEncoder->mode.flags.encoder == SLAP_FRAME_ENCODER_YUV420_KEY_FRAMES)
+    return slapError_StateInvalid;
+
+  // A single tile is the same as no tiles at all.
+  pFileWriter->pEncoder->mode.flags.tileColumns = (columns == 1 && rows == 1) ? 0 : (unsigned int)columns;
+  pFileWriter->pEncoder->mode.flags.tileRows = (columns == 1 && rows == 1) ? 0 : (unsigned int)rows;
+  pFileWriter->frameSizeOffsets[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX] = pFileWriter->pEncoder->mode.flagsPack;
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_EnableSharedJpegTables(slapFileWriter *pFileWriter)
+{
+  slapResult result = slapSuccess;
+  void *compressors[SLAP_SUB_BUFFER_COUNT] = { NULL };
+  void *decompressors[SLAP_SUB_BUFFER_COUNT] = { NULL };
+
+  if (!pFileWriter)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  slapEncoder *pEncoder = pFileWriter->pEncoder;
+
+  if (pEncoder->frameIndex != 0 || pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE || pEncoder->mode.flags.encoder == SLAP_FRAME_ENCODER_YUV420_KEY_FRAMES)
+  {
+    result = slapError_StateInvalid;
+    goto epilogue;
+  }
+
+  if (pEncoder->mode.flags.sharedJpegTables)
+    goto epilogue;
+
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  {
+    compressors[i] = _slapCreateCompressor(1);
+    decompressors[i] = _slapCreateDecompressor(1);
+
+    if (!compressors[i] || !decompressors[i])
+    {
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
+  }
+
+  // The encoder has been created with turbojpeg handles.
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  {
+    _slapDestroyCompressor(pEncoder->pEncoderInternal[i], 0);
+    _slapDestroyDecompressor(pEncoder->pDecoderInternal[i], 0);
+
+    pEncoder->pEncoderInternal[i] = compressors[i];
+    pEncoder->pDecoderInternal[i] = decompressors[i];
+    compressors[i] = decompressors[i] = NULL;
+  }
+
+  pEncoder->mode.flags.sharedJpegTables = 1;
+  pFileWriter->frameSizeOffsets[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX] = pEncoder->mode.flagsPack;
+
+epilogue:
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  {
+    if (compressors[i])
+      _slapDestroyCompressor(compressors[i], 1);
+
+    if (decompressors[i])
+      _slapDestroyDecompressor(decompressors[i], 1);
+  }
+
+  return result;
+}
+
+slapResult slapFileWriter_EnableYUV420KeyFrames(slapFileWriter *pFileWriter)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  // Tiles and shared JPEG tables split the frame into grayscale planes.
+  if (pFileWriter->pEncoder->frameIndex != 0 || pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE || pFileWriter->pEncoder->mode.flags.tileColumns || pFileWriter->pEncoder->mode.flags.sharedJpegTables)
+    return slapError_StateInvalid;
+
+  pFileWriter->pEncoder->mode.flags.encoder = SLAP_FRAME_ENCODER_YUV420_KEY_FRAMES;
+  pFileWriter->frameSizeOffsets[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX] = pFileWriter->pEncoder->mode.flagsPack;
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_EnableCompactIndex(slapFileWriter *pFileWriter)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (pFileWriter->pEncoder->frameIndex != 0 || pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE)
+    return slapError_StateInvalid;
+
+  if (pFileWriter->pIndex)
+    return slapSuccess;
+
+  pFileWriter->pIndex = _slapCreateFrameIndex();
+
+  if (!pFileWriter->pIndex)
+    return slapError_MemoryAllocation;
+
+  pFileWriter->frameSizeOffsets[SLAP_PRE_HEADER_CONTAINER_FLAGS_INDEX] |= SLAP_CONTAINER_FLAG_COMPACT_INDEX;
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_SetThreadCount(slapFileWriter *pFileWriter, const size_t threadCount)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (threadCount == 0)
+    return slapError_InvalidParameter;
+
+  const slapResult result = slapFileWriter_FlushAsync(pFileWriter);
+
+  if (result != slapSuccess)
+    return result;
+
+  _slapFileWriter_DestroyAsyncGroups(pFileWriter);
+  _slapDestroyThreadPool(&pFileWriter->pThreadPool);
+
+  // The calling thread participates in the work, so it doesn't need a worker of its own.
+  if (threadCount > 1)
+  {
+    pFileWriter->pThreadPool = _slapCreateThreadPool(threadCount - 1);
+
+    if (!pFileWriter->pThreadPool)
+      return slapError_MemoryAllocation;
+  }
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_SetFramesInFlight(slapFileWriter *pFileWriter, const size_t framesInFlight)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (framesInFlight == 0)
+    return slapError_InvalidParameter;
+
+  const slapResult result = slapFileWriter_FlushAsync(pFileWriter);
+
+  if (result != slapSuccess)
+    return result;
+
+  _slapFileWriter_DestroyAsyncGroups(pFileWriter);
+  pFileWriter->maxGroupsInFlight = framesInFlight;
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_SetEncoderFrameQuality(slapFileWriter * pFileWriter, const size_t quality)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (quality == 0 || quality > 100)
+    return slapError_InvalidParameter;
+
+  pFileWriter->pEncoder->quality = (int)quality;
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_SetEncoderIntraFrameQuality(slapFileWriter * pFileWriter, const size_t quality)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (pFileWriter->pEncoder->iframeStep == 1)
+    return slapError_StateInvalid;
+
+  if (quality == 0 || quality > 100)
+    return slapError_InvalidParameter;
+
+  pFileWriter->pEncoder->iframeQuality = (int)quality;
+
+  return slapSuccess;
+}
+
+slapResult slapFileWriter_SetRateControl(slapFileWriter *pFileWriter, const slapRateControl rateControl, const size_t bytesPerFrame)
+{
+  if (!pFileWriter)
+    return slapError_ArgumentNull;
+
+  if (rateControl > slapRateControl_MaxFrameSize || (rateControl != slapRateControl_None && bytesPerFrame == 0))
+    return slapError_InvalidParameter;
+
+  // Frames that are still being encoded asynchronously are finished with the previous rate control.
+  const slapResult result = slapFileWriter_FlushAsync(pFileWriter);
+
+  if (result != slapSuccess)
+    return result;
+
+  pFileWriter->pEncoder->rateControl.mode = rateControl;
+  pFileWriter->pEncoder->rateControl.targetFrameSize = bytesPerFrame;
+  pFileWriter->pEncoder->rateControl.balance = 0;
+
+  return slapSuccess;
+}
+
+slapResult slapFinalizeFileWriter(IN slapFileWriter *pFileWriter)
+{
+  slapResult result = slapError_Generic;
+  FILE *pFile = NULL;
+  FILE *pReadFile = NULL;
+  char filenameBuffer[0xFF];
+  void *pData = NULL;
+  int64_t fileSize = 0;
+  const size_t maxBlockSize = 1024 * 1024 * 64;
+  uint64_t remainingSize = 0;
+
+  if (!pFileWriter)
+    goto epilogue;
+
+  if (slapSuccess != (result = slapFileWriter_FlushAsync(pFileWriter)))
+    goto epilogue;
+
+  result = slapError_Generic;
+
+  if (pFileWriter->pEncoder)
+    slapFinalizeEncoder(pFileWriter->pEncoder);
+
+  if (pFileWriter->container != _slapFileWriterContainer_TempFiles)
+  {
+    result = _slapFileWriter_FinalizeSinglePass(pFileWriter);
+    goto epilogue;
+  }
+
+  if (pFileWriter->pHeaderFile)
+  {
+    if (pFileWriter->frameSizeOffsetIndex != 0)
+      fwrite(pFileWriter->frameSizeOffsets, 1, sizeof(uint64_t) * pFileWriter->frameSizeOffsetIndex, pFileWriter->pHeaderFile);
+
+    fflush(pFileWriter->pHeaderFile);
+    fclose(pFileWriter->pHeaderFile);
+    pFileWriter->pHeaderFile = NULL;
+  }
+
+  if (pFileWriter->pMainFile)
+  {
+    fflush(pFileWriter->pMainFile);
+    fclose(pFileWriter->pMainFile);
+    pFileWriter->pMainFile = NULL;
+  }
+
+  pFile = fopen(pFileWriter->filename, "wb");
+
+  if (!pFile)
+    goto epilogue;
+
+  sprintf_s(filenameBuffer, 0xFF, "%s.header", pFileWriter->filename);
+  pReadFile = fopen(filenameBuffer, "rb");
+
+  if (!pReadFile)
+    goto epilogue;
+
+  pData = slapAlloc(unsigned char, pFileWriter->headerPosition * sizeof(uint64_t));
+
+  if (!pData)
+    goto epilogue;
+
+  if (pFileWriter->headerPosition != (fread(pData, sizeof(uint64_t), pFileWriter->headerPosition, pReadFile)))
+    goto epilogue;
+
+  ((uint64_t *)pData)[SLAP_PRE_HEADER_HEADER_SIZE_INDEX] = pFileWriter->pIndex ? _slapFrameIndex_GetSerializedSize(pFileWriter->pIndex) : pFileWriter->headerPosition - SLAP_PRE_HEADER_SIZE;
+  ((uint64_t *)pData)[SLAP_PRE_HEADER_FRAME_COUNT_INDEX] = pFileWriter->frameCount;
+
+  if (pFileWriter->headerPosition != fwrite(pData, sizeof(uint64_t), pFileWriter->headerPosition, pFile))
+    goto epilogue;
+
+  // With a compact index, the header file only contains the pre-header.
+  if (pFileWriter->pIndex && slapSuccess != _slapFrameIndex_Write(pFileWriter->pIndex, pFile))
+    goto epilogue;
+
+  fclose(pReadFile);
+  remove(filenameBuffer);
+
+  sprintf_s(filenameBuffer, 0xFF, "%s.video", pFileWriter->filename);
+  pReadFile = fopen(filenameBuffer, "rb");
+
+  if (!pReadFile)
+    goto epilogue;
+
+  if (slapFSeek(pReadFile, 0, SEEK_END))
+    goto epilogue;
+
+  fileSize = slapFTell(pReadFile);
+
+  if (fileSize < 0 || slapFSeek(pReadFile, 0, SEEK_SET))
+    goto epilogue;
+
+  remainingSize = (uint64_t)fileSize;
+
+  slapRealloc(&pData, uint8_t, remainingSize < maxBlockSize ? (size_t)remainingSize : maxBlockSize);
+
+  while (remainingSize > maxBlockSize)
+  {
+    if (maxBlockSize != fread(pData, 1, maxBlockSize, pReadFile))
+      goto epilogue;
+
+    if (maxBlockSize != fwrite(pData, 1, maxBlockSize, pFile))
+      goto epilogue;
+
+    remainingSize -= maxBlockSize;
+  }
+
+  if ((size_t)remainingSize != fread(pData, 1, (size_t)remainingSize, pReadFile))
+    goto epilogue;
+
+  if ((size_t)remainingSize != fwrite(pData, 1, (size_t)remainingSize, pFile))
+    goto epilogue;
+
+  fclose(pReadFile);
+  pReadFile = NULL;
+  remove(filenameBuffer);
+
+  result = slapSuccess;
+
+epilogue:
+
+  if (pFile)
+    fclose(pFile);
+
+  if (pReadFile)
+    fclose(pReadFile);
+
+  if (pData)
+    slapFreePtr(&pData);
+
+  return result;
+}
+
+slapResult _slapFileWriter_FinalizeSinglePass(IN slapFileWriter *pFileWriter)
+{
+  slapResult result = slapError_FileError;
+  const uint64_t padding = 0;
+  uint64_t *pPreHeader = NULL;
+  int64_t indexOffset = 0;
+
+  if (!pFileWriter->pMainFile)
+    goto epilogue;
+
+  indexOffset = slapFTell(pFileWriter->pMainFile);
+
+  if (indexOffset < 0)
+    goto epilogue;
+
+  // Keep the index aligned, so it can be used straight from a mapped file.
+  if (indexOffset % sizeof(uint64_t) != 0)
+  {
+    const size_t paddingSize = sizeof(uint64_t) - (size_t)(indexOffset % sizeof(uint64_t));
+
+    if (paddingSize != fwrite(&padding, 1, paddingSize, pFileWriter->pMainFile))
+      goto epilogue;
+
+    indexOffset += paddingSize;
+  }
+
+  // The pre-header is at the beginning of the first header block.
+  pPreHeader = pFileWriter->pHeaderBlocks ? pFileWriter->pHeaderBlocks : pFileWriter->frameSizeOffsets;
+
+  pPreHeader[SLAP_PRE_HEADER_HEADER_SIZE_INDEX] = pFileWriter->pIndex ? _slapFrameIndex_GetSerializedSize(pFileWriter->pIndex) : pFileWriter->headerPosition - SLAP_PRE_HEADER_SIZE;
+  pPreHeader[SLAP_PRE_HEADER_FRAME_COUNT_INDEX] = pFileWriter->frameCount;
+  pPreHeader[SLAP_PRE_HEADER_INDEX_OFFSET_INDEX] = (uint64_t)indexOffset;
+
+  if (pFileWriter->pIndex)
+  {
+    if (slapSuccess != _slapFrameIndex_Write(pFileWriter->pIndex, pFileWriter->pMainFile))
+      goto epilogue;
+  }
+  else if (pFileWriter->pHeaderBlocks)
+  {
+    if (pFileWriter->headerBlocksSize - SLAP_PRE_HEADER_SIZE != fwrite(pFileWriter->pHeaderBlocks + SLAP_PRE_HEADER_SIZE, sizeof(uint64_t), pFileWriter->headerBlocksSize - SLAP_PRE_HEADER_SIZE, pFileWriter->pMainFile))
+      goto epilogue;
+
+    if (pFileWriter->frameSizeOffsetIndex != fwrite(pFileWriter->frameSizeOffsets, sizeof(uint64_t), pFileWriter->frameSizeOffsetIndex, pFileWriter->pMainFile))
+      goto epilogue;
+  }
+  else
+  {
+    if (pFileWriter->frameSizeOffsetIndex - SLAP_PRE_HEADER_SIZE != fwrite(pFileWriter->frameSizeOffsets + SLAP_PRE_HEADER_SIZE, sizeof(uint64_t), pFileWriter->frameSizeOffsetIndex - SLAP_PRE_HEADER_SIZE, pFileWriter->pMainFile))
+      goto epilogue;
+  }
+
+  if (slapFSeek(pFileWriter->pMainFile, 0, SEEK_SET))
+    goto epilogue;
+
+  if (SLAP_PRE_HEADER_SIZE != fwrite(pPreHeader, sizeof(uint64_t), SLAP_PRE_HEADER_SIZE, pFileWriter->pMainFile))
+    goto epilogue;
+
+  result = slapSuccess;
+
+epilogue:
+  if (pFileWriter->pMainFile)
+  {
+    if (fclose(pFileWriter->pMainFile) != 0 && result == slapSuccess)
+      result = slapError_FileError;
+
+    pFileWriter->pMainFile = NULL;
+  }
+
+  slapFreePtr(&pFileWriter->pHeaderBlocks);
+  pFileWriter->headerBlocksSize = pFileWriter->headerBlocksCapacity = 0;
+
+  return result;
+}
+
+slapResult _slapFileWriter_WriteStreamingPreHeader(IN slapFileWriter *pFileWriter)
+{
+  if (pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE)
+    return slapError_StateInvalid;
+
+  if (slapFSeek(pFileWriter->pMainFile, 0, SEEK_SET))
+    return slapError_FileError;
+
+  if (SLAP_PRE_HEADER_SIZE != fwrite(pFileWriter->frameSizeOffsets, sizeof(uint64_t), SLAP_PRE_HEADER_SIZE, pFileWriter->pMainFile))
+    return slapError_FileError;
+
+  if (slapFSeek(pFileWriter->pMainFile, 0, SEEK_END))
+    return slapError_FileError;
+
+  return slapSuccess;
+}
+
+slapResult _slapFileWriter_WriteFrame(IN slapFileWriter *pFileWriter, IN _slapFrameEncoderBlock *pSubFrames, const bool_t isKeyFrame)
+{
+  slapResult result = slapSuccess;
+  int64_t filePosition = 0;
+  size_t totalFullFrameSize = 0;
+  uint64_t frameHeader[SLAP_HEADER_PER_FRAME_SIZE];
+  const uint64_t keyFrameFlag = (pFileWriter->pEncoder->mode.flags.adaptiveKeyFrames && isKeyFrame) ? SLAP_KEY_FRAME_FLAG : 0;
+
+  if (pFileWriter->container == _slapFileWriterContainer_Streaming)
+  {
+    uint64_t packetHeader[SLAP_PACKET_HEADER_SIZE];
+
+    // The pre-header is written again with the first frame, so the intra frame step and the codec flags can still be changed until then.
+    if (pFileWriter->frameCount == 0)
+      if ((result = _slapFileWriter_WriteStreamingPreHeader(pFileWriter)) != slapSuccess)
+        goto epilogue;
+
+    packetHeader[SLAP_PACKET_MAGIC_INDEX] = SLAP_PACKET_MAGIC;
+    packetHeader[SLAP_PACKET_FRAME_INDEX_INDEX] = pFileWriter->frameCount | keyFrameFlag;
+
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+      packetHeader[SLAP_PACKET_SUB_FRAME_SIZE_OFFSET + i] = pSubFrames[i].frameSize;
+
+    if (SLAP_PACKET_HEADER_SIZE != fwrite(packetHeader, sizeof(uint64_t), SLAP_PACKET_HEADER_SIZE, pFileWriter->pMainFile))
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
+  }
+
+  filePosition = slapFTell(pFileWriter->pMainFile);
+
+  if (filePosition < 0)
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  frameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX] = (uint64_t)filePosition - pFileWriter->payloadOffset;
+
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  {
+    frameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX] = totalFullFrameSize;
+    frameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX] = pSubFrames[i].frameSize;
+    totalFullFrameSize += pSubFrames[i].frameSize;
+  }
+
+  frameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX] = totalFullFrameSize | keyFrameFlag;
+
+  if (pFileWriter->pIndex)
+  {
+    if ((result = _slapFrameIndex_AddFrame(pFileWriter->pIndex, frameHeader)) != slapSuccess)
+      goto epilogue;
+  }
+  else
+  {
+    for (size_t i = 0; i < SLAP_HEADER_PER_FRAME_SIZE; i++)
+      if ((result = _slapWriteToHeader(pFileWriter, frameHeader[i])) != slapSuccess)
+        goto epilogue;
+  }
+
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  {
+    if (pSubFrames[i].frameSize != fwrite(pSubFrames[i].pFrameData, 1, pSubFrames[i].frameSize, pFileWriter->pMainFile))
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
+  }
+
+  // Make every complete frame visible to readers right away.
+  if (pFileWriter->container == _slapFileWriterContainer_Streaming && fflush(pFileWriter->pMainFile) != 0)
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  pFileWriter->frameCount++;
+
+epilogue:
+  return result;
+}
+
+slapResult slapFileWriter_AddFrameYUV420(IN slapFileWriter *pFileWriter, IN void *pData)
+{
+  slapResult result = slapSuccess;
+  _slapFrameEncoderBlock subFrames[SLAP_SUB_BUFFER_COUNT];
+  _slapSubFrameTask subFrameTasks[SLAP_SUB_BUFFER_COUNT];
+  size_t pendingTasks = 0;
+
+  if (!pFileWriter || !pData)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  // Frames that are still being encoded asynchronously have to be written first.
+  if ((result = slapFileWriter_FlushAsync(pFileWriter)) != slapSuccess)
+    goto epilogue;
+
+  result = slapEncoder_BeginFrame(pFileWriter->pEncoder, pData);
+
+  if (result != slapSuccess)
+    goto epilogue;
+
+  if (pFileWriter->pThreadPool)
+  {
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      subFrameTasks[i].pEncoder = pFileWriter->pEncoder;
+      subFrameTasks[i].pData = pData;
+      subFrameTasks[i].subFrameIndex = i;
+      subFrameTasks[i].pSubFrame = &subFrames[i];
+      subFrameTasks[i].result = slapSuccess;
+
+      _slapThreadPool_Enqueue(pFileWriter->pThreadPool, _slapEncoder_BeginSubFrameTask, &subFrameTasks[i], &pendingTasks);
+    }
+
+    _slapThreadPool_Wait(pFileWriter->pThreadPool, &pendingTasks);
+
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      result = subFrameTasks[i].result;
+
+      if (result != slapSuccess)
+        goto epilogue;
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      result = slapEncoder_BeginSubFrame(pFileWriter->pEncoder, pData, &subFrames[i].pFrameData, &subFrames[i].frameSize, i);
+
+      if (result != slapSuccess)
+        goto epilogue;
+    }
+  }
+
+  // The reconstruction only reads the compressed buffers, so it can run alongside writing them to disk.
+  if (pFileWriter->pThreadPool && _slapEncoder_NeedsReconstruction(pFileWriter->pEncoder))
+  {
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      _slapThreadPool_Enqueue(pFileWriter->pThreadPool, _slapEncoder_EndSubFrameTask, &subFrameTasks[i], &pendingTasks);
+    }
+  }
+
+  if ((result = _slapFileWriter_WriteFrame(pFileWriter, subFrames, pFileWriter->pEncoder->isKeyFrame)) != slapSuccess)
+    goto epilogue;
+
+  if (pFileWriter->pThreadPool)
+  {
+    _slapThreadPool_Wait(pFileWriter->pThreadPool, &pendingTasks);
+
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      result = subFrameTasks[i].result;
+
+      if (result != slapSuccess)
+        goto epilogue;
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      result = slapEncoder_EndSubFrame(pFileWriter->pEncoder, pData, i);
+
+      if (result != slapSuccess)
+        goto epilogue;
+    }
+  }
+
+  // finalize frame.
+  result = slapEncoder_EndFrame(pFileWriter->pEncoder, pData);
+
+  if (result != slapSuccess)
+    goto epilogue;
+
+epilogue:
+  // Don't leave any tasks behind that still reference the stack of this function.
+  if (pFileWriter && pFileWriter->pThreadPool)
+    _slapThreadPool_Wait(pFileWriter->pThreadPool, &pendingTasks);
+
+  return result;
+}
+
+slapResult _slapFileWriter_CreateAsyncGroups(IN slapFileWriter *pFileWriter)
+{
+  slapResult result = slapSuccess;
+  const size_t frameSize = pFileWriter->pEncoder->resX * pFileWriter->pEncoder->resY * 3 / 2;
+  const size_t framesPerGroup = pFileWriter->pEncoder->iframeStep;
+
+  if (pFileWriter->maxGroupsInFlight == 0)
+    pFileWriter->maxGroupsInFlight = pFileWriter->pThreadPool->threadCount + 1;
+
+  pFileWriter->pAsyncGroups = slapAlloc(_slapAsyncGroup, pFileWriter->maxGroupsInFlight);
+
+  if (!pFileWriter->pAsyncGroups)
+  {
+    result = slapError_MemoryAllocation;
+    goto epilogue;
+  }
+
+  memset(pFileWriter->pAsyncGroups, 0, sizeof(_slapAsyncGroup) * pFileWriter->maxGroupsInFlight);
+
+  for (size_t i = 0; i < pFileWriter->maxGroupsInFlight; i++)
+  {
+    _slapAsyncGroup *pGroup = &pFileWriter->pAsyncGroups[i];
+
+    pGroup->pEncoder = slapCreateEncoder(pFileWriter->pEncoder->resX, pFileWriter->pEncoder->resY, pFileWriter->pEncoder->mode.flagsPack);
+    pGroup->pFrameData = slapAlloc(uint8_t, frameSize * framesPerGroup);
+    pGroup->pSubFrameSizes = slapAlloc(size_t, SLAP_SUB_BUFFER_COUNT * framesPerGroup);
+    pGroup->pKeyFrames = slapAlloc(bool_t, framesPerGroup);
+
+    if (!pGroup->pEncoder || !pGroup->pFrameData || !pGroup->pSubFrameSizes || !pGroup->pKeyFrames)
+    {
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
+  }
+
+  pFileWriter->groupsInFlight = 0;
+  pFileWriter->asyncGroupStartIndex = 0;
+
+epilogue:
+  if (result != slapSuccess)
+    _slapFileWriter_DestroyAsyncGroups(pFileWriter);
+
+  return result;
+}
+
+void _slapFileWriter_DestroyAsyncGroups(IN slapFileWriter *pFileWriter)
+{
+  if (!pFileWriter->pAsyncGroups)
+    return;
+
+  for (size_t i = 0; i < pFileWriter->maxGroupsInFlight; i++)
+  {
+    // Groups that are still in flight are discarded.
+    _slapThreadPool_Wait(pFileWriter->pThreadPool, &pFileWriter->pAsyncGroups[i].pendingTasks);
+
+    slapDestroyEncoder(&pFileWriter->pAsyncGroups[i].pEncoder);
+    slapFreePtr(&pFileWriter->pAsyncGroups[i].pFrameData);
+    slapFreePtr(&pFileWriter->pAsyncGroups[i].pSubFrameSizes);
+    slapFreePtr(&pFileWriter->pAsyncGroups[i].pKeyFrames);
+    slapFreePtr(&pFileWriter->pAsyncGroups[i].pCompressedData);
+  }
+
+  slapFreePtr(&pFileWriter->pAsyncGroups);
+  pFileWriter->groupsInFlight = 0;
+}
+
+void _slapFileWriter_EnqueueAsyncGroup(IN slapFileWriter *pFileWriter, IN _slapAsyncGroup *pGroup)
+{
+  pGroup->pEncoder->iframeStep = pFileWriter->pEncoder->iframeStep;
+  pGroup->pEncoder->quality = pFileWriter->pEncoder->quality;
+  pGroup->pEncoder->iframeQuality = pFileWriter->pEncoder->iframeQuality;
+  pGroup->pEncoder->blockSkipThreshold = pFileWriter->pEncoder->blockSkipThreshold;
+  pGroup->pEncoder->reconstruction = pFileWriter->pEncoder->reconstruction;
+  pGroup->pEncoder->rateControl = pFileWriter->pEncoder->rateControl;
+  pGroup->pEncoder->sceneChangeThreshold = pFileWriter->pEncoder->sceneChangeThreshold;
+  pGroup->pEncoder->frameIndex = pGroup->pEncoder->nextKeyFrameIndex = pGroup->firstFrameIndex;
+  pGroup->rateControlBalance = pFileWriter->pEncoder->rateControl.balance;
+  pGroup->compressedDataSize = 0;
+  pGroup->result = slapSuccess;
+
+  _slapThreadPool_Enqueue(pFileWriter->pThreadPool, _slapEncoder_EncodeAsyncGroupTask, pGroup, &pGroup->pendingTasks);
+  pFileWriter->groupsInFlight++;
+}
+
+slapResult _slapFileWriter_WriteOldestAsyncGroup(IN slapFileWriter *pFileWriter)
+{
+  slapResult result = slapSuccess;
+  _slapAsyncGroup *pGroup = &pFileWriter->pAsyncGroups[pFileWriter->asyncGroupStartIndex];
+  _slapFrameEncoderBlock subFrames[SLAP_SUB_BUFFER_COUNT];
+  uint8_t *pCompressedData = NULL;
+
+  _slapThreadPool_Wait(pFileWriter->pThreadPool, &pGroup->pendingTasks);
+
+  pFileWriter->asyncGroupStartIndex = (pFileWriter->asyncGroupStartIndex + 1) % pFileWriter->maxGroupsInFlight;
+  pFileWriter->groupsInFlight--;
+
+  if ((result = pGroup->result) != slapSuccess)
+    goto epilogue;
+
+  // Rate control continues from the state of the group. Groups are written in order, so the bytes every group has saved or overspent add up.
+  {
+    const int64_t balance = pFileWriter->pEncoder->rateControl.balance + pGroup->pEncoder->rateControl.balance - pGroup->rateControlBalance;
+
+    pFileWriter->pEncoder->rateControl = pGroup->pEncoder->rateControl;
+    pFileWriter->pEncoder->rateControl.balance = balance;
+  }
+
+  pCompressedData = pGroup->pCompressedData;
+
+  for (size_t frame = 0; frame < pGroup->frameCount; frame++)
+  {
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      subFrames[i].frameSize = pGroup->pSubFrameSizes[frame * SLAP_SUB_BUFFER_COUNT + i];
+      subFrames[i].pFrameData = pCompressedData;
+      pCompressedData += subFrames[i].frameSize;
+    }
+
+    if ((result = _slapFileWriter_WriteFrame(pFileWriter, subFrames, pGroup->pKeyFrames[frame])) != slapSuccess)
+      goto epilogue;
+  }
+
+epilogue:
+  pGroup->frameCount = 0;
+
+  return result;
+}
+
+slapResult slapFileWriter_AddFrameYUV420Async(IN slapFileWriter *pFileWriter, IN const void *pData)
+{
+  slapResult result = slapSuccess;
+  _slapAsyncGroup *pGroup = NULL;
+  size_t frameSize = 0;
+
+  if (!pFileWriter || !pData)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  // Without worker threads there's nothing to run asynchronously on.
+  if (!pFileWriter->pThreadPool)
+  {
+    result = slapFileWriter_AddFrameYUV420(pFileWriter, (void *)pData);
+    goto epilogue;
+  }
+
+  if (!pFileWriter->pAsyncGroups)
+    if ((result = _slapFileWriter_CreateAsyncGroups(pFileWriter)) != slapSuccess)
+      goto epilogue;
+
+  if (pFileWriter->groupsInFlight == pFileWriter->maxGroupsInFlight)
+    if ((result = _slapFileWriter_WriteOldestAsyncGroup(pFileWriter)) != slapSuccess)
+      goto epilogue;
+
+  pGroup = &pFileWriter->pAsyncGroups[(pFileWriter->asyncGroupStartIndex + pFileWriter->groupsInFlight) % pFileWriter->maxGroupsInFlight];
+
+  // Groups have to start with a full frame. A group that has been started synchronously is also finished synchronously.
+  if (pGroup->frameCount == 0 && pFileWriter->pEncoder->frameIndex < pFileWriter->pEncoder->nextKeyFrameIndex)
+  {
+    result = slapFileWriter_AddFrameYUV420(pFileWriter, (void *)pData);
+    goto epilogue;
+  }
+
+  // Scene changes within the group are placed by the encoder of the group, but the group always ends after IntraFrameStep frames.
+  if (pGroup->frameCount == 0)
+  {
+    pGroup->firstFrameIndex = pFileWriter->pEncoder->frameIndex;
+    pFileWriter->pEncoder->nextKeyFrameIndex = pGroup->firstFrameIndex + pFileWriter->pEncoder->iframeStep;
+  }
+
+  frameSize = pFileWriter->pEncoder->resX * pFileWriter->pEncoder->resY * 3 / 2;
+
+  slapMemcpy(pGroup->pFrameData + pGroup->frameCount * frameSize, pData, frameSize);
+  pGroup->frameCount++;
+  pFileWriter->pEncoder->frameIndex++;
+
+  if (pFileWriter->pEncoder->frameIndex == pFileWriter->pEncoder->nextKeyFrameIndex)
+    _slapFileWriter_EnqueueAsyncGroup(pFileWriter, pGroup);
+
+epilogue:
+  return result;
+}
+
+slapResult slapFileWriter_FlushAsync(IN slapFileWriter *pFileWriter)
+{
+  slapResult result = slapSuccess;
+  _slapAsyncGroup *pPartialGroup = NULL;
+
+  if (!pFileWriter)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (!pFileWriter->pAsyncGroups)
+    goto epilogue;
+
+  if (pFileWriter->groupsInFlight < pFileWriter->maxGroupsInFlight)
+  {
+    _slapAsyncGroup *pGroup = &pFileWriter->pAsyncGroups[(pFileWriter->asyncGroupStartIndex + pFileWriter->groupsInFlight) % pFileWriter->maxGroupsInFlight];
+
+    if (pGroup->frameCount > 0)
+    {
+      pPartialGroup = pGroup;
+      _slapFileWriter_EnqueueAsyncGroup(pFileWriter, pPartialGroup);
+    }
+  }
+
+  while (pFileWriter->groupsInFlight > 0)
+    if ((result = _slapFileWriter_WriteOldestAsyncGroup(pFileWriter)) != slapSuccess)
+      goto epilogue;
+
+  // The remaining intra frames of an unfinished group are encoded by the main encoder, which needs the reference frame and key frame placement of that group.
+  if (pPartialGroup)
+  {
+    _slapCopyToLastFrame(pPartialGroup->pEncoder->pLastFrame, pFileWriter->pEncoder->pLastFrame, pFileWriter->pEncoder->resX, pFileWriter->pEncoder->resY);
+
+    pFileWriter->pEncoder->nextKeyFrameIndex = pPartialGroup->pEncoder->nextKeyFrameIndex;
+    pFileWriter->pEncoder->hasLumaHistogram = pPartialGroup->pEncoder->hasLumaHistogram;
+    memcpy(pFileWriter->pEncoder->lumaHistogram, pPartialGroup->pEncoder->lumaHistogram, sizeof(pFileWriter->pEncoder->lumaHistogram));
+
+    if (pPartialGroup->pEncoder->pBlockSkipReference)
+    {
+      if ((result = _slapEncoder_AllocateBlockSkipBuffers(pFileWriter->pEncoder)) != slapSuccess)
+        goto epilogue;
+
+      _slapCopyToLastFrame(pPartialGroup->pEncoder->pBlockSkipReference, pFileWriter->pEncoder->pBlockSkipReference, pFileWriter->pEncoder->resX, pFileWriter->pEncoder->resY);
+    }
+  }
+
+epilogue:
+  return result;
+}
+
+slapDecoder * slapCreateDecoder(const size_t sizeX, const size_t sizeY, const uint64_t flags)
+{
+  if (sizeX & 7 || sizeY & 7) // must be multiple of 8.
+    return NULL;
+
+  slapDecoder *pDecoder = slapAlloc(slapDecoder, 1);
+
+  if (!pDecoder)
+    goto epilogue;
+
+  slapSetZero(pDecoder, slapDecoder);
+
+  pDecoder->resX = pDecoder->decodedResX = sizeX;
+  pDecoder->resY = pDecoder->decodedResY = sizeY;
+  pDecoder->scale = 1;
+  pDecoder->iframeStep = SLAP_IFRAME_STEP;
+  pDecoder->mode.flagsPack = flags;
+
+  if (pDecoder->mode.flags.blockSkip && (sizeX % SLAP_SKIP_BLOCK_SIZE || sizeY % SLAP_SKIP_BLOCK_SIZE))
+    goto epilogue;
+
+  if (pDecoder->mode.flags.motionCompensation && (sizeX % SLAP_MOTION_BLOCK_SIZE || sizeY % SLAP_MOTION_BLOCK_SIZE))
+    goto epilogue;
+
+  if (pDecoder->mode.flags.encoder > SLAP_FRAME_ENCODER_YUV420_KEY_FRAMES)
+    goto epilogue;
+
+  if (pDecoder->mode.flags.encoder == SLAP_FRAME_ENCODER_YUV420_KEY_FRAMES && (pDecoder->mode.flags.tileColumns || pDecoder->mode.flags.tileRows || pDecoder->mode.flags.sharedJpegTables))
+    goto epilogue;
+
+  if (pDecoder->mode.flags.tileColumns || pDecoder->mode.flags.tileRows)
+  {
+    if (pDecoder->mode.flags.blockSkip || pDecoder->mode.flags.motionCompensation)
+      goto epilogue;
+
+    if (pDecoder->mode.flags.tileColumns == 0 || pDecoder->mode.flags.tileColumns > SLAP_TILE_COUNT_MAX || pDecoder->mode.flags.tileColumns > sizeX / SLAP_TILE_ALIGNMENT)
+      goto epilogue;
+
+    if (pDecoder->mode.flags.tileRows == 0 || pDecoder->mode.flags.tileRows > SLAP_TILE_COUNT_MAX || pDecoder->mode.flags.tileRows > sizeY / SLAP_TILE_ALIGNMENT)
+      goto epilogue;
+  }
+
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  {
+    pDecoder->pDecoders[i] = _slapCreateDecompressor(pDecoder->mode.flags.sharedJpegTables);
+
+    if (!pDecoder->pDecoders[i])
+      goto epilogue;
+  }
+
+  pDecoder->bgraDecoder = tjInitDecompress();
+
+  if (!pDecoder->bgraDecoder)
+    goto epilogue;
+
+  pDecoder->pLastFrame = slapAlloc(uint8_t, sizeX * sizeY * 3 / 2);
+
+  if (!pDecoder->pLastFrame)
+    goto epilogue;
+
+  if (pDecoder->mode.flags.blockSkip)
+  {
+    pDecoder->pBlockFrame = slapAlloc(uint8_t, sizeX * sizeY * 3 / 2);
+
+    if (!pDecoder->pBlockFrame)
+      goto epilogue;
+  }
+
+  return pDecoder;
+
+epilogue:
+  if (pDecoder->pDecoders)
+  {
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+      if (pDecoder->pDecoders[i])
+        _slapDestroyDecompressor(pDecoder->pDecoders[i], pDecoder->mode.flags.sharedJpegTables);
+  }
+
+  if (pDecoder->bgraDecoder)
+    tjDestroy(pDecoder->bgraDecoder);
+
+  if (pDecoder->pLastFrame)
+    slapFreePtr(&pDecoder->pLastFrame);
+
+  slapFreePtr(&pDecoder->pBlockFrame);
+  slapFreePtr(&pDecoder);
+
+  return NULL;
+}
+
+void slapDestroyDecoder(IN_OUT slapDecoder **ppDecoder)
+{
+  if (ppDecoder && *ppDecoder)
+  {
+    if ((*ppDecoder)->pDecoders)
+    {
+      for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+        if ((*ppDecoder)->pDecoders[i])
+          _slapDestroyDecompressor((*ppDecoder)->pDecoders[i], (*ppDecoder)->mode.flags.sharedJpegTables);
+    }
+
+    if ((*ppDecoder)->ppTileDecoders)
+    {
+      const size_t tileDecoderCount = SLAP_SUB_BUFFER_COUNT * (*ppDecoder)->mode.flags.tileColumns * (*ppDecoder)->mode.flags.tileRows;
+
+      for (size_t i = 0; i < tileDecoderCount; i++)
+        if ((*ppDecoder)->ppTileDecoders[i])
+          _slapDestroyDecompressor((*ppDecoder)->ppTileDecoders[i], (*ppDecoder)->mode.flags.sharedJpegTables);
+
+      slapFreePtr(&(*ppDecoder)->ppTileDecoders);
+    }
+
+    if ((*ppDecoder)->bgraDecoder)
+      tjDestroy((*ppDecoder)->bgraDecoder);
+
+    if ((*ppDecoder)->pLastFrame)
+      slapFreePtr(&(*ppDecoder)->pLastFrame);
+
+    slapFreePtr(&(*ppDecoder)->pBlockFrame);
+  }
+
+  slapFreePtr(ppDecoder);
+}
+
+slapResult slapDecoder_DecodeSubFrame(IN slapDecoder *pDecoder, const size_t decoderIndex, IN void **ppCompressedData, IN size_t *pLength, IN_OUT void *pYUVData)
+{
+  uint8_t *pOutData = (uint8_t *)pYUVData;
+
+  if (decoderIndex == 0)
+    return _slapDecoder_DecodeSubFrameToPlane(pDecoder, decoderIndex, ppCompressedData, pLength, pOutData, pDecoder->decodedResX);
+  else if (decoderIndex == 1)
+    return _slapDecoder_DecodeSubFrameToPlane(pDecoder, decoderIndex, ppCompressedData, pLength, pOutData + pDecoder->decodedResX * pDecoder->decodedResY, pDecoder->decodedResX >> 1);
+  else
+    return _slapDecoder_DecodeSubFrameToPlane(pDecoder, decoderIndex, ppCompressedData, pLength, pOutData + pDecoder->decodedResX * pDecoder->decodedResY * 5 / 4, pDecoder->decodedResX >> 1);
+}
+
+slapResult _slapDecoder_DecodeSubFrameToPlane(IN slapDecoder *pDecoder, const size_t decoderIndex, IN void **ppCompressedData, IN size_t *pLength, OUT void *pPlane, const size_t stride)
+{
+  const size_t sizeY = _slapDecoder_IsBlockSkipFrame(pDecoder) ? pDecoder->blockRows * SLAP_SKIP_BLOCK_SIZE : pDecoder->resY;
+
+  // Block skip coded frames without any changed blocks don't contain any image data.
+  if (sizeY == 0)
+    return slapSuccess;
+
+  if (pDecoder->mode.flags.tileColumns)
+  {
+    const size_t tileCount = pDecoder->mode.flags.tileColumns * pDecoder->mode.flags.tileRows;
+
+    for (size_t tile = 0; tile < tileCount; tile++)
+    {
+      const slapResult result = _slapDecompressTile((uint8_t *)pPlane, stride, (const uint8_t *)ppCompressedData[decoderIndex], pLength[decoderIndex], pDecoder->resX, pDecoder->resY, pDecoder->mode.flags.tileColumns, pDecoder->mode.flags.tileRows, decoderIndex, tile, pDecoder->scale, pDecoder->pDecoders[decoderIndex], pDecoder->mode.flags.sharedJpegTables);
+
+      if (result != slapSuccess)
+        return result;
+    }
+
+    return slapSuccess;
+  }
+
+  if (decoderIndex == 0)
+    return _slapDecompressChannel(pPlane, ppCompressedData[decoderIndex], pLength[decoderIndex], pDecoder->resX, sizeY, stride, pDecoder->scale, pDecoder->pDecoders[decoderIndex], pDecoder->mode.flags.sharedJpegTables);
+  else
+    return _slapDecompressChannel(pPlane, ppCompressedData[decoderIndex], pLength[decoderIndex], pDecoder->resX >> 1, sizeY >> 1, stride, pDecoder->scale, pDecoder->pDecoders[decoderIndex], pDecoder->mode.flags.sharedJpegTables);
+}
+
+void _slapDecoder_GetTileAlignedRegion(IN slapDecoder *pDecoder, IN_OUT size_t *pX, IN_OUT size_t *pY, IN_OUT size_t *pSizeX, IN_OUT size_t *pSizeY)
+{
+  const size_t tileColumns = pDecoder->mode.flags.tileColumns;
+  const size_t tileRows = pDecoder->mode.flags.tileRows;
+  const size_t scale = pDecoder->scale;
+
+  if (tileColumns == 0)
+  {
+    *pX = *pY = 0;
+    *pSizeX = pDecoder->decodedResX;
+    *pSizeY = pDecoder->decodedResY;
+    return;
+  }
+
+  *pX *= scale;
+  *pY *= scale;
+  *pSizeX *= scale;
+  *pSizeY *= scale;
+
+  size_t firstColumn = 0;
+  size_t endColumn = tileColumns;
+  size_t firstRow = 0;
+  size_t endRow = tileRows;
+
+  while (firstColumn + 1 < tileColumns && _slapGetTileOffset(pDecoder->resX, tileColumns, firstColumn + 1) <= *pX)
+    firstColumn++;
+
+  while (endColumn > firstColumn + 1 && _slapGetTileOffset(pDecoder->resX, tileColumns, endColumn - 1) >= *pX + *pSizeX)
+    endColumn--;
+
+  while (firstRow + 1 < tileRows && _slapGetTileOffset(pDecoder->resY, tileRows, firstRow + 1) <= *pY)
+    firstRow++;
+
+  while (endRow > firstRow + 1 && _slapGetTileOffset(pDecoder->resY, tileRows, endRow - 1) >= *pY + *pSizeY)
+    endRow--;
+
+  *pX = _slapGetTileOffset(pDecoder->resX, tileColumns, firstColumn);
+  *pY = _slapGetTileOffset(pDecoder->resY, tileRows, firstRow);
+  *pSizeX = (_slapGetTileOffset(pDecoder->resX, tileColumns, endColumn) - *pX) / scale;
+  *pSizeY = (_slapGetTileOffset(pDecoder->resY, tileRows, endRow) - *pY) / scale;
+  *pX /= scale;
+  *pY /= scale;
+}
+
+slapResult _slapDecoder_AllocateTileDecoders(IN slapDecoder *pDecoder)
+{
+  slapResult result = slapSuccess;
+  const size_t tileDecoderCount = SLAP_SUB_BUFFER_COUNT * pDecoder->mode.flags.tileColumns * pDecoder->mode.flags.tileRows;
+
+  if (pDecoder->ppTileDecoders)
+    goto epilogue;
+
+  pDecoder->ppTileDecoders = slapAlloc(void *, tileDecoderCount);
+
+  if (!pDecoder->ppTileDecoders)
+  {
+    result = slapError_MemoryAllocation;
+    goto epilogue;
+  }
+
+  memset(pDecoder->ppTileDecoders, 0, sizeof(void *) * tileDecoderCount);
+
+  for (size_t i = 0; i < tileDecoderCount; i++)
+  {
+    pDecoder->ppTileDecoders[i] = _slapCreateDecompressor(pDecoder->mode.flags.sharedJpegTables);
+
+    if (!pDecoder->ppTileDecoders[i])
+    {
+      result = slapError_Compress_Internal;
+      goto epilogue;
+    }
+  }
+
+epilogue:
+  return result;
+}
+
+bool_t _slapDecoder_IsScaleSupported(IN slapDecoder *pDecoder, const size_t scale)
+{
+  int scalingFactorCount = 0;
+  const tjscalingfactor *pScalingFactors = tjGetScalingFactors(&scalingFactorCount);
+
+  // Only scales that keep the skip blocks, motion blocks and tiles at whole pixels of every plane are supported.
+  if (scale == 0 || (scale & (scale - 1)) || scale > SLAP_DECODE_SCALE_MAX || pDecoder->resX % (scale * 2) || pDecoder->resY % (scale * 2))
+    return 0;
+
+  for (int i = 0; i < scalingFactorCount; i++)
+    if (pScalingFactors[i].num == 1 && (size_t)pScalingFactors[i].denom == scale)
+      return 1;
+
+  return 0;
+}
+
+// Discards the last frame, so decoding has to continue at a key frame.
+slapResult _slapDecoder_SetScale(IN slapDecoder *pDecoder, const size_t scale)
+{
+  slapResult result = slapSuccess;
+  uint8_t *pLastFrame = NULL;
+  uint8_t *pBlockFrame = NULL;
+  const size_t frameSize = (pDecoder->resX / scale) * (pDecoder->resY / scale) * (pDecoder->lumaOnly ? 2 : 3) / 2;
+
+  if (!_slapDecoder_IsScaleSupported(pDecoder, scale))
+  {
+    result = slapError_InvalidParameter;
+    goto epilogue;
+  }
+
+  if (scale == pDecoder->scale)
+    goto epilogue;
+
+  // The buffers are replaced once all of them have been allocated, so the decoder stays usable if this fails.
+  pLastFrame = slapAlloc(uint8_t, frameSize);
+
+  if (!pLastFrame)
+  {
+    result = slapError_MemoryAllocation;
+    goto epilogue;
+  }
+
+  if (pDecoder->mode.flags.blockSkip)
+  {
+    pBlockFrame = slapAlloc(uint8_t, frameSize);
+
+    if (!pBlockFrame)
+    {
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
+  }
+
+  slapFreePtr(&pDecoder->pLastFrame);
+  slapFreePtr(&pDecoder->pBlockFrame);
+
+  pDecoder->pLastFrame = pLastFrame;
+  pDecoder->pBlockFrame = pBlockFrame;
+  pLastFrame = pBlockFrame = NULL;
+
+  pDecoder->scale = scale;
+  pDecoder->decodedResX = pDecoder->resX / scale;
+  pDecoder->decodedResY = pDecoder->resY / scale;
+
+epilogue:
+  slapFreePtr(&pLastFrame);
+  slapFreePtr(&pBlockFrame);
+
+  return result;
+}
+
+// Keeps the luma plane of the last frame, so decoding can continue at the next frame.
+slapResult _slapDecoder_EnableLumaOnly(IN slapDecoder *pDecoder)
+{
+  slapResult result = slapSuccess;
+  const size_t lumaSize = pDecoder->decodedResX * pDecoder->decodedResY;
+  uint8_t *pLastFrame = NULL;
+  uint8_t *pBlockFrame = NULL;
+
+  if (pDecoder->lumaOnly)
+    goto epilogue;
+
+  pLastFrame = slapAlloc(uint8_t, lumaSize);
+
+  if (!pLastFrame)
+  {
+    result = slapError_MemoryAllocation;
+    goto epilogue;
+  }
+
+  if (pDecoder->mode.flags.blockSkip)
+  {
+    pBlockFrame = slapAlloc(uint8_t, lumaSize);
+
+    if (!pBlockFrame)
+    {
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
+  }
+
+  slapMemcpy(pLastFrame, pDecoder->pLastFrame, lumaSize);
+
+  slapFreePtr(&pDecoder->pLastFrame);
+  slapFreePtr(&pDecoder->pBlockFrame);
+
+  pDecoder->pLastFrame = pLastFrame;
+  pDecoder->pBlockFrame = pBlockFrame;
+  pLastFrame = pBlockFrame = NULL;
+
+  pDecoder->lumaOnly = 1;
+
+epilogue:
+  slapFreePtr(&pLastFrame);
+  slapFreePtr(&pBlockFrame);
+
+  return result;
+}
+
+size_t _slapDecoder_GetPlaneCount(IN slapDecoder *pDecoder)
+{
+  return pDecoder->lumaOnly ? 1 : SLAP_SUB_BUFFER_COUNT;
+}
+
+size_t _slapDecoder_GetDecodedFrameSize(IN slapDecoder *pDecoder)
+{
+  return pDecoder->decodedResX * pDecoder->decodedResY * (pDecoder->lumaOnly ? 2 : 3) / 2;
+}
+
+bool_t _slapDecoder_IsYUV420Frame(IN slapDecoder *pDecoder)
+{
+  return pDecoder->mode.flags.encoder == SLAP_FRAME_ENCODER_YUV420_KEY_FRAMES && pDecoder->isKeyFrame;
+}
+
+bool_t _slapDecoder_IsBlockSkipFrame(IN slapDecoder *pDecoder)
+{
+  return pDecoder->mode.flags.blockSkip && pDecoder->iframeStep > 1 && !pDecoder->isKeyFrame;
+}
+
+// Removes the changed block bitmap from the front of the compressed luma plane.
+slapResult _slapDecoder_ReadChangedBlockBitmap(IN slapDecoder *pDecoder, IN_OUT void **ppCompressedData, IN_OUT size_t *pLength)
+{
+  const size_t bitmapSize = _slapGetChangedBlockBitmapSize(pDecoder->resX, pDecoder->resY);
+  const size_t blocksPerRow = pDecoder->resX / SLAP_SKIP_BLOCK_SIZE;
+  size_t changedBlockCount = 0;
+
+  if (pLength[0] < bitmapSize)
+    return slapError_FileError;
+
+  pDecoder->pChangedBlockBitmap = (const uint8_t *)ppCompressedData[0];
+
+  for (size_t i = 0; i < bitmapSize; i++)
+    for (uint8_t bits = pDecoder->pChangedBlockBitmap[i]; bits; bits &= bits - 1)
+      changedBlockCount++;
+
+  pDecoder->blockRows = (changedBlockCount + blocksPerRow - 1) / blocksPerRow;
+
+  ppCompressedData[0] = (uint8_t *)ppCompressedData[0] + bitmapSize;
+  pLength[0] -= bitmapSize;
+
+  return slapSuccess;
+}
+
+bool_t _slapDecoder_IsMotionCompensatedFrame(IN slapDecoder *pDecoder)
+{
+  return pDecoder->mode.flags.motionCompensation && pDecoder->iframeStep > 1 && !pDecoder->isKeyFrame;
+}
+
+// Removes the motion vectors from the front of the compressed luma plane.
+slapResult _slapDecoder_ReadMotionVectors(IN slapDecoder *pDecoder, IN_OUT void **ppCompressedData, IN_OUT size_t *pLength)
+{
+  const size_t motionVectorsSize = _slapGetMotionVectorsSize(pDecoder->resX, pDecoder->resY);
+  const int8_t *pMotionVectors = (const int8_t *)ppCompressedData[0];
+  const size_t blocksPerRow = pDecoder->resX / SLAP_MOTION_BLOCK_SIZE;
+
+  if (pLength[0] < motionVectorsSize)
+    return slapError_FileError;
+
+  // The motion vectors address the last frame, so they can't be trusted to stay inside of it.
+  for (size_t i = 0; i < motionVectorsSize / 2; i++)
+  {
+    const int64_t x = (int64_t)((i % blocksPerRow) * SLAP_MOTION_BLOCK_SIZE) + pMotionVectors[i * 2];
+    const int64_t y = (int64_t)((i / blocksPerRow) * SLAP_MOTION_BLOCK_SIZE) + pMotionVectors[i * 2 + 1];
+
+    if (x < 0 || y < 0 || x > (int64_t)(pDecoder->resX - SLAP_MOTION_BLOCK_SIZE) || y > (int64_t)(pDecoder->resY - SLAP_MOTION_BLOCK_SIZE))
+      return slapError_FileError;
+  }
+
+  pDecoder->pMotionVectors = pMotionVectors;
+
+  ppCompressedData[0] = (uint8_t *)ppCompressedData[0] + motionVectorsSize;
+  pLength[0] -= motionVectorsSize;
+
+  return slapSuccess;
+}
+
+slapResult slapDecoder_FinalizeFrame(IN slapDecoder *pDecoder, IN void *pData, const size_t length, IN_OUT void *pYUVData)
+{
+  slapResult result = slapSuccess;
+
+  if (!pDecoder || !pData || !length || !pYUVData)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  // Planes that have been decoded at a reduced scale don't necessarily consist of whole SSE registers and luma-only frames don't have chroma planes, so they're finalized plane by plane.
+  if (pDecoder->scale > 1 || pDecoder->lumaOnly)
+  {
+    uint8_t *planes[SLAP_SUB_BUFFER_COUNT] = { NULL, NULL, NULL };
+    size_t strides[SLAP_SUB_BUFFER_COUNT] = { 0, 0, 0 };
+
+    planes[0] = (uint8_t *)pYUVData;
+    strides[0] = pDecoder->decodedResX;
+
+    if (!pDecoder->lumaOnly)
+    {
+      planes[1] = planes[0] + pDecoder->decodedResX * pDecoder->decodedResY;
+      planes[2] = planes[0] + pDecoder->decodedResX * pDecoder->decodedResY * 5 / 4;
+      strides[1] = strides[2] = pDecoder->decodedResX >> 1;
+    }
+
+    result = _slapDecoder_FinalizeFramePlanes(pDecoder, planes, strides, 0, 0, pDecoder->decodedResX, pDecoder->decodedResY);
+    goto epilogue;
+  }
+
+  if (pDecoder->iframeStep > 1)
+  {
+    if (_slapDecoder_IsBlockSkipFrame(pDecoder))
+    {
+      // Skipped blocks are taken from the last frame, so the whole frame is copied from there once the changed blocks have been applied.
+      _slapDecodeChangedBlocksDiff(pDecoder->pBlockFrame, pDecoder->pLastFrame, pDecoder->pChangedBlockBitmap, pDecoder->resX, pDecoder->resY, SLAP_SKIP_BLOCK_SIZE, SLAP_SUB_BUFFER_COUNT);
+      slapMemcpy(pYUVData, pDecoder->pLastFrame, pDecoder->resX * pDecoder->resY * 3 / 2);
+    }
+    else if (_slapDecoder_IsMotionCompensatedFrame(pDecoder))
+    {
+      uint8_t *pPlane = (uint8_t *)pYUVData;
+      const uint8_t *pLastFramePlane = pDecoder->pLastFrame;
+
+      for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+      {
+        const size_t sizeX = i == 0 ? pDecoder->resX : pDecoder->resX >> 1;
+        const size_t sizeY = i == 0 ? pDecoder->resY : pDecoder->resY >> 1;
+
+        _slapDecodeLastFrameDiffMotionPlane(pPlane, sizeX, pLastFramePlane, pDecoder->pMotionVectors, sizeX, sizeY, i == 0 ? SLAP_MOTION_BLOCK_SIZE : SLAP_MOTION_BLOCK_SIZE / 2, 1, i == 0 ? 129 : 130);
+
+        pPlane += sizeX * sizeY;
+        pLastFramePlane += sizeX * sizeY;
+      }
+
+      _slapCopyToLastFrame(pYUVData, pDecoder->pLastFrame, pDecoder->resX, pDecoder->resY);
+    }
+    else if (!pDecoder->isKeyFrame)
+    {
+      _slapDecodeLastFrameDiff(pYUVData, pDecoder->pLastFrame, pDecoder->resX, pDecoder->resY);
+    }
+    else
+      _slapCopyToLastFrame(pYUVData, pDecoder->pLastFrame, pDecoder->resX, pDecoder->resY);
+  }
+
+  pDecoder->frameIndex++;
+
+epilogue:
+  return result;
+}
+
+slapResult _slapDecoder_FinalizeFramePlanes(IN slapDecoder *pDecoder, IN_OUT uint8_t **ppPlanes, const size_t *pStrides, const size_t x, const size_t y, const size_t sizeX, const size_t sizeY)
+{
+  if (pDecoder->iframeStep > 1)
+  {
+    uint8_t *pLastFramePlane = pDecoder->pLastFrame;
+    const bool_t isIntraFrame = !pDecoder->isKeyFrame;
+    const bool_t isBlockSkipFrame = _slapDecoder_IsBlockSkipFrame(pDecoder);
+    const bool_t isMotionCompensatedFrame = _slapDecoder_IsMotionCompensatedFrame(pDecoder);
+    const size_t planeCount = _slapDecoder_GetPlaneCount(pDecoder);
+
+    if (isBlockSkipFrame)
+      _slapDecodeChangedBlocksDiff(pDecoder->pBlockFrame, pDecoder->pLastFrame, pDecoder->pChangedBlockBitmap, pDecoder->decodedResX, pDecoder->decodedResY, SLAP_SKIP_BLOCK_SIZE / pDecoder->scale, _slapDecoder_GetPlaneCount(pDecoder));
+
+    for (size_t i = 0; i < planeCount; i++)
+    {
+      const size_t shift = i == 0 ? 0 : 1;
+      const size_t planeSizeX = pDecoder->decodedResX >> shift;
+      const size_t planeSizeY = pDecoder->decodedResY >> shift;
+      const size_t regionSizeX = sizeX >> shift;
+      const size_t regionSizeY = sizeY >> shift;
+      uint8_t *pPlaneRegion = ppPlanes[i] + (y >> shift) * pStrides[i] + (x >> shift);
+      uint8_t *pLastFrameRegion = pLastFramePlane + (y >> shift) * planeSizeX + (x >> shift);
+
+      if (isBlockSkipFrame)
+      {
+        for (size_t row = 0; row < regionSizeY; row++)
+          slapMemcpy(pPlaneRegion + row * pStrides[i], pLastFrameRegion + row * planeSizeX, regionSizeX);
+      }
+      else if (isIntraFrame && !isMotionCompensatedFrame)
+      {
+        _slapDecodeLastFrameDiffPlane(pPlaneRegion, pStrides[i], pLastFrameRegion, planeSizeX, regionSizeX, regionSizeY, i == 0 ? 129 : 130);
+      }
+      else
+      {
+        // Motion compensated blocks are predicted from anywhere in the plane, so the plane is only replaced once it has been decoded completely. (Motion compensated frames aren't tiled, so the region is the whole plane.)
+        if (isMotionCompensatedFrame)
+          _slapDecodeLastFrameDiffMotionPlane(ppPlanes[i], pStrides[i], pLastFramePlane, pDecoder->pMotionVectors, planeSizeX, planeSizeY, SLAP_MOTION_BLOCK_SIZE >> shift, pDecoder->scale, i == 0 ? 129 : 130);
+
+        for (size_t row = 0; row < regionSizeY; row++)
+          slapMemcpy(pLastFrameRegion + row * planeSizeX, pPlaneRegion + row * pStrides[i], regionSizeX);
+      }
+
+      pLastFramePlane += planeSizeX * planeSizeY;
+    }
+  }
+
+  pDecoder->frameIndex++;
+
+  return slapSuccess;
+}
+
+slapFileReader * slapCreateFileReader(const char *filename)
+{
+  slapFileReader *pFileReader = slapAlloc(slapFileReader, 1);
+
+  if (!pFileReader)
+    goto epilogue;
+
+  slapSetZero(pFileReader, slapFileReader);
+
+  pFileReader->pFile = fopen(filename, "rb");
+
+  if (!pFileReader->pFile)
+    goto epilogue;
+
+  if (SLAP_PRE_HEADER_SIZE != fread(pFileReader->preHeaderBlock, sizeof(uint64_t), SLAP_PRE_HEADER_SIZE, pFileReader->pFile))
+    goto epilogue;
+
+  pFileReader->pIndex = _slapCreateFrameIndex();
+
+  if (!pFileReader->pIndex)
+    goto epilogue;
+
+  if (_slapFileReader_IsUnfinalizedStream(pFileReader))
+  {
+    if (slapSuccess != _slapFileReader_BeginStream(pFileReader))
+      goto epilogue;
+  }
+  else
+  {
+    // Files written in a single pass store the header after the payload.
+    if (pFileReader->preHeaderBlock[SLAP_PRE_HEADER_INDEX_OFFSET_INDEX] != 0)
+    {
+      pFileReader->headerOffset = SLAP_PRE_HEADER_SIZE * sizeof(uint64_t);
+
+      if (slapFSeek(pFileReader->pFile, pFileReader->preHeaderBlock[SLAP_PRE_HEADER_INDEX_OFFSET_INDEX], SEEK_SET))
+        goto epilogue;
+    }
+    else
+    {
+      pFileReader->headerOffset = (SLAP_PRE_HEADER_SIZE + pFileReader->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX]) * sizeof(uint64_t);
+    }
+
+    if (slapSuccess != _slapFileReader_ReadIndex(pFileReader))
+      goto epilogue;
+  }
+
+  if (slapSuccess != _slapFileReader_CreateDecoder(pFileReader))
+    goto epilogue;
+
+  return pFileReader;
+
+epilogue:
+  slapDestroyFileReader(&pFileReader);
+
+  return NULL;
+}
+
+slapResult _slapFileReader_ReadIndex(IN slapFileReader *pFileReader)
+{
+  slapResult result = slapSuccess;
+  const uint64_t headerSize = pFileReader->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX];
+  const uint64_t frameCount = pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX];
+  uint64_t header[SLAP_HEADER_BLOCK_SIZE];
+
+  if (pFileReader->preHeaderBlock[SLAP_PRE_HEADER_CONTAINER_FLAGS_INDEX] & SLAP_CONTAINER_FLAG_COMPACT_INDEX)
+  {
+    result = _slapFrameIndex_Read(pFileReader->pIndex, pFileReader->pFile, headerSize, frameCount);
+    goto epilogue;
+  }
+
+  if (frameCount > headerSize / SLAP_HEADER_PER_FRAME_SIZE)
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  // The header is packed into the index a block at a time, so it's never held in memory as a whole.
+  for (uint64_t frame = 0; frame < frameCount; frame += SLAP_HEADER_BLOCK_SIZE / SLAP_HEADER_PER_FRAME_SIZE)
+  {
+    const size_t blockFrameCount = (size_t)(frameCount - frame < SLAP_HEADER_BLOCK_SIZE / SLAP_HEADER_PER_FRAME_SIZE ? frameCount - frame : SLAP_HEADER_BLOCK_SIZE / SLAP_HEADER_PER_FRAME_SIZE);
+
+    if (blockFrameCount * SLAP_HEADER_PER_FRAME_SIZE != fread(header, sizeof(uint64_t), blockFrameCount * SLAP_HEADER_PER_FRAME_SIZE, pFileReader->pFile))
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
+
+    if ((result = _slapFrameIndex_AddFrames(pFileReader->pIndex, header, blockFrameCount)) != slapSuccess)
+      goto epilogue;
+  }
+
+epilogue:
+  return result;
+}
+
+slapFileReader * slapCreateFileReaderMapped(const char *filename)
+{
+  slapFileReader *pFileReader = slapAlloc(slapFileReader, 1);
+
+  if (!pFileReader)
+    goto epilogue;
+
+  slapSetZero(pFileReader, slapFileReader);
+
+  if (slapSuccess != _slapFileReader_MapFile(pFileReader, filename))
+    goto epilogue;
+
+  if (slapSuccess != _slapFileReader_CreateDecoder(pFileReader))
+    goto epilogue;
+
+  return pFileReader;
+
+epilogue:
+  slapDestroyFileReader(&pFileReader);
+
+  return NULL;
+}
+
+slapResult _slapFileReader_MapFile(IN slapFileReader *pFileReader, const char *filename)
+{
+  slapResult result = slapSuccess;
+  LARGE_INTEGER fileSize;
+  uint64_t headerSize = 0;
+  uint64_t headerPosition = 0;
+
+  // Frames are usually read front to back, so let the OS read ahead.
+  pFileReader->mappedFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+  if (pFileReader->mappedFile == INVALID_HANDLE_VALUE)
+  {
+    pFileReader->mappedFile = NULL;
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  if (!GetFileSizeEx(pFileReader->mappedFile, &fileSize))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  pFileReader->mappedFileSize = (uint64_t)fileSize.QuadPart;
+
+  if (pFileReader->mappedFileSize < SLAP_PRE_HEADER_SIZE * sizeof(uint64_t))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  pFileReader->fileMapping = CreateFileMappingA(pFileReader->mappedFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+  if (!pFileReader->fileMapping)
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  pFileReader->pMappedFile = (uint8_t *)MapViewOfFile(pFileReader->fileMapping, FILE_MAP_READ, 0, 0, 0);
+
+  if (!pFileReader->pMappedFile)
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  slapMemcpy(pFileReader->preHeaderBlock, pFileReader->pMappedFile, sizeof(pFileReader->preHeaderBlock));
+
+  headerSize = pFileReader->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX];
+  pFileReader->pIndex = _slapCreateFrameIndex();
+
+  if (!pFileReader->pIndex)
+  {
+    result = slapError_MemoryAllocation;
+    goto epilogue;
+  }
+
+  if (_slapFileReader_IsUnfinalizedStream(pFileReader))
+  {
+    result = _slapFileReader_BeginStream(pFileReader);
+  }
+  else
+  {
+    // Files written in a single pass store the header after the payload.
+    if (pFileReader->preHeaderBlock[SLAP_PRE_HEADER_INDEX_OFFSET_INDEX] != 0)
+    {
+      headerPosition = pFileReader->preHeaderBlock[SLAP_PRE_HEADER_INDEX_OFFSET_INDEX];
+      pFileReader->headerOffset = SLAP_PRE_HEADER_SIZE * sizeof(uint64_t);
+    }
+    else
+    {
+      headerPosition = SLAP_PRE_HEADER_SIZE * sizeof(uint64_t);
+      pFileReader->headerOffset = (SLAP_PRE_HEADER_SIZE + headerSize) * sizeof(uint64_t);
+    }
+
+    if (headerPosition % sizeof(uint64_t) != 0 || headerPosition > pFileReader->mappedFileSize || headerSize > (pFileReader->mappedFileSize - headerPosition) / sizeof(uint64_t))
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
+
+    // Compact indices are used straight from the mapped file.
+    if (pFileReader->preHeaderBlock[SLAP_PRE_HEADER_CONTAINER_FLAGS_INDEX] & SLAP_CONTAINER_FLAG_COMPACT_INDEX)
+    {
+      result = _slapFrameIndex_Map(pFileReader->pIndex, (const uint64_t *)(pFileReader->pMappedFile + (size_t)headerPosition), headerSize, pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX]);
+    }
+    else
+    {
+      if (pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX] > headerSize / SLAP_HEADER_PER_FRAME_SIZE)
+      {
+        result = slapError_FileError;
+        goto epilogue;
+      }
+
+      result = _slapFrameIndex_AddFrames(pFileReader->pIndex, (const uint64_t *)(pFileReader->pMappedFile + (size_t)headerPosition), (size_t)pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX]);
+    }
+  }
+
+epilogue:
+  return result;
+}
+
+slapResult _slapFileReader_CreateDecoder(IN slapFileReader *pFileReader)
+{
+  pFileReader->pDecoder = slapCreateDecoder(pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX], pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX], pFileReader->preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX]);
+
+  if (!pFileReader->pDecoder)
+    return slapError_MemoryAllocation;
+
+  pFileReader->pDecoder->iframeStep = pFileReader->preHeaderBlock[SLAP_PRE_HEADER_IFRAME_STEP_INDEX];
+
+  pFileReader->pDecodedFrameYUV = slapAlloc(uint8_t, pFileReader->pDecoder->resX * pFileReader->pDecoder->resY * 3 / 2);
+
+  if (!pFileReader->pDecodedFrameYUV)
+    return slapError_MemoryAllocation;
+
+  return slapSuccess;
+}
+
+slapVideo * slapCreateVideo(const char *filename)
+{
+  slapVideo *pVideo = NULL;
+
+  if (!filename)
+    goto epilogue;
+
+  pVideo = slapAlloc(slapVideo, 1);
+
+  if (!pVideo)
+    goto epilogue;
+
+  slapSetZero(pVideo, slapVideo);
+
+  pVideo->referenceCount = 1;
+  pVideo->pFileReader = slapAlloc(slapFileReader, 1);
+
+  if (!pVideo->pFileReader)
+    goto epilogue;
+
+  slapSetZero(pVideo->pFileReader, slapFileReader);
+
+  if (slapSuccess != _slapFileReader_MapFile(pVideo->pFileReader, filename))
+    goto epilogue;
+
+  return pVideo;
+
+epilogue:
+  slapDestroyVideo(&pVideo);
+
+  return NULL;
+}
+
+void slapDestroyVideo(IN_OUT slapVideo **ppVideo)
+{
+  if (ppVideo && *ppVideo)
+  {
+    // The last reference destroys the video.
+    if (InterlockedDecrement(&(*ppVideo)->referenceCount) == 0)
+    {
+      slapDestroyFileReader(&(*ppVideo)->pFileReader);
+      slapFreePtr(ppVideo);
+    }
+
+    *ppVideo = NULL;
+  }
+}
+
+slapFileReader * slapCreateFileReaderFromVideo(IN slapVideo *pVideo)
+{
+  slapFileReader *pFileReader = NULL;
+
+  if (!pVideo)
+    goto epilogue;
+
+  pFileReader = slapAlloc(slapFileReader, 1);
+
+  if (!pFileReader)
+    goto epilogue;
+
+  slapSetZero(pFileReader, slapFileReader);
+
+  // The reader decodes straight from the mapped file of the video and reads the index of the video, neither of which are ever modified.
+  InterlockedIncrement(&pVideo->referenceCount);
+  pFileReader->pVideo = pVideo;
+
+  slapMemcpy(pFileReader->preHeaderBlock, pVideo->pFileReader->preHeaderBlock, sizeof(pFileReader->preHeaderBlock));
+  pFileReader->pIndex = pVideo->pFileReader->pIndex;
+  pFileReader->headerOffset = pVideo->pFileReader->headerOffset;
+  pFileReader->pMappedFile = pVideo->pFileReader->pMappedFile;
+  pFileReader->mappedFileSize = pVideo->pFileReader->mappedFileSize;
+
+  if (slapSuccess != _slapFileReader_CreateDecoder(pFileReader))
+    goto epilogue;
+
+  return pFileReader;
+
+epilogue:
+  slapDestroyFileReader(&pFileReader);
+
+  return NULL;
+}
+
+void slapDestroyFileReader(IN_OUT slapFileReader **ppFileReader)
+{
+  if (ppFileReader && *ppFileReader)
+  {
+    // Readers of a shared video only hold a reference to its mapped file and index.
+    if ((*ppFileReader)->pVideo)
+    {
+      (*ppFileReader)->pMappedFile = NULL;
+      (*ppFileReader)->pCurrentFrame = NULL;
+      (*ppFileReader)->pIndex = NULL;
+
+      slapDestroyVideo(&(*ppFileReader)->pVideo);
+    }
+
+    if ((*ppFileReader)->pMappedFile)
+    {
+      UnmapViewOfFile((*ppFileReader)->pMappedFile);
+      (*ppFileReader)->pCurrentFrame = NULL;
+    }
+
+    if ((*ppFileReader)->fileMapping)
+      CloseHandle((*ppFileReader)->fileMapping);
+
+    if ((*ppFileReader)->mappedFile)
+      CloseHandle((*ppFileReader)->mappedFile);
+
+    _slapDestroyFrameIndex(&(*ppFileReader)->pIndex);
+    slapFreePtr(&(*ppFileReader)->pCurrentFrame);
+    slapFreePtr(&(*ppFileReader)->pDecodedFrameYUV);
+    slapFreePtr(&(*ppFileReader)->pDecodedFrameBGRA);
+    slapDestroyDecoder(&(*ppFileReader)->pDecoder);
+    _slapDestroyThreadPool(&(*ppFileReader)->pThreadPool);
+    slapFreePtr(&(*ppFileReader)->pTileTasks);
+    _slapFileReader_ClearFrameCache(*ppFileReader);
+
+    if ((*ppFileReader)->pFile)
+      fclose((*ppFileReader)->pFile);
+  }
+
+  slapFreePtr(ppFileReader);
+}
+
+bool_t _slapFileReader_IsUnfinalizedStream(IN slapFileReader *pFileReader)
+{
+  return (pFileReader->preHeaderBlock[SLAP_PRE_HEADER_CONTAINER_FLAGS_INDEX] & SLAP_CONTAINER_FLAG_STREAMING) && pFileReader->preHeaderBlock[SLAP_PRE_HEADER_INDEX_OFFSET_INDEX] == 0;
+}
+
+slapResult _slapFileReader_BeginStream(IN slapFileReader *pFileReader)
+{
+  pFileReader->headerOffset = SLAP_PRE_HEADER_SIZE * sizeof(uint64_t);
+  pFileReader->streamPosition = pFileReader->headerOffset;
+  pFileReader->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX] = 0;
+  pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX] = 0;
+
+  return _slapFileReader_ScanStream(pFileReader);
+}
+
+slapResult _slapFileReader_ReadAt(IN slapFileReader *pFileReader, const uint64_t position, OUT void *pData, const size_t size)
+{
+  if (pFileReader->pMappedFile)
+  {
+    if (position > pFileReader->mappedFileSize || size > pFileReader->mappedFileSize - position)
+      return slapError_FileError;
+
+    slapMemcpy(pData, pFileReader->pMappedFile + (size_t)position, size);
+
+    return slapSuccess;
+  }
+
+  if (slapFSeek(pFileReader->pFile, position, SEEK_SET))
+    return slapError_FileError;
+
+  if (size != fread(pData, 1, size, pFileReader->pFile))
+    return slapError_FileError;
+
+  return slapSuccess;
+}
+
+slapResult _slapFileReader_ScanStream(IN slapFileReader *pFileReader)
+{
+  slapResult result = slapSuccess;
+  uint64_t packetHeader[SLAP_PACKET_HEADER_SIZE];
+  int64_t fileSize = 0;
+
+  if (pFileReader->pMappedFile)
+  {
+    fileSize = (int64_t)pFileReader->mappedFileSize;
+  }
+  else
+  {
+    if (slapFSeek(pFileReader->pFile, 0, SEEK_END))
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
+
+    fileSize = slapFTell(pFileReader->pFile);
+
+    if (fileSize < 0)
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
+  }
+
+  // Stops at the first incomplete packet. It's either still being written or has been cut off by a crash.
+  while (pFileReader->streamPosition + sizeof(packetHeader) <= (uint64_t)fileSize)
+  {
+    const uint64_t frameIndex = pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX];
+    const uint64_t dataPosition = pFileReader->streamPosition + sizeof(packetHeader);
+    uint64_t frameHeader[SLAP_HEADER_PER_FRAME_SIZE];
+    uint64_t frameSize = 0;
+
+    if ((result = _slapFileReader_ReadAt(pFileReader, pFileReader->streamPosition, packetHeader, sizeof(packetHeader))) != slapSuccess)
+      goto epilogue;
+
+    if (packetHeader[SLAP_PACKET_MAGIC_INDEX] != SLAP_PACKET_MAGIC || (packetHeader[SLAP_PACKET_FRAME_INDEX_INDEX] & ~SLAP_KEY_FRAME_FLAG) != frameIndex)
+      goto epilogue;
+
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      if (packetHeader[SLAP_PACKET_SUB_FRAME_SIZE_OFFSET + i] > (uint64_t)fileSize - dataPosition - frameSize)
+        goto epilogue;
+
+      frameSize += packetHeader[SLAP_PACKET_SUB_FRAME_SIZE_OFFSET + i];
+    }
+
+    frameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX] = dataPosition - pFileReader->headerOffset;
+    frameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX] = frameSize | (packetHeader[SLAP_PACKET_FRAME_INDEX_INDEX] & SLAP_KEY_FRAME_FLAG);
+    frameSize = 0;
+
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      frameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX] = frameSize;
+      frameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX] = packetHeader[SLAP_PACKET_SUB_FRAME_SIZE_OFFSET + i];
+      frameSize += packetHeader[SLAP_PACKET_SUB_FRAME_SIZE_OFFSET + i];
+    }
+
+    if ((result = _slapFrameIndex_AddFrame(pFileReader->pIndex, frameHeader)) != slapSuccess)
+      goto epilogue;
+
+    pFileReader->streamPosition = dataPosition + frameSize;
+    pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX]++;
+  }
+
+epilogue:
+  return result;
+}
+
+slapResult _slapFileReader_UpdateStreamPreHeader(IN slapFileReader *pFileReader)
+{
+  slapResult result = slapSuccess;
+  uint64_t preHeaderBlock[SLAP_PRE_HEADER_SIZE];
+  slapDecoder *pDecoder = NULL;
+
+  if ((result = _slapFileReader_ReadAt(pFileReader, 0, preHeaderBlock, sizeof(preHeaderBlock))) != slapSuccess)
+    goto epilogue;
+
+  if (preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX] != pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX] || preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX] != pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX])
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  // Nothing has been decoded yet, so the decoder can be replaced as long as it keeps the scale and luma only setting.
+  if (preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX] != pFileReader->preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX])
+  {
+    pDecoder = slapCreateDecoder(preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX], preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX], preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX]);
+
+    if (!pDecoder)
+    {
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
+
+    if ((result = _slapDecoder_SetScale(pDecoder, pFileReader->pDecoder->scale)) != slapSuccess)
+      goto epilogue;
+
+    if (pFileReader->pDecoder->lumaOnly)
+      if ((result = _slapDecoder_EnableLumaOnly(pDecoder)) != slapSuccess)
+        goto epilogue;
+
+    slapDestroyDecoder(&pFileReader->pDecoder);
+    pFileReader->pDecoder = pDecoder;
+    pDecoder = NULL;
+
+    slapFreePtr(&pFileReader->pTileTasks);
+    pFileReader->preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX] = preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX];
+  }
+
+  pFileReader->preHeaderBlock[SLAP_PRE_HEADER_IFRAME_STEP_INDEX] = preHeaderBlock[SLAP_PRE_HEADER_IFRAME_STEP_INDEX];
+  pFileReader->pDecoder->iframeStep = preHeaderBlock[SLAP_PRE_HEADER_IFRAME_STEP_INDEX];
+
+epilogue:
+  slapDestroyDecoder(&pDecoder);
+
+  return result;
+}
+
+slapResult slapFileReader_Refresh(IN slapFileReader *pFileReader)
+{
+  slapResult result = slapSuccess;
+  HANDLE fileMapping = NULL;
+  uint8_t *pMappedFile = NULL;
+  LARGE_INTEGER fileSize;
+
+  if (!pFileReader)
+    return slapError_ArgumentNull;
+
+  // Only streaming videos that hadn't been finalized when they were opened can grow.
+  if (pFileReader->streamPosition == 0)
+    return slapSuccess;
+
+  if (pFileReader->pMappedFile)
+  {
+    if (!GetFileSizeEx(pFileReader->mappedFile, &fileSize))
+      return slapError_FileError;
+
+    if ((uint64_t)fileSize.QuadPart != pFileReader->mappedFileSize)
+    {
+      // Map the grown file before releasing the old view, so the reader stays usable if this fails.
+      fileMapping = CreateFileMappingA(pFileReader->mappedFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+      if (!fileMapping)
+        return slapError_FileError;
+
+      pMappedFile = (uint8_t *)MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+
+      if (!pMappedFile)
+      {
+        CloseHandle(fileMapping);
+        return slapError_FileError;
+      }
+
+      // The current frame points into the old view and has to be moved over to the new one.
+      if (pFileReader->pCurrentFrame)
+        pFileReader->pCurrentFrame = pMappedFile + ((uint8_t *)pFileReader->pCurrentFrame - pFileReader->pMappedFile);
+
+      UnmapViewOfFile(pFileReader->pMappedFile);
+      CloseHandle(pFileReader->fileMapping);
+
+      pFileReader->fileMapping = fileMapping;
+      pFileReader->pMappedFile = pMappedFile;
+      pFileReader->mappedFileSize = (uint64_t)fileSize.QuadPart;
+    }
+  }
+
+  // The writer patches the pre-header once more before the first frame.
+  if (pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX] == 0)
+    if ((result = _slapFileReader_UpdateStreamPreHeader(pFileReader)) != slapSuccess)
+      return result;
+
+  return _slapFileReader_ScanStream(pFileReader);
+}
+
+slapResult slapFileReader_SetThreadCount(IN slapFileReader *pFileReader, const size_t threadCount)
+{
+  if (!pFileReader)
+    return slapError_ArgumentNull;
+
+  if (threadCount == 0)
+    return slapError_InvalidParameter;
+
+  _slapDestroyThreadPool(&pFileReader->pThreadPool);
+
+  // The calling thread participates in the work, so it doesn't need a worker of its own.
+  if (threadCount > 1)
+  {
+    pFileReader->pThreadPool = _slapCreateThreadPool(threadCount - 1);
+
+    if (!pFileReader->pThreadPool)
+      return slapError_MemoryAllocation;
+  }
+
+  return slapSuccess;
+}
+
+slapResult slapFileReader_SetDecodeScale(IN slapFileReader *pFileReader, const size_t scale)
+{
+  slapResult result = slapSuccess;
+  uint8_t *pDecodedFrameYUV = NULL;
+
+  if (!pFileReader)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (!_slapDecoder_IsScaleSupported(pFileReader->pDecoder, scale))
+  {
+    result = slapError_InvalidParameter;
+    goto epilogue;
+  }
+
+  if (scale == pFileReader->pDecoder->scale)
+    goto epilogue;
+
+  pDecodedFrameYUV = slapAlloc(uint8_t, (pFileReader->pDecoder->resX / scale) * (pFileReader->pDecoder->resY / scale) * (pFileReader->pDecoder->lumaOnly ? 2 : 3) / 2);
+
+  if (!pDecodedFrameYUV)
+  {
+    result = slapError_MemoryAllocation;
+    goto epilogue;
+  }
+
+  if ((result = _slapDecoder_SetScale(pFileReader->pDecoder, scale)) != slapSuccess)
+    goto epilogue;
+
+  slapFreePtr(&pFileReader->pDecodedFrameYUV);
+  pFileReader->pDecodedFrameYUV = pDecodedFrameYUV;
+  pDecodedFrameYUV = NULL;
+
+  // The BGRA buffer is allocated again at the new resolution when it's needed.
+  slapFreePtr(&pFileReader->pDecodedFrameBGRA);
+  _slapFileReader_ClearFrameCache(pFileReader);
+
+  // The last frame has been discarded, so decoding continues at the key frame that the next frame depends on.
+  if (pFileReader->frameIndex < slapFileReader_GetFrameCount(pFileReader))
+    pFileReader->pDecoder->frameIndex = pFileReader->frameIndex = slapFileReader_GetKeyFrameIndex(pFileReader, pFileReader->frameIndex);
+
+epilogue:
+  slapFreePtr(&pDecodedFrameYUV);
+
+  return result;
+}
+
+slapResult slapFileReader_EnableLumaOnly(IN slapFileReader *pFileReader)
+{
+  slapResult result = slapSuccess;
+  uint8_t *pDecodedFrameY = NULL;
+  const size_t lumaSize = pFileReader ? pFileReader->pDecoder->decodedResX * pFileReader->pDecoder->decodedResY : 0;
+
+  if (!pFileReader)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (pFileReader->pDecoder->lumaOnly)
+    goto epilogue;
+
+  pDecodedFrameY = slapAlloc(uint8_t, lumaSize);
+
+  if (!pDecodedFrameY)
+  {
+    result = slapError_MemoryAllocation;
+    goto epilogue;
+  }
+
+  if ((result = _slapDecoder_EnableLumaOnly(pFileReader->pDecoder)) != slapSuccess)
+    goto epilogue;
+
+  slapMemcpy(pDecodedFrameY, pFileReader->pDecodedFrameYUV, lumaSize);
+  slapFreePtr(&pFileReader->pDecodedFrameYUV);
+  pFileReader->pDecodedFrameYUV = pDecodedFrameY;
+  pDecodedFrameY = NULL;
+
+  slapFreePtr(&pFileReader->pDecodedFrameBGRA);
+  _slapFileReader_ClearFrameCache(pFileReader);
+
+epilogue:
+  slapFreePtr(&pDecodedFrameY);
+
+  return result;
+}
+
+slapResult slapFileReader_GetResolution(IN slapFileReader *pFileReader, OUT size_t *pResolutionX, OUT size_t *pResolutionY)
+{
+  if (!pFileReader || !pResolutionX || !pResolutionY)
+    return slapError_ArgumentNull;
+
+  *pResolutionX = pFileReader->pDecoder->decodedResX;
+  *pResolutionY = pFileReader->pDecoder->decodedResY;
+
+  return slapSuccess;
+}
+
+size_t slapFileReader_GetFrameCount(IN slapFileReader *pFileReader)
+{
+  if (!pFileReader)
+    return 0;
+
+  return pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX];
+}
+
+size_t slapFileReader_GetIntraFrameStep(IN slapFileReader *pFileReader)
+{
+  if (!pFileReader)
+    return (size_t)-1;
+
+  return pFileReader->pDecoder->iframeStep;
+}
+
+slapResult slapFileReader_SetFrameIndex(IN slapFileReader *pFileReader, const size_t frameIndex)
+{
+  if (!pFileReader)
+    return slapError_ArgumentNull;
+
+  if (slapFileReader_GetFrameCount(pFileReader) <= frameIndex)
+    return slapError_EndOfStream;
+
+  pFileReader->pDecoder->frameIndex = pFileReader->frameIndex = slapFileReader_GetKeyFrameIndex(pFileReader, frameIndex);
+  
+  return slapSuccess;
+}
+
+slapResult slapFileReader_SetFrameIndexExact(IN slapFileReader *pFileReader, const size_t frameIndex)
+{
+  slapResult result = slapSuccess;
+  size_t keyFrameIndex;
+
+  if (!pFileReader)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (slapFileReader_GetFrameCount(pFileReader) <= frameIndex)
+  {
+    result = slapError_EndOfStream;
+    goto epilogue;
+  }
+
+  keyFrameIndex = slapFileReader_GetKeyFrameIndex(pFileReader, frameIndex);
+
+  // If the frame is ahead of the current frame in the same group of frames, the last frame already is the reference of the current frame, so the key frame isn't decoded again.
+  if (pFileReader->frameIndex <= keyFrameIndex || pFileReader->frameIndex > frameIndex)
+    pFileReader->pDecoder->frameIndex = pFileReader->frameIndex = keyFrameIndex;
+
+  // Cached frames are reference states as well, so decoding continues at the last cached frame of the group of frames up to the frame.
+  for (size_t i = 0; i < pFileReader->cachedFrameCount; i++)
+    if (pFileReader->pCachedFrames[i].frameIndex > pFileReader->frameIndex && pFileReader->pCachedFrames[i].frameIndex <= frameIndex)
+      pFileReader->pDecoder->frameIndex = pFileReader->frameIndex = pFileReader->pCachedFrames[i].frameIndex;
+
+  while (pFileReader->frameIndex < frameIndex)
+    if ((result = slapFileReader_GetNextFrame(pFileReader)) != slapSuccess)
+      goto epilogue;
+
+epilogue:
+  return result;
+}
+
+size_t slapFileReader_GetKeyFrameIndex(IN slapFileReader *pFileReader, const size_t frameIndex)
+{
+  if (!pFileReader || slapFileReader_GetFrameCount(pFileReader) <= frameIndex)
+    return (size_t)-1;
+
+  // Key frames are at most IntraFrameStep frames apart.
+  for (size_t i = frameIndex; i > 0; i--)
+    if (_slapFileReader_IsKeyFrame(pFileReader, i))
+      return i;
+
+  return 0;
+}
+
+bool_t _slapFileReader_IsKeyFrame(IN slapFileReader *pFileReader, const size_t frameIndex)
+{
+  if (pFileReader->pDecoder->mode.flags.adaptiveKeyFrames)
+    return _slapFrameIndex_IsKeyFrame(pFileReader->pIndex, frameIndex);
+
+  return frameIndex % pFileReader->pDecoder->iframeStep == 0;
+}
+
+size_t slapFileReader_GetFrameIndex(IN slapFileReader *pFileReader)
+{
+  if (!pFileReader)
+    return (size_t)-1;
+
+  return pFileReader->frameIndex;
+}
+
+slapResult slapFileReader_ReadNextFrame(IN slapFileReader *pFileReader)
+{
+  slapResult result = slapSuccess;
+  uint64_t position;
+
+  if (!pFileReader)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (pFileReader->frameIndex >= pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX])
+  {
+    result = slapError_EndOfStream;
+    goto epilogue;
+  }
+
+  if ((result = _slapFrameIndex_GetFrame(pFileReader->pIndex, pFileReader->frameIndex, pFileReader->currentFrameHeader)) != slapSuccess)
+    goto epilogue;
+
+  position = pFileReader->currentFrameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX] + pFileReader->headerOffset;
+  pFileReader->currentFrameSize = pFileReader->currentFrameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX] & ~SLAP_KEY_FRAME_FLAG;
+  pFileReader->pDecoder->isKeyFrame = _slapFileReader_IsKeyFrame(pFileReader, pFileReader->frameIndex);
+
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  {
+    const uint64_t *pSubFrameHeader = pFileReader->currentFrameHeader + SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2;
+
+    if (pSubFrameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX] > pFileReader->currentFrameSize || pSubFrameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX] > pFileReader->currentFrameSize - pSubFrameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX])
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
+  }
+
+  // Only the luma sub buffer is read if the chroma planes aren't decoded.
+  if (pFileReader->pDecoder->lumaOnly)
+  {
+    const uint64_t *pSubFrameHeader = pFileReader->currentFrameHeader + SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET;
+
+    position += pSubFrameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX];
+    pFileReader->currentFrameSize = pSubFrameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+  }
+
+  // Mapped files are decoded straight from the mapped view.
+  if (pFileReader->pMappedFile)
+  {
+    if (position > pFileReader->mappedFileSize || pFileReader->currentFrameSize > pFileReader->mappedFileSize - position)
+    {
+      result = slapError_FileError;
+      goto epilogue;
+    }
+
+    pFileReader->pCurrentFrame = pFileReader->pMappedFile + (size_t)position;
+    pFileReader->frameIndex++;
+
+    goto epilogue;
+  }
+
+  if (pFileReader->currentFrameAllocatedSize < pFileReader->currentFrameSize)
+  {
+    slapRealloc(&pFileReader->pCurrentFrame, uint8_t, pFileReader->currentFrameSize);
+    pFileReader->currentFrameAllocatedSize = pFileReader->currentFrameSize;
+
+    if (!pFileReader->pCurrentFrame)
+    {
+      pFileReader->currentFrameAllocatedSize = 0;
+      result = slapError_MemoryAllocation;
+      goto epilogue;
+    }
+  }
+
+  if (slapFSeek(pFileReader->pFile, position, SEEK_SET))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  if (pFileReader->currentFrameSize != fread(pFileReader->pCurrentFrame, 1, pFileReader->currentFrameSize, pFileReader->pFile))
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  pFileReader->frameIndex++;
+
+epilogue:
+  return result;
+}
+
+// Decodes all tiles that intersect the luma region (in decoded pixels). Frames that aren't tiled are decoded as a whole.
+slapResult _slapFileReader_DecodeTiles(IN slapFileReader *pFileReader, IN void **ppCompressedData, IN size_t *pLength, OUT uint8_t **ppPlanes, const size_t *pStrides, const size_t x, const size_t y, const size_t sizeX, const size_t sizeY)
+{
+  slapResult result = slapSuccess;
+  slapDecoder *pDecoder = pFileReader->pDecoder;
+  const size_t tileCount = pDecoder->mode.flags.tileColumns * pDecoder->mode.flags.tileRows;
+  const size_t planeCount = _slapDecoder_GetPlaneCount(pDecoder);
+  size_t pendingTasks = 0;
+
+  if (pFileReader->pThreadPool)
+  {
+    if ((result = _slapDecoder_AllocateTileDecoders(pDecoder)) != slapSuccess)
+      goto epilogue;
+
+    if (!pFileReader->pTileTasks)
+    {
+      pFileReader->pTileTasks = slapAlloc(_slapDecodeTileTask, SLAP_SUB_BUFFER_COUNT * tileCount);
+
+      if (!pFileReader->pTileTasks)
+      {
+        result = slapError_MemoryAllocation;
+        goto epilogue;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < planeCount; i++)
+  {
+    for (size_t tile = 0; tile < tileCount; tile++)
+    {
+      size_t tileX, tileY, tileSizeX, tileSizeY;
+      _slapGetTileRect(pDecoder->resX, pDecoder->resY, pDecoder->mode.flags.tileColumns, pDecoder->mode.flags.tileRows, 0, tile, &tileX, &tileY, &tileSizeX, &tileSizeY);
+
+      if (pFileReader->pThreadPool)
+        pFileReader->pTileTasks[i * tileCount + tile].result = slapSuccess;
+
+      tileX /= pDecoder->scale;
+      tileY /= pDecoder->scale;
+      tileSizeX /= pDecoder->scale;
+      tileSizeY /= pDecoder->scale;
+
+      if (tileX >= x + sizeX || tileX + tileSizeX <= x || tileY >= y + sizeY || tileY + tileSizeY <= y)
+        continue;
+
+      if (pFileReader->pThreadPool)
+      {
+        _slapDecodeTileTask *pTask = &pFileReader->pTileTasks[i * tileCount + tile];
+
+        pTask->pDecoder = pDecoder;
+        pTask->subFrameIndex = i;
+        pTask->tileIndex = tile;
+        pTask->pCompressedData = (const uint8_t *)ppCompressedData[i];
+        pTask->length = pLength[i];
+        pTask->pPlane = ppPlanes[i];
+        pTask->stride = pStrides[i];
+
+        _slapThreadPool_Enqueue(pFileReader->pThreadPool, _slapDecoder_DecodeTileTask, pTask, &pendingTasks);
+      }
+      else
+      {
+        if ((result = _slapDecompressTile(ppPlanes[i], pStrides[i], (const uint8_t *)ppCompressedData[i], pLength[i], pDecoder->resX, pDecoder->resY, pDecoder->mode.flags.tileColumns, pDecoder->mode.flags.tileRows, i, tile, pDecoder->scale, pDecoder->pDecoders[i], pDecoder->mode.flags.sharedJpegTables)) != slapSuccess)
+          goto epilogue;
+      }
+    }
+  }
+
+  if (pFileReader->pThreadPool)
+  {
+    _slapThreadPool_Wait(pFileReader->pThreadPool, &pendingTasks);
+
+    for (size_t i = 0; i < planeCount * tileCount; i++)
+      if ((result = pFileReader->pTileTasks[i].result) != slapSuccess)
+        goto epilogue;
+  }
+
+epilogue:
+  return result;
+}
+
+slapResult _slapFileReader_DecodeCurrentFrameToPlanes(IN slapFileReader *pFileReader, OUT uint8_t **ppPlanes, const size_t *pStrides, const size_t x, const size_t y, const size_t sizeX, const size_t sizeY)
+{
+  slapResult result = slapSuccess;
+  void *dataAddrs[SLAP_SUB_BUFFER_COUNT];
+  size_t dataSizes[SLAP_SUB_BUFFER_COUNT];
+  _slapDecodeSubFrameTask subFrameTasks[SLAP_SUB_BUFFER_COUNT];
+  size_t pendingTasks = 0;
+  uint8_t *blockPlanes[SLAP_SUB_BUFFER_COUNT] = { NULL, NULL, NULL };
+  size_t blockStrides[SLAP_SUB_BUFFER_COUNT] = { 0, 0, 0 };
+  const size_t planeCount = _slapDecoder_GetPlaneCount(pFileReader->pDecoder);
+
+  // Luma-only frames only contain the luma sub buffer. (see `slapFileReader_ReadNextFrame`)
+  if (pFileReader->pDecoder->lumaOnly)
+  {
+    dataAddrs[0] = pFileReader->pCurrentFrame;
+    dataSizes[0] = pFileReader->currentFrameSize;
+  }
+  else
+  {
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      dataAddrs[i] = ((uint8_t *)pFileReader->pCurrentFrame) + pFileReader->currentFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX];
+      dataSizes[i] = pFileReader->currentFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+    }
+  }
+
+  // The changed blocks of block skip coded frames are decoded into the block frame and applied to the last frame when the frame is finalized.
+  if (_slapDecoder_IsBlockSkipFrame(pFileReader->pDecoder))
+  {
+    if ((result = _slapDecoder_ReadChangedBlockBitmap(pFileReader->pDecoder, dataAddrs, dataSizes)) != slapSuccess)
+      goto epilogue;
+
+    blockPlanes[0] = pFileReader->pDecoder->pBlockFrame;
+    blockStrides[0] = pFileReader->pDecoder->decodedResX;
+
+    if (!pFileReader->pDecoder->lumaOnly)
+    {
+      blockPlanes[1] = blockPlanes[0] + pFileReader->pDecoder->decodedResX * pFileReader->pDecoder->decodedResY;
+      blockPlanes[2] = blockPlanes[0] + pFileReader->pDecoder->decodedResX * pFileReader->pDecoder->decodedResY * 5 / 4;
+      blockStrides[1] = blockStrides[2] = pFileReader->pDecoder->decodedResX >> 1;
+    }
+
+    ppPlanes = blockPlanes;
+    pStrides = blockStrides;
+  }
+  else if (_slapDecoder_IsMotionCompensatedFrame(pFileReader->pDecoder))
+  {
+    if ((result = _slapDecoder_ReadMotionVectors(pFileReader->pDecoder, dataAddrs, dataSizes)) != slapSuccess)
+      goto epilogue;
+  }
+
+  if (_slapDecoder_IsYUV420Frame(pFileReader->pDecoder) && pFileReader->pDecoder->lumaOnly)
+  {
+    result = _slapDecompressYUV420Luma(ppPlanes[0], pStrides[0], dataAddrs[0], dataSizes[0], pFileReader->pDecoder->resX, pFileReader->pDecoder->resY, pFileReader->pDecoder->scale, pFileReader->pDecoder->pDecoders[0]);
+  }
+  else if (_slapDecoder_IsYUV420Frame(pFileReader->pDecoder))
+  {
+    // The whole frame is decoded in one go, so there's nothing to be done in parallel.
+    result = _slapDecompressYUV420(ppPlanes, pStrides, dataAddrs[0], dataSizes[0], pFileReader->pDecoder->resX, pFileReader->pDecoder->resY, pFileReader->pDecoder->scale, pFileReader->pDecoder->pDecoders[0]);
+  }
+  else if (pFileReader->pDecoder->mode.flags.tileColumns)
+  {
+    result = _slapFileReader_DecodeTiles(pFileReader, dataAddrs, dataSizes, ppPlanes, pStrides, x, y, sizeX, sizeY);
+  }
+  else if (pFileReader->pThreadPool && planeCount > 1)
+  {
+    for (size_t i = 0; i < planeCount; i++)
+    {
+      subFrameTasks[i].pDecoder = pFileReader->pDecoder;
+      subFrameTasks[i].subFrameIndex = i;
+      subFrameTasks[i].ppCompressedData = dataAddrs;
+      subFrameTasks[i].pLength = dataSizes;
+      subFrameTasks[i].pPlane = ppPlanes[i];
+      subFrameTasks[i].stride = pStrides[i];
+      subFrameTasks[i].result = slapSuccess;
+
+      _slapThreadPool_Enqueue(pFileReader->pThreadPool, _slapDecoder_DecodeSubFrameTask, &subFrameTasks[i], &pendingTasks);
+    }
+
+    _slapThreadPool_Wait(pFileReader->pThreadPool, &pendingTasks);
+
+    for (size_t i = 0; i < planeCount; i++)
+    {
+      result = subFrameTasks[i].result;
+
+      if (result != slapSuccess)
+        goto epilogue;
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < planeCount; i++)
+    {
+      result = _slapDecoder_DecodeSubFrameToPlane(pFileReader->pDecoder, i, dataAddrs, dataSizes, ppPlanes[i], pStrides[i]);
+
+      if (result != slapSuccess)
+        goto epilogue;
+    }
+  }
+
+epilogue:
+  return result;
+}
+
+slapResult slapFileReader_DecodeCurrentFrame(IN slapFileReader *pFileReader)
+{
+  slapResult result = slapSuccess;
+  uint8_t *planes[SLAP_SUB_BUFFER_COUNT] = { NULL, NULL, NULL };
+  size_t strides[SLAP_SUB_BUFFER_COUNT] = { 0, 0, 0 };
+
+  if (!pFileReader)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  planes[0] = (uint8_t *)pFileReader->pDecodedFrameYUV;
+  strides[0] = pFileReader->pDecoder->decodedResX;
+
+  if (!pFileReader->pDecoder->lumaOnly)
+  {
+    planes[1] = planes[0] + pFileReader->pDecoder->decodedResX * pFileReader->pDecoder->decodedResY;
+    planes[2] = planes[0] + pFileReader->pDecoder->decodedResX * pFileReader->pDecoder->decodedResY * 5 / 4;
+    strides[1] = strides[2] = pFileReader->pDecoder->decodedResX >> 1;
+  }
+
+  result = _slapFileReader_DecodeCurrentFrameToPlanes(pFileReader, planes, strides, 0, 0, pFileReader->pDecoder->decodedResX, pFileReader->pDecoder->decodedResY);
+
+  if (result != slapSuccess)
+    goto epilogue;
+
+  result = slapDecoder_FinalizeFrame(pFileReader->pDecoder, pFileReader->pCurrentFrame, pFileReader->currentFrameSize, pFileReader->pDecodedFrameYUV);
+
+  if (result != slapSuccess)
+    goto epilogue;
+
+epilogue:
+  return result;
+}
+
+slapResult slapFileReader_GetNextFrameInto(IN slapFileReader *pFileReader, OUT void *pY, const size_t strideY, OUT void *pU, OUT void *pV, const size_t strideUV)
+{
+  slapResult result = slapSuccess;
+  uint8_t *planes[SLAP_SUB_BUFFER_COUNT];
+  size_t strides[SLAP_SUB_BUFFER_COUNT];
+
+  if (!pFileReader || !pY || (!pFileReader->pDecoder->lumaOnly && (!pU || !pV)))
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (strideY < pFileReader->pDecoder->decodedResX || (!pFileReader->pDecoder->lumaOnly && strideUV < (pFileReader->pDecoder->decodedResX >> 1)))
+  {
+    result = slapError_InvalidParameter;
+    goto epilogue;
+  }
+
+  planes[0] = (uint8_t *)pY;
+  planes[1] = (uint8_t *)pU;
+  planes[2] = (uint8_t *)pV;
+  strides[0] = strideY;
+  strides[1] = strides[2] = strideUV;
+
+  if ((result = slapFileReader_ReadNextFrame(pFileReader)) != slapSuccess)
+    goto epilogue;
+
+  if ((result = _slapFileReader_DecodeCurrentFrameToPlanes(pFileReader, planes, strides, 0, 0, pFileReader->pDecoder->decodedResX, pFileReader->pDecoder->decodedResY)) != slapSuccess)
+    goto epilogue;
+
+  result = _slapDecoder_FinalizeFramePlanes(pFileReader->pDecoder, planes, strides, 0, 0, pFileReader->pDecoder->decodedResX, pFileReader->pDecoder->decodedResY);
+
+epilogue:
+  return result;
+}
+
+slapResult slapFileReader_GetNextFrameRegionInto(IN slapFileReader *pFileReader, const size_t x, const size_t y, const size_t sizeX, const size_t sizeY, OUT void *pY, const size_t strideY, OUT void *pU, OUT void *pV, const size_t strideUV)
+{
+  slapResult result = slapSuccess;
+  uint8_t *planes[SLAP_SUB_BUFFER_COUNT];
+  size_t strides[SLAP_SUB_BUFFER_COUNT];
+  size_t regionX = x;
+  size_t regionY = y;
+  size_t regionSizeX = sizeX;
+  size_t regionSizeY = sizeY;
+
+  if (!pFileReader || !pY || (!pFileReader->pDecoder->lumaOnly && (!pU || !pV)))
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (strideY < pFileReader->pDecoder->decodedResX || (!pFileReader->pDecoder->lumaOnly && strideUV < (pFileReader->pDecoder->decodedResX >> 1)))
+  {
+    result = slapError_InvalidParameter;
+    goto epilogue;
+  }
+
+  if (sizeX == 0 || sizeY == 0 || x >= pFileReader->pDecoder->decodedResX || y >= pFileReader->pDecoder->decodedResY || sizeX > pFileReader->pDecoder->decodedResX - x || sizeY > pFileReader->pDecoder->decodedResY - y)
+  {
+    result = slapError_InvalidParameter;
+    goto epilogue;
+  }
+
+  _slapDecoder_GetTileAlignedRegion(pFileReader->pDecoder, &regionX, &regionY, &regionSizeX, &regionSizeY);
+
+  planes[0] = (uint8_t *)pY;
+  planes[1] = (uint8_t *)pU;
+  planes[2] = (uint8_t *)pV;
+  strides[0] = strideY;
+  strides[1] = strides[2] = strideUV;
+
+  if ((result = slapFileReader_ReadNextFrame(pFileReader)) != slapSuccess)
+    goto epilogue;
+
+  if ((result = _slapFileReader_DecodeCurrentFrameToPlanes(pFileReader, planes, strides, regionX, regionY, regionSizeX, regionSizeY)) != slapSuccess)
+    goto epilogue;
+
+  result = _slapDecoder_FinalizeFramePlanes(pFileReader->pDecoder, planes, strides, regionX, regionY, regionSizeX, regionSizeY);
+
+epilogue:
+  return result;
+}
+
+slapResult slapFileReader_GetNextFrameBGRAInto(IN slapFileReader *pFileReader, OUT void *pBGRA, const size_t stride)
+{
+  slapResult result = slapSuccess;
+
+  if (!pFileReader || !pBGRA)
+  {
+    result = slapError_ArgumentNull;
+    goto epilogue;
+  }
+
+  if (stride < pFileReader->pDecoder->decodedResX * sizeof(uint32_t))
+  {
+    result = slapError_InvalidParameter;
+    goto epilogue;
+  }
+
+  if (pFileReader->pDecoder->lumaOnly)
+  {
+    result = slapError_StateInvalid;
+    goto epilogue;
+  }
+
+  if ((result = slapFileReader_ReadNextFrame(pFileReader)) != slapSuccess)
+    goto epilogue;
+
+  slapDecoder *pDecoder = pFileReader->pDecoder;
+
+  // The planes of a key frame are only needed if the next frame is an intra frame that references them.
+  const bool_t isReference = pDecoder->iframeStep > 1 && !(pFileReader->frameIndex < slapFileReader_GetFrameCount(pFileReader) && _slapFileReader_IsKeyFrame(pFileReader, pFileReader->frameIndex));
+
+  if (_slapDecoder_IsYUV420Frame(pDecoder) && !isReference)
+  {
+    const uint64_t *pFrameHeader = pFileReader->currentFrameHeader + SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET;
+
+    if ((result = _slapDecompressYUV420ToBGRA(pBGRA, stride, (uint8_t *)pFileReader->pCurrentFrame + pFrameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX], pFrameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX], pDecoder->resX, pDecoder->resY, pDecoder->scale, pDecoder->bgraDecoder)) != slapSuccess)
+      goto epilogue;
+
+    pDecoder->frameIndex++;
+    goto epilogue;
+  }
+
+  if ((result = slapFileReader_DecodeCurrentFrame(pFileReader)) != slapSuccess)
+    goto epilogue;
+
+  result = slapFileReader_TransformBufferToBGRAInto(pFileReader, pBGRA, stride);
+
+epilogue:
+  return result;
+}
+
+slapResult slapFileReader_GetKeyFrameJpeg(IN slapFileReader *pFileReader, const size_t frameIndex, OUT void *pJpeg, IN_OUT size_t *pSize)
+{
+  if (!pFileReader || !pSize)
+    return slapError_ArgumentNull;
+
+  if (slapFileReader_GetFrameCount(pFileReader) <= frameIndex)
+    return slapError_EndOfStream;
+
+  if (pFileReader->pDecoder->mode.flags.encoder != SLAP_FRAME_ENCODER_YUV420_KEY_FRAMES || !_slapFileReader_IsKeyFrame(pFileReader, frameIndex))
+    return slapError_StateInvalid;
+
+  uint64_t frameHeader[SLAP_HEADER_PER_FRAME_SIZE];
+  const slapResult result = _slapFrameIndex_GetFrame(pFileReader->pIndex, frameIndex, frameHeader);
+
+  if (result != slapSuccess)
+    return result;
+
+  const size_t jpegSize = (size_t)frameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+  const uint64_t position = frameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX] + pFileReader->headerOffset + frameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + SLAP_HEADER_FRAME_OFFSET_INDEX];
+
+  if (!pJpeg)
+  {
+    *pSize = jpegSize;
+    return slapSuccess;
+  }
+
+  if (*pSize < jpegSize)
+  {
+    *pSize = jpegSize;
+    return slapError_InvalidParameter;
+  }
+
+  *pSize = jpegSize;
+
+  return _slapFileReader_ReadAt(pFileReader, position, pJpeg, jpegSize);
+}
+
+slapResult slapFileReader_GetNextFrame(IN slapFileReader *pFileReader)
+{
+  slapResult result = slapSuccess;
+
+  if (pFileReader && pFileReader->cachedFrameCount)
+  {
+    _slapCachedFrame *pCachedFrame = _slapFileReader_GetCachedFrame(pFileReader, pFileReader->frameIndex);
+
+    if (pCachedFrame)
+    {
+      _slapFileReader_RestoreCachedFrame(pFileReader, pCachedFrame);
+      goto epilogue;
+    }
+  }
+
+  if ((result = slapFileReader_ReadNextFrame(pFileReader)) != slapSuccess)
+    goto epilogue;
+
+  if ((result = slapFileReader_DecodeCurrentFrame(pFileReader)) != slapSuccess)
+    goto epilogue;
+
+  // Caching is best effort: The frame has been decoded and the reader has moved past it, so a frame that can't be cached is no error.
+  if (pFileReader->frameCacheSize)
+    _slapFileReader_CacheDecodedFrame(pFileReader, pFileReader->frameIndex - 1);
+
+epilogue:
+  return result;
+}
+
+slapResult slapFileReader_SetFrameCacheSize(IN slapFileReader *pFileReader, const size_t size)
+{
+  if (!pFileReader)
+    return slapError_ArgumentNull;
+
+  _slapFileReader_ClearFrameCache(pFileReader);
+  pFileReader->frameCacheSize = size;
+
+  return slapSuccess;
+}
+
+_slapCachedFrame * _slapFileReader_GetCachedFrame(IN slapFileReader *pFileReader, const size_t frameIndex)
+{
+  for (size_t i = 0; i < pFileReader->cachedFrameCount; i++)
+    if (pFileReader->pCachedFrames[i].frameIndex == frameIndex)
+      return &pFileReader->pCachedFrames[i];
+
+  return NULL;
+}
+
+slapResult _slapFileReader_CacheDecodedFrame(IN slapFileReader *pFileReader, const size_t frameIndex)
+{
+  const size_t frameSize = _slapDecoder_GetDecodedFrameSize(pFileReader->pDecoder);
+  _slapCachedFrame *pCachedFrame = NULL;
+
+  // The capacity depends on the decoded frame size, so it's only determined once the first frame is cached.
+  if (!pFileReader->pCachedFrames)
+  {
+    pFileReader->cachedFrameCapacity = pFileReader->frameCacheSize / frameSize;
+
+    if (pFileReader->cachedFrameCapacity == 0)
+      return slapSuccess;
+
+    pFileReader->pCachedFrames = slapAlloc(_slapCachedFrame, pFileReader->cachedFrameCapacity);
+
+    if (!pFileReader->pCachedFrames)
+    {
+      pFileReader->cachedFrameCapacity = 0;
+      return slapError_MemoryAllocation;
+    }
+  }
+
+  if (pFileReader->cachedFrameCount < pFileReader->cachedFrameCapacity)
+  {
+    pCachedFrame = &pFileReader->pCachedFrames[pFileReader->cachedFrameCount];
+    pCachedFrame->pData = slapAlloc(uint8_t, frameSize);
+
+    // The slot is only counted once it has a buffer.
+    if (!pCachedFrame->pData)
+      return slapError_MemoryAllocation;
+
+    pFileReader->cachedFrameCount++;
+  }
+  else
+  {
+    size_t keyFrameCount = 0;
+
+    for (size_t i = 0; i < pFileReader->cachedFrameCount; i++)
+      keyFrameCount += pFileReader->pCachedFrames[i].isKeyFrame;
+
+    const bool_t preferKeyFrames = keyFrameCount * 2 <= pFileReader->cachedFrameCount;
+
+    for (size_t i = 0; i < pFileReader->cachedFrameCount; i++)
+    {
+      _slapCachedFrame *pCandidate = &pFileReader->pCachedFrames[i];
+
+      if (!pCachedFrame || (preferKeyFrames && pCachedFrame->isKeyFrame && !pCandidate->isKeyFrame) || ((!preferKeyFrames || pCachedFrame->isKeyFrame == pCandidate->isKeyFrame) && pCandidate->lastAccess < pCachedFrame->lastAccess))
+        pCachedFrame = pCandidate;
+    }
+  }
+
+  pCachedFrame->frameIndex = frameIndex;
+  pCachedFrame->isKeyFrame = _slapFileReader_IsKeyFrame(pFileReader, frameIndex);
+  pCachedFrame->lastAccess = ++pFileReader->cacheAccessCount;
+  slapMemcpy(pCachedFrame->pData, pFileReader->pDecodedFrameYUV, frameSize);
+
+  return slapSuccess;
+}
+
+void _slapFileReader_RestoreCachedFrame(IN slapFileReader *pFileReader, IN _slapCachedFrame *pCachedFrame)
+{
+  const size_t frameSize = _slapDecoder_GetDecodedFrameSize(pFileReader->pDecoder);
+
+  slapMemcpy(pFileReader->pDecodedFrameYUV, pCachedFrame->pData, frameSize);
+
+  if (pFileReader->pDecoder->iframeStep > 1)
+    slapMemcpy(pFileReader->pDecoder->pLastFrame, pCachedFrame->pData, frameSize);
+
+  pCachedFrame->lastAccess = ++pFileReader->cacheAccessCount;
+
+  pFileReader->pDecoder->isKeyFrame = pCachedFrame->isKeyFrame;
+  pFileReader->pDecoder->frameIndex++;
+  pFileReader->frameIndex++;
+}
+
+void _slapFileReader_ClearFrameCache(IN slapFileReader *pFileReader)
+{
+  for (size_t i = 0; i < pFileReader->cachedFrameCount; i++)
+    slapFreePtr(&pFileReader->pCachedFrames[i].pData);
+
+  slapFreePtr(&pFileReader->pCachedFrames);
+  pFileReader->cachedFrameCount = 0;
+  pFileReader->cachedFrameCapacity = 0;
+}
+
+slapResult slapFileReader_RestartVideoStream(IN slapFileReader *pFileReader)
+{
+  if (pFileReader == NULL)
+    return slapError_ArgumentNull;
+
+  pFileReader->frameIndex = 0;
+  pFileReader->pDecoder->frameIndex = 0;
+
+  return slapSuccess;
+}
+
+slapResult slapFileReader_TransformBufferToBGRA(IN slapFileReader *pFileReader)
+{
+  if (pFileReader == NULL)
+    return slapError_ArgumentNull;
+
+  if (pFileReader->pDecoder->lumaOnly)
+    return slapError_StateInvalid;
+
+  if (!pFileReader->pDecodedFrameBGRA)
+  {
+    pFileReader->pDecodedFrameBGRA = slapAlloc(uint32_t, pFileReader->pDecoder->decodedResX * pFileReader->pDecoder->decodedResY);
+
+    if (!pFileReader->pDecodedFrameBGRA)
+      return slapError_MemoryAllocation;
+  }
+
+  return slapFileReader_TransformBufferToBGRAInto(pFileReader, pFileReader->pDecodedFrameBGRA, pFileReader->pDecoder->decodedResX * sizeof(uint32_t));
+}
+
+slapResult slapFileReader_TransformBufferToBGRAInto(IN slapFileReader *pFileReader, OUT void *pBGRA, const size_t stride)
+{
+  if (pFileReader == NULL || pBGRA == NULL)
+    return slapError_ArgumentNull;
+
+  if (stride < pFileReader->pDecoder->decodedResX * sizeof(uint32_t))
+    return slapError_InvalidParameter;
+
+  if (pFileReader->pDecoder->lumaOnly)
+    return slapError_StateInvalid;
+
+  const int error = tjDecodeYUV(pFileReader->pDecoder->bgraDecoder, (unsigned char *)pFileReader->pDecodedFrameYUV, 1, TJSAMP_420, (unsigned char *)pBGRA, (int)pFileReader->pDecoder->decodedResX, (int)stride, (int)pFileReader->pDecoder->decodedResY, TJPF_BGRA, 0);
+
+  if (error != 0)
+    return slapError_Compress_Internal;
+
+  return slapSuccess;
+}
+
+const void * slapFileReader_GetBufferYUV420(IN slapFileReader *pFileReader)
+{
+  if (pFileReader == NULL || pFileReader->pDecoder->lumaOnly)
+    return NULL;
+
+  return pFileReader->pDecodedFrameYUV;
+}
+
+const void * slapFileReader_GetBufferY(IN slapFileReader *pFileReader)
+{
+  if (pFileReader == NULL)
+    return NULL;
+
+  // The luma plane comes first in the internal YUV420 buffer.
+  return pFileReader->pDecodedFrameYUV;
+}
+
+
+const void * slapFileReader_GetBufferBGRA(IN slapFileReader *pFileReader)
+{
+  if (pFileReader == NULL)
+    return NULL;
+
+  return pFileReader->pDecodedFrameBGRA;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Frame Index
+//////////////////////////////////////////////////////////////////////////
+
+_slapFrameIndex * _slapCreateFrameIndex(void)
+{
+  _slapFrameIndex *pIndex = slapAlloc(_slapFrameIndex, 1);
+
+  if (pIndex)
+    slapSetZero(pIndex, _slapFrameIndex);
+
+  return pIndex;
+}
+
+void _slapDestroyFrameIndex(IN_OUT _slapFrameIndex **ppIndex)
+{
+  if (ppIndex && *ppIndex && !(*ppIndex)->isMapped)
+  {
+    slapFreePtr(&(*ppIndex)->pAnchors);
+    slapFreePtr(&(*ppIndex)->pRecords);
+  }
+
+  slapFreePtr(ppIndex);
+}
+
+slapResult _slapFrameIndex_AddFrame(IN _slapFrameIndex *pIndex, IN const uint64_t *pFrameHeader)
+{
+  const uint64_t offset = pFrameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX];
+  const uint64_t frameSize = pFrameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX] & ~SLAP_KEY_FRAME_FLAG;
+  const size_t anchorIndex = (size_t)(pIndex->frameCount / SLAP_FRAME_INDEX_ANCHOR_INTERVAL);
+  const size_t groupFrameIndex = (size_t)(pIndex->frameCount % SLAP_FRAME_INDEX_ANCHOR_INTERVAL);
+  bool_t isRegular = offset >= pIndex->frameOffset && offset - pIndex->frameOffset < SLAP_KEY_FRAME_FLAG;
+  uint64_t subFrameOffset = 0;
+
+  if (pIndex->isMapped)
+    return slapError_StateInvalid;
+
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  {
+    if (pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX] != subFrameOffset)
+      isRegular = 0;
+
+    subFrameOffset += pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
+  }
+
+  if (subFrameOffset != frameSize)
+    isRegular = 0;
+
+  if (groupFrameIndex == 0 && pIndex->anchorCapacity <= anchorIndex)
+  {
+    uint64_t *pAnchors = pIndex->pAnchors;
+    const size_t anchorCapacity = (anchorIndex + 1) * 2;
+
+    slapRealloc(&pAnchors, uint64_t, anchorCapacity * SLAP_FRAME_INDEX_ANCHOR_SIZE);
+
+    if (!pAnchors)
+      return slapError_MemoryAllocation;
+
+    pIndex->pAnchors = pAnchors;
+    pIndex->anchorCapacity = anchorCapacity;
+  }
+
+  if (pIndex->recordsCapacity < pIndex->recordsSize + SLAP_FRAME_INDEX_RECORD_MAX_SIZE)
+  {
+    uint8_t *pRecords = pIndex->pRecords;
+    const size_t recordsCapacity = (pIndex->recordsSize + SLAP_FRAME_INDEX_RECORD_MAX_SIZE) * 2;
+
+    slapRealloc(&pRecords, uint8_t, recordsCapacity);
+
+    if (!pRecords)
+      return slapError_MemoryAllocation;
+
+    pIndex->pRecords = pRecords;
+    pIndex->recordsCapacity = recordsCapacity;
+  }
+
+  uint64_t *pAnchor = pIndex->pAnchors + anchorIndex * SLAP_FRAME_INDEX_ANCHOR_SIZE;
+
+  if (groupFrameIndex == 0)
+  {
+    pAnchor[SLAP_FRAME_INDEX_ANCHOR_RECORD_POSITION_INDEX] = pIndex->recordsSize;
+    pAnchor[SLAP_FRAME_INDEX_ANCHOR_FRAME_OFFSET_INDEX] = pIndex->frameOffset;
+    pAnchor[SLAP_FRAME_INDEX_ANCHOR_KEY_FRAME_MASK_INDEX] = 0;
+  }
+
+  if (pFrameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX] & SLAP_KEY_FRAME_FLAG)
+    pAnchor[SLAP_FRAME_INDEX_ANCHOR_KEY_FRAME_MASK_INDEX] |= (uint64_t)1 << groupFrameIndex;
+
+  if (isRegular)
+  {
+    _slapFrameIndex_WriteVarInt(pIndex, (offset - pIndex->frameOffset) << 1);
+
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+      _slapFrameIndex_WriteVarInt(pIndex, pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX]);
+  }
+  else
+  {
+    _slapFrameIndex_WriteVarInt(pIndex, 1);
+    _slapFrameIndex_WriteVarInt(pIndex, offset);
+    _slapFrameIndex_WriteVarInt(pIndex, frameSize);
+
+    for (size_t i = SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET; i < SLAP_HEADER_PER_FRAME_SIZE; i++)
+      _slapFrameIndex_WriteVarInt(pIndex, pFrameHeader[i]);
+  }
+
+  pIndex->frameOffset = offset + frameSize;
+  pIndex->frameCount++;
+
+  return slapSuccess;
+}
+
+slapResult _slapFrameIndex_AddFrames(IN _slapFrameIndex *pIndex, IN const uint64_t *pHeader, const size_t frameCount)
+{
+  slapResult result = slapSuccess;
+
+  for (size_t i = 0; i < frameCount; i++)
+    if ((result = _slapFrameIndex_AddFrame(pIndex, pHeader + i * SLAP_HEADER_PER_FRAME_SIZE)) != slapSuccess)
+      break;
+
+  return result;
+}
+
+slapResult _slapFrameIndex_GetFrame(IN const _slapFrameIndex *pIndex, const uint64_t frameIndex, OUT uint64_t *pFrameHeader)
+{
+  slapResult result = slapSuccess;
+  const uint64_t *pAnchor = NULL;
+  size_t position = 0;
+  uint64_t frameOffset = 0;
+  uint64_t frameSize = 0;
+  uint64_t value = 0;
+
+  if (frameIndex >= pIndex->frameCount)
+  {
+    result = slapError_EndOfStream;
+    goto epilogue;
+  }
+
+  pAnchor = pIndex->pAnchors + (size_t)(frameIndex / SLAP_FRAME_INDEX_ANCHOR_INTERVAL) * SLAP_FRAME_INDEX_ANCHOR_SIZE;
+  frameOffset = pAnchor[SLAP_FRAME_INDEX_ANCHOR_FRAME_OFFSET_INDEX];
+
+  if (pAnchor[SLAP_FRAME_INDEX_ANCHOR_RECORD_POSITION_INDEX] > pIndex->recordsSize)
+  {
+    result = slapError_FileError;
+    goto epilogue;
+  }
+
+  position = (size_t)pAnchor[SLAP_FRAME_INDEX_ANCHOR_RECORD_POSITION_INDEX];
+
+  // The records of the frames before the frame in its group are decoded as well, because the offset of every frame depends on the last frame.
+  for (uint64_t i = frameIndex - frameIndex % SLAP_FRAME_INDEX_ANCHOR_INTERVAL; i <= frameIndex; i++)
+  {
+    if ((result = _slapFrameIndex_ReadVarInt(pIndex, &position, &value)) != slapSuccess)
+      goto epilogue;
+
+    if (!(value & 1))
+    {
+      pFrameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX] = frameOffset + (value >> 1);
+      frameSize = 0;
+
+      for (size_t j = 0; j < SLAP_SUB_BUFFER_COUNT; j++)
+      {
+        if ((result = _slapFrameIndex_ReadVarInt(pIndex, &position, &value)) != slapSuccess)
+          goto epilogue;
+
+        pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + j * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX] = frameSize;
+        pFrameHeader[SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + j * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX] = value;
+        frameSize += value;
+      }
+    }
+    else
+    {
+      if ((result = _slapFrameIndex_ReadVarInt(pIndex, &position, &pFrameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX])) != slapSuccess)
+        goto epilogue;
+
+      if ((result = _slapFrameIndex_ReadVarInt(pIndex, &position, &frameSize)) != slapSuccess)
+        goto epilogue;
+
+      for (size_t j = SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET; j < SLAP_HEADER_PER_FRAME_SIZE; j++)
+        if ((result = _slapFrameIndex_ReadVarInt(pIndex, &position, &pFrameHeader[j])) != slapSuccess)
+          goto epilogue;
+    }
+
+    frameOffset = pFrameHeader[SLAP_HEADER_FRAME_OFFSET_INDEX] + frameSize;
+  }
+
+  pFrameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX] = frameSize & ~SLAP_KEY_FRAME_FLAG;
+
+  if (_slapFrameIndex_IsKeyFrame(pIndex, frameIndex))
+    pFrameHeader[SLAP_HEADER_FRAME_DATA_SIZE_INDEX] |= SLAP_KEY_FRAME_FLAG;
+
+epilogue:
+  return result;
+}
+
+bool_t _slapFrameIndex_IsKeyFrame(IN const _slapFrameIndex *pIndex, const uint64_t frameIndex)
+{
+  if (frameIndex >= pIndex->frameCount)
+    return 0;
+
+  return (pIndex->pAnchors[(size_t)(frameIndex / SLAP_FRAME_INDEX_ANCHOR_INTERVAL) * SLAP_FRAME_INDEX_ANCHOR_SIZE + SLAP_FRAME_INDEX_ANCHOR_KEY_FRAME_MASK_INDEX] >> (frameIndex % SLAP_FRAME_INDEX_ANCHOR_INTERVAL)) & 1;
+}
+
+// Expects `SLAP_FRAME_INDEX_RECORD_MAX_SIZE` bytes to be available for the record.
+void _slapFrameIndex_WriteVarInt(IN _slapFrameIndex *pIndex, const uint64_t value)
+{
+  uint64_t remaining = value;
+
+  while (remaining >= 0x80)
+  {
+    pIndex->pRecords[pIndex->recordsSize++] = (uint8_t)(remaining | 0x80);
+    remaining >>= 7;
+  }
+
+  pIndex->pRecords[pIndex->recordsSize++] = (uint8_t)remaining;
+}
+
+slapResult _slapFrameIndex_ReadVarInt(IN const _slapFrameIndex *pIndex, IN_OUT size_t *pPosition, OUT uint64_t *pValue)
+{
+  uint64_t value = 0;
+
+  for (size_t shift = 0; shift < 64; shift += 7)
+  {
+    if (*pPosition >= pIndex->recordsSize)
+      return slapError_FileError;
+
+    const uint8_t byte = pIndex->pRecords[(*pPosition)++];
+
+    value |= (uint64_t)(byte & 0x7F) << shift;
+
+    if (!(byte & 0x80))
+    {
+      *pValue = value;
+      return slapSuccess;
+    }
+  }
+
+  return slapError_FileError;
+}
+
+size_t _slapFrameIndex_GetAnchorCount(const uint64_t frameCount)
+{
+  return (size_t)(frameCount / SLAP_FRAME_INDEX_ANCHOR_INTERVAL + (frameCount % SLAP_FRAME_INDEX_ANCHOR_INTERVAL != 0));
+}
+
+uint64_t _slapFrameIndex_GetSerializedSize(IN const _slapFrameIndex *pIndex)
+{
+  return _slapFrameIndex_GetAnchorCount(pIndex->frameCount) * SLAP_FRAME_INDEX_ANCHOR_SIZE + (pIndex->recordsSize + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+}
+
+slapResult _slapFrameIndex_Write(IN const _slapFrameIndex *pIndex, IN FILE *pFile)
+{
+  const uint64_t padding = 0;
+  const size_t anchorValueCount = _slapFrameIndex_GetAnchorCount(pIndex->frameCount) * SLAP_FRAME_INDEX_ANCHOR_SIZE;
+  const size_t paddingSize = (sizeof(uint64_t) - pIndex->recordsSize % sizeof(uint64_t)) % sizeof(uint64_t);
+
+  if (anchorValueCount != 0 && anchorValueCount != fwrite(pIndex->pAnchors, sizeof(uint64_t), anchorValueCount, pFile))
+    return slapError_FileError;
+
+  if (pIndex->recordsSize != 0 && pIndex->recordsSize != fwrite(pIndex->pRecords, 1, pIndex->recordsSize, pFile))
+    return slapError_FileError;
+
+  if (paddingSize != 0 && paddingSize != fwrite(&padding, 1, paddingSize, pFile))
+    return slapError_FileError;
+
+  return slapSuccess;
+}
+
+slapResult _slapFrameIndex_Read(IN _slapFrameIndex *pIndex, IN FILE *pFile, const uint64_t headerSize, const uint64_t frameCount)
+{
+  const size_t anchorCount = _slapFrameIndex_GetAnchorCount(frameCount);
+
+  if (pIndex->frameCount != 0 || anchorCount > headerSize / SLAP_FRAME_INDEX_ANCHOR_SIZE || headerSize > SIZE_MAX / sizeof(uint64_t))
+    return slapError_FileError;
+
+  pIndex->anchorCapacity = anchorCount;
+  pIndex->recordsCapacity = (size_t)(headerSize - anchorCount * SLAP_FRAME_INDEX_ANCHOR_SIZE) * sizeof(uint64_t);
+
+  if (anchorCount != 0)
+  {
+    pIndex->pAnchors = slapAlloc(uint64_t, anchorCount * SLAP_FRAME_INDEX_ANCHOR_SIZE);
+
+    if (!pIndex->pAnchors)
+      return slapError_MemoryAllocation;
+
+    if (anchorCount * SLAP_FRAME_INDEX_ANCHOR_SIZE != fread(pIndex->pAnchors, sizeof(uint64_t), anchorCount * SLAP_FRAME_INDEX_ANCHOR_SIZE, pFile))
+      return slapError_FileError;
+  }
+
+  if (pIndex->recordsCapacity != 0)
+  {
+    pIndex->pRecords = slapAlloc(uint8_t, pIndex->recordsCapacity);
+
+    if (!pIndex->pRecords)
+      return slapError_MemoryAllocation;
+
+    if (pIndex->recordsCapacity != fread(pIndex->pRecords, 1, pIndex->recordsCapacity, pFile))
+      return slapError_FileError;
+  }
+
+  pIndex->recordsSize = pIndex->recordsCapacity;
+  pIndex->frameCount = frameCount;
+
+  return slapSuccess;
+}
+
+slapResult _slapFrameIndex_Map(IN _slapFrameIndex *pIndex, IN const uint64_t *pHeader, const uint64_t headerSize, const uint64_t frameCount)
+{
+  const size_t anchorCount = _slapFrameIndex_GetAnchorCount(frameCount);
+
+  if (pIndex->frameCount != 0 || anchorCount > headerSize / SLAP_FRAME_INDEX_ANCHOR_SIZE || headerSize > SIZE_MAX / sizeof(uint64_t))
+    return slapError_FileError;
+
+  pIndex->pAnchors = (uint64_t *)pHeader;
+  pIndex->anchorCapacity = anchorCount;
+  pIndex->pRecords = (uint8_t *)(pHeader + anchorCount * SLAP_FRAME_INDEX_ANCHOR_SIZE);
+  pIndex->recordsSize = pIndex->recordsCapacity = (size_t)(headerSize - anchorCount * SLAP_FRAME_INDEX_ANCHOR_SIZE) * sizeof(uint64_t);
+  pIndex->frameCount = frameCount;
+  pIndex->isMapped = 1;
+
+  return slapSuccess;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Asynchronous File Reader
+//////////////////////////////////////////////////////////////////////////
+
+void _slapFileReaderAsync_BeginReverse(IN slapFileReaderAsync *pFileReaderAsync, const size_t frameIndex)
+{
+  _slapAsyncFrameGroup *pCurrent = &pFileReaderAsync->groups[pFileReaderAsync->currentGroup];
+  _slapAsyncFrameGroup *pPrevious = &pFileReaderAsync->groups[pFileReaderAsync->currentGroup ^ 1];
+
+  pCurrent->firstFrameIndex = slapFileReader_GetKeyFrameIndex(pFileReaderAsync->pFileReader, frameIndex);
+  pCurrent->frameCount = pCurrent->remainingFrameCount = frameIndex + 1 - pCurrent->firstFrameIndex;
+  pCurrent->decodedFrameCount = 0;
+  pCurrent->failed = 0;
+
+  pPrevious->frameCount = pPrevious->remainingFrameCount = pPrevious->decodedFrameCount = 0;
+  pPrevious->failed = 0;
+}
+
+slapResult _slapFileReaderAsync_DecodeGroupFrame(IN slapFileReaderAsync *pFileReaderAsync, IN _slapAsyncFrameGroup *pGroup)
+{
+  slapResult result = slapSuccess;
+  slapFileReader *pFileReader = pFileReaderAsync->pFileReader;
+
+  if (pGroup->decodedFrameCount == 0 && (result = slapFileReader_SetFrameIndex(pFileReader, pGroup->firstFrameIndex)) != slapSuccess)
+    goto epilogue;
+
+  pFileReader->pDecodedFrameYUV = pGroup->ppDecodedFramesYUV[pGroup->decodedFrameCount];
+
+  if ((result = slapFileReader_GetNextFrame(pFileReader)) != slapSuccess)
+    goto epilogue;
+
+  pGroup->decodedFrameCount++;
+
+epilogue:
+  return result;
+}
+
+bool_t _slapFileReaderAsync_DecodePreviousGroupFrame(IN slapFileReaderAsync *pFileReaderAsync)
+{
+  _slapAsyncFrameGroup *pCurrent = &pFileReaderAsync->groups[pFileReaderAsync->currentGroup];
+  _slapAsyncFrameGroup *pPrevious = &pFileReaderAsync->groups[pFileReaderAsync->currentGroup ^ 1];
+
+  // The reader is still needed for the current group.
+  if (pCurrent->decodedFrameCount < pCurrent->frameCount || pCurrent->firstFrameIndex == 0)
+    return 0;
+
+  if (pPrevious->frameCount == 0)
+  {
+    pPrevious->firstFrameIndex = slapFileReader_GetKeyFrameIndex(pFileReaderAsync->pFileReader, pCurrent->firstFrameIndex - 1);
+    pPrevious->frameCount = pPrevious->remainingFrameCount = pCurrent->firstFrameIndex - pPrevious->firstFrameIndex;
+    pPrevious->decodedFrameCount = 0;
+    pPrevious->failed = 0;
+  }
+
+  if (pPrevious->failed || pPrevious->decodedFrameCount == pPrevious->frameCount)
+    return 0;
+
+  // Errors are reported once the group becomes the current group and is decoded again.
+  if (_slapFileReaderAsync_DecodeGroupFrame(pFileReaderAsync, pPrevious) != slapSuccess)
+  {
+    pPrevious->decodedFrameCount = 0;
+    pPrevious->failed = 1;
+  }
+
+  return 1;
+}
+
+slapResult _slapFileReaderAsync_GetPreviousFrame(IN slapFileReaderAsync *pFileReaderAsync, IN _slapAsyncDecodedFrame *pFrame)
+{
+  slapResult result = slapSuccess;
+  slapFileReader *pFileReader = pFileReaderAsync->pFileReader;
+  _slapAsyncFrameGroup *pCurrent = &pFileReaderAsync->groups[pFileReaderAsync->currentGroup];
+
+  if (pCurrent->remainingFrameCount == 0)
+  {
+    if (pCurrent->firstFrameIndex == 0 || pCurrent->frameCount == 0)
+    {
+      result = slapError_EndOfStream;
+      goto epilogue;
+    }
+
+    // Sets up the previous group if it hasn't been prefetched.
+    _slapFileReaderAsync_DecodePreviousGroupFrame(pFileReaderAsync);
+
+    pCurrent->frameCount = pCurrent->decodedFrameCount = 0;
+    pFileReaderAsync->currentGroup ^= 1;
+    pCurrent = &pFileReaderAsync->groups[pFileReaderAsync->currentGroup];
+    pCurrent->failed = 0;
+  }
+
+  // The last frame of the group can only be handed over once the whole group has been decoded.
+  while (pCurrent->decodedFrameCount < pCurrent->frameCount)
+    if ((result = _slapFileReaderAsync_DecodeGroupFrame(pFileReaderAsync, pCurrent)) != slapSuccess)
+      goto epilogue;
+
+  pCurrent->remainingFrameCount--;
+
+  void *pDecodedFrameYUV = pCurrent->ppDecodedFramesYUV[pCurrent->remainingFrameCount];
+  pCurrent->ppDecodedFramesYUV[pCurrent->remainingFrameCount] = pFrame->pDecodedFrameYUV;
+  pFrame->pDecodedFrameYUV = pDecodedFrameYUV;
+  pFrame->frameIndex = pCurrent->firstFrameIndex + pCurrent->remainingFrameCount;
+
+  if (pFileReaderAsync->flags & slapFileReaderAsync_DecodeBGRA)
+  {
+    pFileReader->pDecodedFrameYUV = pFrame->pDecodedFrameYUV;
+    result = slapFileReader_TransformBufferToBGRAInto(pFileReader, pFrame->pDecodedFrameBGRA, pFileReader->pDecoder->decodedResX * sizeof(uint32_t));
+  }
+
+epilogue:
+  return result;
 }
 
-void slapDestroyFileWriter(IN_OUT slapFileWriter **ppFileWriter)
+DWORD WINAPI _slapFileReaderAsync_DecodeThread(IN LPVOID pUserData)
 {
-  if (ppFileWriter && *ppFileWriter)
+  slapFileReaderAsync *pFileReaderAsync = (slapFileReaderAsync *)pUserData;
+  slapFileReader *pFileReader = pFileReaderAsync->pFileReader;
+  slapResult result = slapSuccess;
+
+  while (pFileReaderAsync->running)
   {
-    slapDestroyEncoder(&(*ppFileWriter)->pEncoder);
+    // Wait for the consumer to release a frame if all of them are in use.
+    if ((ULONG)(pFileReaderAsync->writeIndex - pFileReaderAsync->readIndex) == (ULONG)pFileReaderAsync->frameCount)
+    {
+      // Reverse playback decodes the previous group of frames in the meantime.
+      if (pFileReaderAsync->reverse && _slapFileReaderAsync_DecodePreviousGroupFrame(pFileReaderAsync))
+        continue;
 
-    if ((*ppFileWriter)->pData)
-      tjFree((*ppFileWriter)->pData);
+      WaitForSingleObject(pFileReaderAsync->frameReleasedEvent, INFINITE);
+      continue;
+    }
 
-    if ((*ppFileWriter)->filename)
-      slapFreePtr(&(*ppFileWriter)->filename);
-  }
+    _slapAsyncDecodedFrame *pFrame = &pFileReaderAsync->pFrames[(ULONG)pFileReaderAsync->writeIndex % pFileReaderAsync->frameCount];
 
-  slapFreePtr(ppFileWriter);
-}
+    if (pFileReaderAsync->reverse)
+    {
+      result = _slapFileReaderAsync_GetPreviousFrame(pFileReaderAsync, pFrame);
 
-slapResult slapFileWriter_SetIntraFrameStep(slapFileWriter *pFileWriter, const size_t step)
-{
-  if (!pFileWriter)
-    return slapError_ArgumentNull;
+      if (result == slapError_EndOfStream && (pFileReaderAsync->flags & slapFileReaderAsync_PingPong) && slapFileReader_GetFrameCount(pFileReader) > 1 && (!pFileReaderAsync->secondPass || (pFileReaderAsync->flags & slapFileReaderAsync_Loop)))
+      {
+        // The first frame isn't repeated when the direction changes.
+        pFileReader->pDecodedFrameYUV = pFileReaderAsync->pOwnDecodedFrameYUV;
+
+        if ((result = slapFileReader_SetFrameIndexExact(pFileReader, 1)) == slapSuccess)
+        {
+          pFileReaderAsync->reverse = 0;
+          pFileReaderAsync->secondPass = 1;
+          continue;
+        }
+      }
+      else if (result == slapError_EndOfStream && (pFileReaderAsync->flags & slapFileReaderAsync_Loop))
+      {
+        _slapFileReaderAsync_BeginReverse(pFileReaderAsync, slapFileReader_GetFrameCount(pFileReader) - 1);
+        continue;
+      }
+    }
+    else
+    {
+      // Decode straight into the buffers of the frame.
+      pFileReader->pDecodedFrameYUV = pFrame->pDecodedFrameYUV;
+      pFileReader->pDecodedFrameBGRA = pFrame->pDecodedFrameBGRA;
 
-  if (step == 0)
-    return slapError_InvalidParameter;
+      result = slapFileReader_GetNextFrame(pFileReader);
 
-  if (pFileWriter->pEncoder->frameIndex != 0 || pFileWriter->headerPosition != SLAP_PRE_HEADER_SIZE)
-    return slapError_StateInvalid;
+      if (result == slapError_EndOfStream && (pFileReaderAsync->flags & slapFileReaderAsync_PingPong) && slapFileReader_GetFrameCount(pFileReader) > 1 && (!pFileReaderAsync->secondPass || (pFileReaderAsync->flags & slapFileReaderAsync_Loop)))
+      {
+        // The last frame isn't repeated when the direction changes.
+        _slapFileReaderAsync_BeginReverse(pFileReaderAsync, slapFileReader_GetFrameCount(pFileReader) - 2);
+        pFileReaderAsync->reverse = 1;
+        pFileReaderAsync->secondPass = 1;
+        continue;
+      }
 
-  pFileWriter->frameSizeOffsets[SLAP_PRE_HEADER_IFRAME_STEP_INDEX] = pFileWriter->pEncoder->iframeStep = step;
+      if (result == slapError_EndOfStream && (pFileReaderAsync->flags & slapFileReaderAsync_Loop))
+      {
+        if ((result = slapFileReader_RestartVideoStream(pFileReader)) == slapSuccess)
+          result = slapFileReader_GetNextFrame(pFileReader);
+      }
 
-  return slapSuccess;
-}
+      if (result == slapSuccess && (pFileReaderAsync->flags & slapFileReaderAsync_DecodeBGRA))
+        result = slapFileReader_TransformBufferToBGRA(pFileReader);
 
-slapResult slapFileWriter_SetEncoderFrameQuality(slapFileWriter * pFileWriter, const size_t quality)
-{
-  if (!pFileWriter)
-    return slapError_ArgumentNull;
+      pFrame->frameIndex = slapFileReader_GetFrameIndex(pFileReader) - 1;
+    }
 
-  if (quality == 0 || quality > 100)
-    return slapError_InvalidParameter;
+    pFrame->result = result;
 
-  pFileWriter->pEncoder->quality = (int)quality;
+    // Make sure the frame is complete before it's handed to the consumer.
+    MemoryBarrier();
+    InterlockedIncrement(&pFileReaderAsync->writeIndex);
+    SetEvent(pFileReaderAsync->frameAvailableEvent);
 
-  return slapSuccess;
+    // The end of the stream and errors are final.
+    if (result != slapSuccess)
+      break;
+  }
+
+  return 0;
 }
 
-slapResult slapFileWriter_SetEncoderIntraFrameQuality(slapFileWriter * pFileWriter, const size_t quality)
+slapFileReaderAsync * slapCreateFileReaderAsync(const char *filename, const size_t bufferedFrameCount, const uint64_t flags)
 {
-  if (!pFileWriter)
-    return slapError_ArgumentNull;
+  slapFileReaderAsync *pFileReaderAsync = NULL;
+  size_t resX, resY;
 
-  if (pFileWriter->pEncoder->iframeStep == 1)
-    return slapError_StateInvalid;
+  if (!filename || bufferedFrameCount == 0)
+    goto epilogue;
 
-  if (quality == 0 || quality > 100)
-    return slapError_InvalidParameter;
+  pFileReaderAsync = slapAlloc(slapFileReaderAsync, 1);
 
-  pFileWriter->pEncoder->iframeQuality = (int)quality;
+  if (!pFileReaderAsync)
+    goto epilogue;
 
-  return slapSuccess;
-}
+  slapSetZero(pFileReaderAsync, slapFileReaderAsync);
 
-slapResult slapFinalizeFileWriter(IN slapFileWriter *pFileWriter)
-{
-  slapResult result = slapError_Generic;
-  FILE *pFile = NULL;
-  FILE *pReadFile = NULL;
-  char filenameBuffer[0xFF];
-  void *pData = NULL;
-  size_t fileSize = 0; 
-  const size_t maxBlockSize = 1024 * 1024 * 64;
-  size_t remainingSize = 0;
+  pFileReaderAsync->flags = flags;
+  pFileReaderAsync->frameCount = bufferedFrameCount;
+  if (flags & slapFileReaderAsync_MemoryMapped)
+    pFileReaderAsync->pFileReader = slapCreateFileReaderMapped(filename);
+  else
+    pFileReaderAsync->pFileReader = slapCreateFileReader(filename);
 
-  if (!pFileWriter)
+  if (!pFileReaderAsync->pFileReader)
     goto epilogue;
 
-  if (pFileWriter->pEncoder)
-    slapFinalizeEncoder(pFileWriter->pEncoder);
+  pFileReaderAsync->pOwnDecodedFrameYUV = pFileReaderAsync->pFileReader->pDecodedFrameYUV;
+  pFileReaderAsync->pOwnDecodedFrameBGRA = pFileReaderAsync->pFileReader->pDecodedFrameBGRA;
 
-  if (pFileWriter->pHeaderFile)
-  {
-    if (pFileWriter->frameSizeOffsetIndex != 0)
-      fwrite(pFileWriter->frameSizeOffsets, 1, sizeof(uint64_t) * pFileWriter->frameSizeOffsetIndex, pFileWriter->pHeaderFile);
+  if (slapSuccess != slapFileReader_GetResolution(pFileReaderAsync->pFileReader, &resX, &resY))
+    goto epilogue;
 
-    fflush(pFileWriter->pHeaderFile);
-    fclose(pFileWriter->pHeaderFile);
-    pFileWriter->pHeaderFile = NULL;
-  }
+  pFileReaderAsync->pFrames = slapAlloc(_slapAsyncDecodedFrame, bufferedFrameCount);
 
-  if (pFileWriter->pMainFile)
+  if (!pFileReaderAsync->pFrames)
+    goto epilogue;
+
+  memset(pFileReaderAsync->pFrames, 0, sizeof(_slapAsyncDecodedFrame) * bufferedFrameCount);
+
+  for (size_t i = 0; i < bufferedFrameCount; i++)
   {
-    fflush(pFileWriter->pMainFile);
-    fclose(pFileWriter->pMainFile);
-    pFileWriter->pMainFile = NULL;
+    pFileReaderAsync->pFrames[i].pDecodedFrameYUV = slapAlloc(uint8_t, resX * resY * 3 / 2);
+
+    if (!pFileReaderAsync->pFrames[i].pDecodedFrameYUV)
+      goto epilogue;
+
+    if (flags & slapFileReaderAsync_DecodeBGRA)
+    {
+      pFileReaderAsync->pFrames[i].pDecodedFrameBGRA = slapAlloc(uint32_t, resX * resY);
+
+      if (!pFileReaderAsync->pFrames[i].pDecodedFrameBGRA)
+        goto epilogue;
+    }
   }
 
-  pFile = fopen(pFileWriter->filename, "wb");
+  if (flags & (slapFileReaderAsync_Reverse | slapFileReaderAsync_PingPong))
+  {
+    // Key frames are at most IntraFrameStep frames apart.
+    pFileReaderAsync->groupCapacity = slapFileReader_GetIntraFrameStep(pFileReaderAsync->pFileReader);
 
-  if (!pFile)
-    goto epilogue;
+    for (size_t i = 0; i < 2; i++)
+    {
+      pFileReaderAsync->groups[i].ppDecodedFramesYUV = slapAlloc(void *, pFileReaderAsync->groupCapacity);
 
-  sprintf_s(filenameBuffer, 0xFF, "%s.header", pFileWriter->filename);
-  pReadFile = fopen(filenameBuffer, "rb");
+      if (!pFileReaderAsync->groups[i].ppDecodedFramesYUV)
+        goto epilogue;
 
-  if (!pReadFile)
-    goto epilogue;
+      memset(pFileReaderAsync->groups[i].ppDecodedFramesYUV, 0, sizeof(void *) * pFileReaderAsync->groupCapacity);
 
-  pData = slapAlloc(unsigned char, pFileWriter->headerPosition * sizeof(uint64_t));
+      for (size_t j = 0; j < pFileReaderAsync->groupCapacity; j++)
+      {
+        pFileReaderAsync->groups[i].ppDecodedFramesYUV[j] = slapAlloc(uint8_t, resX * resY * 3 / 2);
 
-  if (!pData)
-    goto epilogue;
+        if (!pFileReaderAsync->groups[i].ppDecodedFramesYUV[j])
+          goto epilogue;
+      }
+    }
 
-  if (pFileWriter->headerPosition != (fread(pData, sizeof(uint64_t), pFileWriter->headerPosition, pReadFile)))
-    goto epilogue;
+    if ((flags & slapFileReaderAsync_Reverse) && slapFileReader_GetFrameCount(pFileReaderAsync->pFileReader) > 0)
+    {
+      pFileReaderAsync->reverse = 1;
+      _slapFileReaderAsync_BeginReverse(pFileReaderAsync, slapFileReader_GetFrameCount(pFileReaderAsync->pFileReader) - 1);
+    }
+  }
 
-  ((uint64_t *)pData)[SLAP_PRE_HEADER_HEADER_SIZE_INDEX] = pFileWriter->headerPosition - SLAP_PRE_HEADER_SIZE;
-  ((uint64_t *)pData)[SLAP_PRE_HEADER_FRAME_COUNT_INDEX] = pFileWriter->frameCount;
+  pFileReaderAsync->frameAvailableEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+  pFileReaderAsync->frameReleasedEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 
-  if (pFileWriter->headerPosition != fwrite(pData, sizeof(uint64_t), pFileWriter->headerPosition, pFile))
+  if (!pFileReaderAsync->frameAvailableEvent || !pFileReaderAsync->frameReleasedEvent)
     goto epilogue;
 
-  fclose(pReadFile);
-  remove(filenameBuffer);
-
-  sprintf_s(filenameBuffer, 0xFF, "%s.video", pFileWriter->filename);
-  pReadFile = fopen(filenameBuffer, "rb");
+  pFileReaderAsync->running = 1;
+  pFileReaderAsync->thread = CreateThread(NULL, 0, _slapFileReaderAsync_DecodeThread, pFileReaderAsync, 0, NULL);
 
-  if (!pFile)
+  if (!pFileReaderAsync->thread)
     goto epilogue;
 
-  fseek(pReadFile, 0, SEEK_END);
-  fileSize = ftell(pReadFile);
-  fseek(pReadFile, 0, SEEK_SET);
+  return pFileReaderAsync;
 
-  remainingSize = fileSize;
+epilogue:
+  slapDestroyFileReaderAsync(&pFileReaderAsync);
 
-  slapRealloc(&pData, uint8_t, fileSize < maxBlockSize ? fileSize : maxBlockSize);
+  return NULL;
+}
 
-  while (remainingSize > maxBlockSize)
+void slapDestroyFileReaderAsync(IN_OUT slapFileReaderAsync **ppFileReaderAsync)
+{
+  if (ppFileReaderAsync && *ppFileReaderAsync)
   {
-    if (maxBlockSize != fread(pData, 1, maxBlockSize, pReadFile))
-      goto epilogue;
+    slapFileReaderAsync *pFileReaderAsync = *ppFileReaderAsync;
 
-    if (maxBlockSize != fwrite(pData, 1, maxBlockSize, pFile))
-      goto epilogue;
+    if (pFileReaderAsync->thread)
+    {
+      pFileReaderAsync->running = 0;
+      SetEvent(pFileReaderAsync->frameReleasedEvent);
 
-    remainingSize -= maxBlockSize;
-  }
+      WaitForSingleObject(pFileReaderAsync->thread, INFINITE);
+      CloseHandle(pFileReaderAsync->thread);
+    }
 
-  if (remainingSize != fread(pData, 1, remainingSize, pReadFile))
-    goto epilogue;
+    if (pFileReaderAsync->frameAvailableEvent)
+      CloseHandle(pFileReaderAsync->frameAvailableEvent);
 
-  if (remainingSize != fwrite(pData, 1, remainingSize, pFile))
-    goto epilogue;
+    if (pFileReaderAsync->frameReleasedEvent)
+      CloseHandle(pFileReaderAsync->frameReleasedEvent);
 
-  fclose(pReadFile);
-  pReadFile = NULL;
-  remove(filenameBuffer);
+    if (pFileReaderAsync->pFileReader)
+    {
+      pFileReaderAsync->pFileReader->pDecodedFrameYUV = pFileReaderAsync->pOwnDecodedFrameYUV;
+      pFileReaderAsync->pFileReader->pDecodedFrameBGRA = pFileReaderAsync->pOwnDecodedFrameBGRA;
 
-  result = slapSuccess;
+      slapDestroyFileReader(&pFileReaderAsync->pFileReader);
+    }
 
-epilogue:
+    if (pFileReaderAsync->pFrames)
+    {
+      for (size_t i = 0; i < pFileReaderAsync->frameCount; i++)
+      {
+        slapFreePtr(&pFileReaderAsync->pFrames[i].pDecodedFrameYUV);
+        slapFreePtr(&pFileReaderAsync->pFrames[i].pDecodedFrameBGRA);
+      }
 
-  if (pFile)
-    fclose(pFile);
+      slapFreePtr(&pFileReaderAsync->pFrames);
+    }
 
-  if (pReadFile)
-    fclose(pReadFile);
+    for (size_t i = 0; i < 2; i++)
+    {
+      if (pFileReaderAsync->groups[i].ppDecodedFramesYUV)
+      {
+        for (size_t j = 0; j < pFileReaderAsync->groupCapacity; j++)
+          slapFreePtr(&pFileReaderAsync->groups[i].ppDecodedFramesYUV[j]);
 
-  if (pData)
-    slapFreePtr(&pData);
+        slapFreePtr(&pFileReaderAsync->groups[i].ppDecodedFramesYUV);
+      }
+    }
+  }
 
-  return result;
+  slapFreePtr(ppFileReaderAsync);
 }
 
-slapResult slapFileWriter_AddFrameYUV420(IN slapFileWriter *pFileWriter, IN void *pData)
+slapResult slapFileReaderAsync_AcquireFrame(IN slapFileReaderAsync *pFileReaderAsync, const uint32_t timeoutMs, OUT const void **ppDecodedFrameYUV, OUT const void **ppDecodedFrameBGRA, OUT size_t *pFrameIndex)
 {
   slapResult result = slapSuccess;
-  size_t filePosition = 0;
-  _slapFrameEncoderBlock subFrames[SLAP_SUB_BUFFER_COUNT];
-  size_t totalFullFrameSize = 0;
+  _slapAsyncDecodedFrame *pFrame = NULL;
 
-  if (!pFileWriter || !pData)
+  if (!pFileReaderAsync)
   {
     result = slapError_ArgumentNull;
     goto epilogue;
   }
 
-  result = slapEncoder_BeginFrame(pFileWriter->pEncoder, pData);
-
-  if (result != slapSuccess)
+  if (pFileReaderAsync->frameAcquired)
+  {
+    result = slapError_StateInvalid;
     goto epilogue;
+  }
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  while (pFileReaderAsync->writeIndex == pFileReaderAsync->readIndex)
   {
-    result = slapEncoder_BeginSubFrame(pFileWriter->pEncoder, pData, &subFrames[i].pFrameData, &subFrames[i].frameSize, i);
+    if (WAIT_OBJECT_0 != WaitForSingleObject(pFileReaderAsync->frameAvailableEvent, timeoutMs == (uint32_t)-1 ? INFINITE : timeoutMs))
+    {
+      // The event might've been consumed by an earlier call that had already seen the new frame.
+      if (pFileReaderAsync->writeIndex != pFileReaderAsync->readIndex)
+        break;
 
-    if (result != slapSuccess)
+      result = slapError_Timeout;
       goto epilogue;
+    }
   }
 
-  filePosition = ftell(pFileWriter->pMainFile);
+  MemoryBarrier();
 
-  if ((result = _slapWriteToHeader(pFileWriter, filePosition)) != slapSuccess)
+  pFrame = &pFileReaderAsync->pFrames[(ULONG)pFileReaderAsync->readIndex % pFileReaderAsync->frameCount];
+
+  // The end of the stream and errors aren't consumed, so they're reported again on the next call.
+  if ((result = pFrame->result) != slapSuccess)
     goto epilogue;
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-    totalFullFrameSize += subFrames[i].frameSize;
+  pFileReaderAsync->frameAcquired = 1;
 
-  if ((result = _slapWriteToHeader(pFileWriter, totalFullFrameSize)) != slapSuccess)
-    goto epilogue;
+  if (ppDecodedFrameYUV)
+    *ppDecodedFrameYUV = pFrame->pDecodedFrameYUV;
 
-  filePosition = 0;
+  if (ppDecodedFrameBGRA)
+    *ppDecodedFrameBGRA = pFrame->pDecodedFrameBGRA;
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  if (pFrameIndex)
+    *pFrameIndex = pFrame->frameIndex;
+
+epilogue:
+  return result;
+}
+
+slapResult slapFileReaderAsync_ReleaseFrame(IN slapFileReaderAsync *pFileReaderAsync)
+{
+  if (!pFileReaderAsync)
+    return slapError_ArgumentNull;
+
+  if (!pFileReaderAsync->frameAcquired)
+    return slapError_StateInvalid;
+
+  pFileReaderAsync->frameAcquired = 0;
+
+  MemoryBarrier();
+  InterlockedIncrement(&pFileReaderAsync->readIndex);
+  SetEvent(pFileReaderAsync->frameReleasedEvent);
+
+  return slapSuccess;
+}
+
+slapResult slapFileReaderAsync_GetResolution(IN slapFileReaderAsync *pFileReaderAsync, OUT size_t *pResolutionX, OUT size_t *pResolutionY)
+{
+  if (!pFileReaderAsync)
+    return slapError_ArgumentNull;
+
+  return slapFileReader_GetResolution(pFileReaderAsync->pFileReader, pResolutionX, pResolutionY);
+}
+
+size_t slapFileReaderAsync_GetFrameCount(IN slapFileReaderAsync *pFileReaderAsync)
+{
+  if (!pFileReaderAsync)
+    return 0;
+
+  return slapFileReader_GetFrameCount(pFileReaderAsync->pFileReader);
+}
+
+size_t slapFileReaderAsync_GetIntraFrameStep(IN slapFileReaderAsync *pFileReaderAsync)
+{
+  if (!pFileReaderAsync)
+    return (size_t)-1;
+
+  return slapFileReader_GetIntraFrameStep(pFileReaderAsync->pFileReader);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void _slapEncoder_BeginSubFrameTask(IN void *pUserData)
+{
+  _slapSubFrameTask *pTask = (_slapSubFrameTask *)pUserData;
+
+  pTask->result = slapEncoder_BeginSubFrame(pTask->pEncoder, pTask->pData, &pTask->pSubFrame->pFrameData, &pTask->pSubFrame->frameSize, pTask->subFrameIndex);
+}
+
+void _slapEncoder_EndSubFrameTask(IN void *pUserData)
+{
+  _slapSubFrameTask *pTask = (_slapSubFrameTask *)pUserData;
+
+  pTask->result = slapEncoder_EndSubFrame(pTask->pEncoder, pTask->pData, pTask->subFrameIndex);
+}
+
+void _slapEncoder_EncodeAsyncGroupTask(IN void *pUserData)
+{
+  _slapAsyncGroup *pGroup = (_slapAsyncGroup *)pUserData;
+  slapEncoder *pEncoder = pGroup->pEncoder;
+  slapResult result = slapSuccess;
+  const size_t frameSize = pEncoder->resX * pEncoder->resY * 3 / 2;
+
+  for (size_t frame = 0; frame < pGroup->frameCount; frame++)
   {
-    if ((result = _slapWriteToHeader(pFileWriter, filePosition)) != slapSuccess)
+    uint8_t *pFrameData = pGroup->pFrameData + frame * frameSize;
+
+    if ((result = slapEncoder_BeginFrame(pEncoder, pFrameData)) != slapSuccess)
       goto epilogue;
 
-    if ((result = _slapWriteToHeader(pFileWriter, subFrames[i].frameSize)) != slapSuccess)
+    pGroup->pKeyFrames[frame] = pEncoder->isKeyFrame;
+
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+    {
+      void *pSubFrameData = NULL;
+      size_t subFrameSize = 0;
+
+      if ((result = slapEncoder_BeginSubFrame(pEncoder, pFrameData, &pSubFrameData, &subFrameSize, i)) != slapSuccess)
+        goto epilogue;
+
+      if (pGroup->compressedDataCapacity < pGroup->compressedDataSize + subFrameSize)
+      {
+        pGroup->compressedDataCapacity = (pGroup->compressedDataSize + subFrameSize) * 2;
+        slapRealloc(&pGroup->pCompressedData, uint8_t, pGroup->compressedDataCapacity);
+
+        if (!pGroup->pCompressedData)
+        {
+          pGroup->compressedDataCapacity = 0;
+          result = slapError_MemoryAllocation;
+          goto epilogue;
+        }
+      }
+
+      slapMemcpy(pGroup->pCompressedData + pGroup->compressedDataSize, pSubFrameData, subFrameSize);
+      pGroup->compressedDataSize += subFrameSize;
+      pGroup->pSubFrameSizes[frame * SLAP_SUB_BUFFER_COUNT + i] = subFrameSize;
+    }
+
+    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+      if ((result = slapEncoder_EndSubFrame(pEncoder, pFrameData, i)) != slapSuccess)
+        goto epilogue;
+
+    if ((result = slapEncoder_EndFrame(pEncoder, pFrameData)) != slapSuccess)
       goto epilogue;
+  }
+
+epilogue:
+  pGroup->result = result;
+}
+
+void _slapDecoder_DecodeSubFrameTask(IN void *pUserData)
+{
+  _slapDecodeSubFrameTask *pTask = (_slapDecodeSubFrameTask *)pUserData;
+
+  pTask->result = _slapDecoder_DecodeSubFrameToPlane(pTask->pDecoder, pTask->subFrameIndex, pTask->ppCompressedData, pTask->pLength, pTask->pPlane, pTask->stride);
+}
+
+void _slapDecoder_DecodeTileTask(IN void *pUserData)
+{
+  _slapDecodeTileTask *pTask = (_slapDecodeTileTask *)pUserData;
+  slapDecoder *pDecoder = pTask->pDecoder;
+  const size_t tileCount = pDecoder->mode.flags.tileColumns * pDecoder->mode.flags.tileRows;
 
-    filePosition += subFrames[i].frameSize;
+  pTask->result = _slapDecompressTile(pTask->pPlane, pTask->stride, pTask->pCompressedData, pTask->length, pDecoder->resX, pDecoder->resY, pDecoder->mode.flags.tileColumns, pDecoder->mode.flags.tileRows, pTask->subFrameIndex, pTask->tileIndex, pDecoder->scale, pDecoder->ppTileDecoders[pTask->subFrameIndex * tileCount + pTask->tileIndex], pDecoder->mode.flags.sharedJpegTables);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Thread Pool
+//////////////////////////////////////////////////////////////////////////
+
+// Expects `pThreadPool->lock` to be held by the caller. Returns with the lock held.
+bool_t _slapThreadPool_TryExecuteTask(IN _slapThreadPool *pThreadPool)
+{
+  _slapTask task;
+
+  if (pThreadPool->taskCount == 0)
+    return 0;
 
-    if (subFrames[i].frameSize != fwrite(subFrames[i].pFrameData, 1, subFrames[i].frameSize, pFileWriter->pMainFile))
-    {
-      result = slapError_FileError;
-      goto epilogue;
-    }
-  }
+  task = pThreadPool->tasks[pThreadPool->taskStartIndex];
+  pThreadPool->taskStartIndex = (pThreadPool->taskStartIndex + 1) % SLAP_THREAD_POOL_MAX_TASKS;
+  pThreadPool->taskCount--;
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-  {
-    result = slapEncoder_EndSubFrame(pFileWriter->pEncoder, pData, i);
+  LeaveCriticalSection(&pThreadPool->lock);
 
-    if (result != slapSuccess)
-      goto epilogue;
-  }
+  task.pFunc(task.pUserData);
 
-  // finalize frame.
-  result = slapEncoder_EndFrame(pFileWriter->pEncoder, pData);
+  EnterCriticalSection(&pThreadPool->lock);
 
-  if (result != slapSuccess)
-    goto epilogue;
+  (*task.pPendingCount)--;
 
-  pFileWriter->frameCount++; 
+  if (*task.pPendingCount == 0)
+    WakeAllConditionVariable(&pThreadPool->taskCompleted);
 
-epilogue:
-  return result;
+  return 1;
 }
 
-slapDecoder * slapCreateDecoder(const size_t sizeX, const size_t sizeY, const uint64_t flags)
+DWORD WINAPI _slapThreadPool_WorkerThread(IN LPVOID pUserData)
 {
-  if (sizeX & 7 || sizeY & 7) // must be multiple of 8.
-    return NULL;
+  _slapThreadPool *pThreadPool = (_slapThreadPool *)pUserData;
 
-  slapDecoder *pDecoder = slapAlloc(slapDecoder, 1);
+  EnterCriticalSection(&pThreadPool->lock);
 
-  if (!pDecoder)
-    goto epilogue;
+  while (pThreadPool->running)
+  {
+    if (!_slapThreadPool_TryExecuteTask(pThreadPool))
+      SleepConditionVariableCS(&pThreadPool->taskAvailable, &pThreadPool->lock, INFINITE);
+  }
 
-  slapSetZero(pDecoder, slapDecoder);
+  LeaveCriticalSection(&pThreadPool->lock);
 
-  pDecoder->resX = sizeX;
-  pDecoder->resY = sizeY;
-  pDecoder->iframeStep = SLAP_IFRAME_STEP;
-  pDecoder->mode.flagsPack = flags;
+  return 0;
+}
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-  {
-    pDecoder->pDecoders[i] = tjInitDecompress();
+_slapThreadPool * _slapCreateThreadPool(const size_t threadCount)
+{
+  _slapThreadPool *pThreadPool = slapAlloc(_slapThreadPool, 1);
 
-    if (!pDecoder->pDecoders[i])
-      goto epilogue;
-  }
+  if (!pThreadPool)
+    goto epilogue;
 
-  pDecoder->pLastFrame = slapAlloc(uint8_t, sizeX * sizeY * 3 / 2);
+  slapSetZero(pThreadPool, _slapThreadPool);
 
-  if (!pDecoder->pLastFrame)
-    goto epilogue;
+  InitializeCriticalSection(&pThreadPool->lock);
+  InitializeConditionVariable(&pThreadPool->taskAvailable);
+  InitializeConditionVariable(&pThreadPool->taskCompleted);
 
-  return pDecoder;
+  pThreadPool->running = 1;
+  pThreadPool->pThreads = slapAlloc(HANDLE, threadCount);
 
-epilogue:
-  if (pDecoder->pDecoders)
+  if (!pThreadPool->pThreads)
+    goto epilogue;
+
+  for (; pThreadPool->threadCount < threadCount; pThreadPool->threadCount++)
   {
-    for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-      if (pDecoder->pDecoders[i])
-        tjDestroy(pDecoder->pDecoders[i]);
+    pThreadPool->pThreads[pThreadPool->threadCount] = CreateThread(NULL, 0, _slapThreadPool_WorkerThread, pThreadPool, 0, NULL);
+
+    if (!pThreadPool->pThreads[pThreadPool->threadCount])
+      goto epilogue;
   }
 
-  if (pDecoder->pLastFrame)
-    slapFreePtr(&pDecoder->pLastFrame);
+  return pThreadPool;
 
-  slapFreePtr(&pDecoder);
+epilogue:
+  _slapDestroyThreadPool(&pThreadPool);
 
   return NULL;
 }
 
-void slapDestroyDecoder(IN_OUT slapDecoder **ppDecoder)
+void _slapDestroyThreadPool(IN_OUT _slapThreadPool **ppThreadPool)
 {
-  if (ppDecoder && *ppDecoder)
+  if (ppThreadPool && *ppThreadPool)
   {
-    if ((*ppDecoder)->pDecoders)
+    EnterCriticalSection(&(*ppThreadPool)->lock);
+    (*ppThreadPool)->running = 0;
+    WakeAllConditionVariable(&(*ppThreadPool)->taskAvailable);
+    LeaveCriticalSection(&(*ppThreadPool)->lock);
+
+    for (size_t i = 0; i < (*ppThreadPool)->threadCount; i++)
     {
-      for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-        if ((*ppDecoder)->pDecoders[i])
-          tjDestroy((*ppDecoder)->pDecoders[i]);
+      WaitForSingleObject((*ppThreadPool)->pThreads[i], INFINITE);
+      CloseHandle((*ppThreadPool)->pThreads[i]);
     }
 
-    if ((*ppDecoder)->pLastFrame)
-      slapFreePtr(&(*ppDecoder)->pLastFrame);
+    DeleteCriticalSection(&(*ppThreadPool)->lock);
+    slapFreePtr(&(*ppThreadPool)->pThreads);
   }
 
-  slapFreePtr(ppDecoder);
+  slapFreePtr(ppThreadPool);
 }
 
-slapResult slapDecoder_DecodeSubFrame(IN slapDecoder *pDecoder, const size_t decoderIndex, IN void **ppCompressedData, IN size_t *pLength, IN_OUT void *pYUVData)
+void _slapThreadPool_Enqueue(IN _slapThreadPool *pThreadPool, IN _slapTaskFunc pFunc, IN void *pUserData, IN_OUT size_t *pPendingCount)
 {
-  slapResult result = slapSuccess;
-
-  uint8_t *pOutData = (uint8_t *)pYUVData;
+  EnterCriticalSection(&pThreadPool->lock);
 
-  if (decoderIndex == 0)
-    result = _slapDecompressChannel(pOutData, ppCompressedData[decoderIndex], pLength[decoderIndex], pDecoder->resX, pDecoder->resY, pDecoder->pDecoders[decoderIndex]);
-  else if (decoderIndex == 1)
-    result = _slapDecompressChannel(pOutData + pDecoder->resX * pDecoder->resY, ppCompressedData[decoderIndex], pLength[decoderIndex], pDecoder->resX >> 1, pDecoder->resY >> 1, pDecoder->pDecoders[decoderIndex]);
-  else
-    result = _slapDecompressChannel(pOutData + pDecoder->resX * pDecoder->resY * 5 / 4, ppCompressedData[decoderIndex], pLength[decoderIndex], pDecoder->resX >> 1, pDecoder->resY >> 1, pDecoder->pDecoders[decoderIndex]);
+  // If the queue is full, help out until there's space again.
+  while (pThreadPool->taskCount == SLAP_THREAD_POOL_MAX_TASKS)
+    _slapThreadPool_TryExecuteTask(pThreadPool);
 
-  if (result != slapSuccess)
-    goto epilogue;
+  _slapTask *pTask = &pThreadPool->tasks[(pThreadPool->taskStartIndex + pThreadPool->taskCount) % SLAP_THREAD_POOL_MAX_TASKS];
+  pTask->pFunc = pFunc;
+  pTask->pUserData = pUserData;
+  pTask->pPendingCount = pPendingCount;
+  pThreadPool->taskCount++;
+  (*pPendingCount)++;
 
-epilogue:
-  return result;
+  WakeConditionVariable(&pThreadPool->taskAvailable);
+  LeaveCriticalSection(&pThreadPool->lock);
 }
 
-slapResult slapDecoder_FinalizeFrame(IN slapDecoder *pDecoder, IN void *pData, const size_t length, IN_OUT void *pYUVData)
+void _slapThreadPool_Wait(IN _slapThreadPool *pThreadPool, IN_OUT size_t *pPendingCount)
 {
-  slapResult result = slapSuccess;
-
-  if (!pDecoder || !pData || !length || !pYUVData)
-  {
-    result = slapError_ArgumentNull;
-    goto epilogue;
-  }
+  EnterCriticalSection(&pThreadPool->lock);
 
-  if (pDecoder->iframeStep > 1)
+  while (*pPendingCount != 0)
   {
-    if (pDecoder->frameIndex % pDecoder->iframeStep != 0)
-      _slapDecodeLastFrameDiff(pYUVData, pDecoder->pLastFrame, pDecoder->resX, pDecoder->resY);
-    else
-      _slapCopyToLastFrame(pYUVData, pDecoder->pLastFrame, pDecoder->resX, pDecoder->resY);
+    if (!_slapThreadPool_TryExecuteTask(pThreadPool))
+      SleepConditionVariableCS(&pThreadPool->taskCompleted, &pThreadPool->lock, INFINITE);
   }
 
-  pDecoder->frameIndex++;
-
-epilogue:
-  return result;
+  LeaveCriticalSection(&pThreadPool->lock);
 }
 
-slapFileReader * slapCreateFileReader(const char *filename)
-{
-  slapFileReader *pFileReader = slapAlloc(slapFileReader, 1);
-  size_t frameSize = 0;
+//////////////////////////////////////////////////////////////////////////
+// Core En- & Decoding Functions
+//////////////////////////////////////////////////////////////////////////
 
-  if (!pFileReader)
-    goto epilogue;
+void _slapJpegErrorExit(j_common_ptr pInfo)
+{
+  _slapJpegErrorManager *pError = (_slapJpegErrorManager *)pInfo->err;
 
-  slapSetZero(pFileReader, slapFileReader);
+  longjmp(pError->jumpBuffer, 1);
+}
 
-  pFileReader->pFile = fopen(filename, "rb");
+void _slapJpegOutputMessage(j_common_ptr pInfo)
+{
+#ifdef _DEBUG
+  char message[JMSG_LENGTH_MAX];
 
-  if (!pFileReader->pFile)
-    goto epilogue;
+  pInfo->err->format_message(pInfo, message);
+  slapLog("%s\n", message);
+#else
+  (void)pInfo;
+#endif
+}
 
-  if (SLAP_PRE_HEADER_SIZE != fread(pFileReader->preHeaderBlock, sizeof(uint64_t), SLAP_PRE_HEADER_SIZE, pFileReader->pFile))
-    goto epilogue;
+void _slapJpegInitErrorManager(OUT _slapJpegErrorManager *pError)
+{
+  jpeg_std_error(&pError->pub);
+  pError->pub.error_exit = _slapJpegErrorExit;
+  pError->pub.output_message = _slapJpegOutputMessage;
+}
 
-  pFileReader->pHeader = slapAlloc(uint64_t, pFileReader->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX]);
+void * _slapCreateCompressor(const bool_t sharedJpegTables)
+{
+  if (!sharedJpegTables)
+    return tjInitCompress();
 
-  if (!pFileReader->pHeader)
-    goto epilogue;
+  _slapJpegCompressor *pCompressor = slapAlloc(_slapJpegCompressor, 1);
 
-  if (pFileReader->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX] != fread(pFileReader->pHeader, sizeof(uint64_t), pFileReader->preHeaderBlock[SLAP_PRE_HEADER_HEADER_SIZE_INDEX], pFileReader->pFile))
-    goto epilogue;
+  if (!pCompressor)
+    return NULL;
 
-  pFileReader->headerOffset = ftell(pFileReader->pFile);
+  slapSetZero(pCompressor, _slapJpegCompressor);
 
-  pFileReader->pDecoder = slapCreateDecoder(pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEX_INDEX], pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_SIZEY_INDEX], pFileReader->preHeaderBlock[SLAP_PRE_HEADER_CODEC_FLAGS_INDEX]);
-  pFileReader->pDecoder->iframeStep = pFileReader->preHeaderBlock[SLAP_PRE_HEADER_IFRAME_STEP_INDEX];
+  if (!_slapJpegCompressor_Initialize(pCompressor))
+  {
+    _slapDestroyCompressor(pCompressor, sharedJpegTables);
+    return NULL;
+  }
 
-  if (!pFileReader->pDecoder)
-    goto epilogue;
+  return pCompressor;
+}
 
-  frameSize = pFileReader->pDecoder->resX * pFileReader->pDecoder->resY * 3 / 2;
+bool_t _slapJpegCompressor_Initialize(IN_OUT _slapJpegCompressor *pCompressor)
+{
+  _slapJpegInitErrorManager(&pCompressor->error);
+  pCompressor->info.err = &pCompressor->error.pub;
 
-  pFileReader->pDecodedFrameYUV = slapAlloc(uint8_t, frameSize);
+  if (setjmp(pCompressor->error.jumpBuffer))
+    return 0;
 
-  if (!pFileReader->pDecodedFrameYUV)
-    goto epilogue;
+  jpeg_create_compress(&pCompressor->info);
 
-  return pFileReader;
+  return 1;
+}
 
-epilogue:
+void _slapDestroyCompressor(IN void *pCompressor, const bool_t sharedJpegTables)
+{
+  if (!sharedJpegTables)
+  {
+    tjDestroy(pCompressor);
+    return;
+  }
 
-  slapFreePtr(&(pFileReader)->pHeader);
-  slapFreePtr(&(pFileReader)->pCurrentFrame);
-  slapFreePtr(&(pFileReader)->pDecodedFrameYUV);
+  jpeg_destroy_compress(&((_slapJpegCompressor *)pCompressor)->info);
+  free(pCompressor);
+}
 
-  if (pFileReader->pFile)
-    fclose(pFileReader->pFile);
+void * _slapCreateDecompressor(const bool_t sharedJpegTables)
+{
+  if (!sharedJpegTables)
+    return tjInitDecompress();
 
-  if (pFileReader->pDecoder)
-    slapDestroyDecoder(&pFileReader->pDecoder);
+  _slapJpegDecompressor *pDecompressor = slapAlloc(_slapJpegDecompressor, 1);
 
-  slapFreePtr(&pFileReader);
+  if (!pDecompressor)
+    return NULL;
 
-  return NULL;
-}
+  slapSetZero(pDecompressor, _slapJpegDecompressor);
 
-void slapDestroyFileReader(IN_OUT slapFileReader **ppFileReader)
-{
-  if (ppFileReader && *ppFileReader)
+  if (!_slapJpegDecompressor_Initialize(pDecompressor))
   {
-    slapFreePtr(&(*ppFileReader)->pHeader);
-    slapFreePtr(&(*ppFileReader)->pCurrentFrame);
-    slapFreePtr(&(*ppFileReader)->pDecodedFrameYUV);
-    slapFreePtr(&(*ppFileReader)->pDecodedFrameBGRA);
-    slapDestroyDecoder(&(*ppFileReader)->pDecoder);
-    fclose((*ppFileReader)->pFile);
+    _slapDestroyDecompressor(pDecompressor, sharedJpegTables);
+    return NULL;
   }
 
-  slapFreePtr(ppFileReader);
+  return pDecompressor;
 }
 
-slapResult slapFileReader_GetResolution(IN slapFileReader *pFileReader, OUT size_t *pResolutionX, OUT size_t *pResolutionY)
+bool_t _slapJpegDecompressor_Initialize(IN_OUT _slapJpegDecompressor *pDecompressor)
 {
-  if (!pFileReader || !pResolutionX || !pResolutionY)
-    return slapError_ArgumentNull;
+  _slapJpegInitErrorManager(&pDecompressor->error);
+  pDecompressor->info.err = &pDecompressor->error.pub;
+  pDecompressor->tables.err = &pDecompressor->error.pub;
+
+  if (setjmp(pDecompressor->error.jumpBuffer))
+    return 0;
 
-  *pResolutionX = pFileReader->pDecoder->resX;
-  *pResolutionY = pFileReader->pDecoder->resY;
+  jpeg_create_decompress(&pDecompressor->info);
+  jpeg_create_compress(&pDecompressor->tables);
 
-  return slapSuccess;
+  jpeg_save_markers(&pDecompressor->info, SLAP_JPEG_QUALITY_MARKER, 1);
+
+  pDecompressor->tables.input_components = 1;
+  pDecompressor->tables.in_color_space = JCS_GRAYSCALE;
+  jpeg_set_defaults(&pDecompressor->tables);
+
+  return 1;
 }
 
-size_t slapFileReader_GetFrameCount(IN slapFileReader *pFileReader)
+void _slapDestroyDecompressor(IN void *pDecompressor, const bool_t sharedJpegTables)
 {
-  if (!pFileReader)
-    return 0;
+  if (!sharedJpegTables)
+  {
+    tjDestroy(pDecompressor);
+    return;
+  }
 
-  return pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX];
+  jpeg_destroy_decompress(&((_slapJpegDecompressor *)pDecompressor)->info);
+  jpeg_destroy_compress(&((_slapJpegDecompressor *)pDecompressor)->tables);
+  free(pDecompressor);
 }
 
-size_t slapFileReader_GetIntraFrameStep(IN slapFileReader *pFileReader)
+// Returns 0 if the datastream doesn't have a valid quality marker.
+int _slapJpegDecompressor_GetQuality(IN _slapJpegDecompressor *pDecompressor)
 {
-  if (!pFileReader)
-    return (size_t)-1;
+  for (jpeg_saved_marker_ptr pMarker = pDecompressor->info.marker_list; pMarker != NULL; pMarker = pMarker->next)
+    if (pMarker->marker == SLAP_JPEG_QUALITY_MARKER && pMarker->data_length == 1 && pMarker->data[0] >= 1 && pMarker->data[0] <= 100)
+      return pMarker->data[0];
 
-  return pFileReader->pDecoder->iframeStep;
+  return 0;
 }
 
-slapResult slapFileReader_SetFrameIndex(IN slapFileReader *pFileReader, const size_t frameIndex)
+// Generates the tables exactly like `_slapCompressChannelAbbreviated` sets them up for `quality` and loads them into the decompressor, where they're kept for all following datastreams.
+void _slapJpegDecompressor_LoadTables(IN _slapJpegDecompressor *pDecompressor, const int quality)
 {
-  if (!pFileReader)
-    return slapError_ArgumentNull;
+  struct jpeg_decompress_struct *pInfo = &pDecompressor->info;
+  struct jpeg_compress_struct *pTables = &pDecompressor->tables;
 
-  if (slapFileReader_GetFrameCount(pFileReader) <= frameIndex)
-    return slapError_EndOfStream;
+  pDecompressor->quality = 0;
 
-  pFileReader->pDecoder->frameIndex = pFileReader->frameIndex = frameIndex - (frameIndex % slapFileReader_GetIntraFrameStep(pFileReader));
-  
-  return slapSuccess;
-}
+  jpeg_set_quality(pTables, quality, TRUE);
 
-size_t slapFileReader_GetFrameIndex(IN slapFileReader *pFileReader)
-{
-  if (!pFileReader)
-    return (size_t)-1;
+  if (!pInfo->quant_tbl_ptrs[0])
+    pInfo->quant_tbl_ptrs[0] = jpeg_alloc_quant_table((j_common_ptr)pInfo);
 
-  return pFileReader->frameIndex;
+  if (!pInfo->dc_huff_tbl_ptrs[0])
+    pInfo->dc_huff_tbl_ptrs[0] = jpeg_alloc_huff_table((j_common_ptr)pInfo);
+
+  if (!pInfo->ac_huff_tbl_ptrs[0])
+    pInfo->ac_huff_tbl_ptrs[0] = jpeg_alloc_huff_table((j_common_ptr)pInfo);
+
+  memcpy(pInfo->quant_tbl_ptrs[0]->quantval, pTables->quant_tbl_ptrs[0]->quantval, sizeof(pTables->quant_tbl_ptrs[0]->quantval));
+  memcpy(pInfo->dc_huff_tbl_ptrs[0]->bits, pTables->dc_huff_tbl_ptrs[0]->bits, sizeof(pTables->dc_huff_tbl_ptrs[0]->bits));
+  memcpy(pInfo->dc_huff_tbl_ptrs[0]->huffval, pTables->dc_huff_tbl_ptrs[0]->huffval, sizeof(pTables->dc_huff_tbl_ptrs[0]->huffval));
+  memcpy(pInfo->ac_huff_tbl_ptrs[0]->bits, pTables->ac_huff_tbl_ptrs[0]->bits, sizeof(pTables->ac_huff_tbl_ptrs[0]->bits));
+  memcpy(pInfo->ac_huff_tbl_ptrs[0]->huffval, pTables->ac_huff_tbl_ptrs[0]->huffval, sizeof(pTables->ac_huff_tbl_ptrs[0]->huffval));
+
+  pDecompressor->quality = quality;
 }
 
-slapResult slapFileReader_ReadNextFrame(IN slapFileReader *pFileReader)
+slapResult _slapCompressChannel(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const size_t pitch, const int quality, IN void *pCompressor, const bool_t sharedJpegTables)
 {
-  slapResult result = slapSuccess;
-  uint64_t position;
+  if (sharedJpegTables)
+    return _slapCompressChannelAbbreviated(pData, ppCompressedData, pCompressedDataSize, width, height, pitch, quality, (_slapJpegCompressor *)pCompressor);
 
-  if (!pFileReader)
-  {
-    result = slapError_ArgumentNull;
-    goto epilogue;
-  }
+  unsigned long length = (unsigned long)*pCompressedDataSize;
 
-  if (pFileReader->frameIndex >= pFileReader->preHeaderBlock[SLAP_PRE_HEADER_FRAME_COUNT_INDEX])
+  if (tjCompress2(pCompressor, (unsigned char *)pData, (int)width, (int)pitch, (int)height, TJPF_GRAY, (unsigned char **)ppCompressedData, &length, TJSAMP_GRAY, quality, TJFLAG_FASTDCT))
   {
-    result = slapError_EndOfStream;
-    goto epilogue;
+    slapLog(tjGetErrorStr2(pCompressor));
+    return slapError_Compress_Internal;
   }
 
-  position = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE * pFileReader->frameIndex + SLAP_HEADER_FRAME_OFFSET_INDEX] + pFileReader->headerOffset;
-  pFileReader->currentFrameSize = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE * pFileReader->frameIndex + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
-
-  if (pFileReader->currentFrameAllocatedSize < pFileReader->currentFrameSize)
-  {
-    slapRealloc(&pFileReader->pCurrentFrame, uint8_t, pFileReader->currentFrameSize);
-    pFileReader->currentFrameAllocatedSize = pFileReader->currentFrameSize;
+  *pCompressedDataSize = length;
 
-    if (!pFileReader->pCurrentFrame)
-    {
-      pFileReader->currentFrameAllocatedSize = 0;
-      result = slapError_MemoryAllocation;
-      goto epilogue;
-    }
-  }
+  return slapSuccess;
+}
 
-  if (fseek(pFileReader->pFile, (long)position, SEEK_SET))
-  {
-    result = slapError_FileError;
-    goto epilogue;
-  }
+slapResult _slapCompressYUV420(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pCompressor)
+{
+  unsigned long length = (unsigned long)*pCompressedDataSize;
 
-  if (pFileReader->currentFrameSize != fread(pFileReader->pCurrentFrame, 1, pFileReader->currentFrameSize, pFileReader->pFile))
+  // The planes aren't padded.
+  if (tjCompressFromYUV(pCompressor, (unsigned char *)pData, (int)width, 1, (int)height, TJSAMP_420, (unsigned char **)ppCompressedData, &length, quality, TJFLAG_FASTDCT))
   {
-    result = slapError_FileError;
-    goto epilogue;
+    slapLog(tjGetErrorStr2(pCompressor));
+    return slapError_Compress_Internal;
   }
 
-  pFileReader->frameIndex++;
+  *pCompressedDataSize = length;
 
-epilogue:
-  return result;
+  return slapSuccess;
 }
 
-slapResult slapFileReader_DecodeCurrentFrame(IN slapFileReader *pFileReader)
+slapResult _slapCompressChannelAbbreviated(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const size_t pitch, const int quality, IN _slapJpegCompressor *pCompressor)
 {
-  slapResult result = slapSuccess;
-  void *dataAddrs[SLAP_SUB_BUFFER_COUNT];
-  size_t dataSizes[SLAP_SUB_BUFFER_COUNT];
+  struct jpeg_compress_struct *pInfo = &pCompressor->info;
+  unsigned char *pBuffer = (unsigned char *)*ppCompressedData;
+  unsigned long length = (unsigned long)*pCompressedDataSize;
+  const JOCTET qualityMarker = (JOCTET)quality;
 
-  if (!pFileReader)
+  if (setjmp(pCompressor->error.jumpBuffer))
   {
-    result = slapError_ArgumentNull;
-    goto epilogue;
+    jpeg_abort_compress(pInfo);
+    return slapError_Compress_Internal;
   }
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-  {
-    dataAddrs[i] = ((uint8_t *)pFileReader->pCurrentFrame) + pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE * (pFileReader->frameIndex - 1) + SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_OFFSET_INDEX];
-    dataSizes[i] = pFileReader->pHeader[SLAP_HEADER_PER_FRAME_SIZE * (pFileReader->frameIndex - 1) + SLAP_HEADER_PER_FRAME_FULL_FRAME_OFFSET + i * 2 + SLAP_HEADER_FRAME_DATA_SIZE_INDEX];
-  }
+  pInfo->image_width = (JDIMENSION)width;
+  pInfo->image_height = (JDIMENSION)height;
+  pInfo->input_components = 1;
+  pInfo->in_color_space = JCS_GRAYSCALE;
 
-  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
-  {
-    result = slapDecoder_DecodeSubFrame(pFileReader->pDecoder, i, dataAddrs, dataSizes, pFileReader->pDecodedFrameYUV);
+  jpeg_set_defaults(pInfo);
+  jpeg_set_quality(pInfo, quality, TRUE);
+  jpeg_suppress_tables(pInfo, TRUE);
 
-    if (result != slapSuccess)
-      goto epilogue;
-  }
+  pInfo->dct_method = JDCT_IFAST;
+  pInfo->write_JFIF_header = FALSE;
 
-  result = slapDecoder_FinalizeFrame(pFileReader->pDecoder, pFileReader->pCurrentFrame, pFileReader->currentFrameSize, pFileReader->pDecodedFrameYUV);
+  jpeg_mem_dest(pInfo, &pBuffer, &length);
+  jpeg_start_compress(pInfo, FALSE);
+  jpeg_write_marker(pInfo, SLAP_JPEG_QUALITY_MARKER, &qualityMarker, 1);
 
-  if (result != slapSuccess)
-    goto epilogue;
+  while (pInfo->next_scanline < pInfo->image_height)
+  {
+    JSAMPROW row = (JSAMPROW)((uint8_t *)pData + pInfo->next_scanline * pitch);
+    jpeg_write_scanlines(pInfo, &row, 1);
+  }
 
-epilogue:
-  return result;
-}
+  jpeg_finish_compress(pInfo);
 
-slapResult slapFileReader_GetNextFrame(IN slapFileReader *pFileReader)
-{
-  slapResult result = slapFileReader_ReadNextFrame(pFileReader);
+  // The destination manager allocates a new buffer if the existing one is too small.
+  if (pBuffer != *ppCompressedData)
+  {
+    free(*ppCompressedData);
+    *ppCompressedData = pBuffer;
+  }
 
-  if (result != slapSuccess)
-    return result;
+  *pCompressedDataSize = length;
 
-  return slapFileReader_DecodeCurrentFrame(pFileReader);
+  return slapSuccess;
 }
 
-slapResult slapFileReader_RestartVideoStream(IN slapFileReader *pFileReader)
+// `width` and `height` are the size of the compressed channel. It's decoded at `1 / scale` of that size.
+slapResult _slapDecompressChannel(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t pitch, const size_t scale, IN void *pDecompressor, const bool_t sharedJpegTables)
 {
-  if (pFileReader == NULL)
-    return slapError_ArgumentNull;
+  if (sharedJpegTables)
+    return _slapDecompressChannelAbbreviated(pData, pCompressedData, compressedDataSize, width, height, pitch, scale, (_slapJpegDecompressor *)pDecompressor);
 
-  pFileReader->frameIndex = 0;
-  pFileReader->pDecoder->frameIndex = 0;
+  // turbojpeg picks the largest scaling factor that fits into the requested size.
+  if (tjDecompress2(pDecompressor, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize, (unsigned char *)pData, (int)(width / scale), (int)pitch, (int)(height / scale), TJPF_GRAY, TJFLAG_FASTDCT))
+  {
+    slapLog(tjGetErrorStr2(pDecompressor));
+    return slapError_Compress_Internal;
+  }
 
   return slapSuccess;
 }
 
-slapResult slapFileReader_TransformBufferToBGRA(IN slapFileReader *pFileReader)
+slapResult _slapDecompressChannelAbbreviated(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t pitch, const size_t scale, IN _slapJpegDecompressor *pDecompressor)
 {
-  if (pFileReader == NULL)
-    return slapError_ArgumentNull;
-
-  slapResult result = slapSuccess;
+  struct jpeg_decompress_struct *pInfo = &pDecompressor->info;
 
-  if (!pFileReader->pDecodedFrameBGRA)
+  if (setjmp(pDecompressor->error.jumpBuffer))
   {
-    pFileReader->pDecodedFrameBGRA = slapAlloc(uint32_t, pFileReader->pDecoder->resX * pFileReader->pDecoder->resY);
+    jpeg_abort_decompress(pInfo);
+    return slapError_Compress_Internal;
+  }
 
-    if (!pFileReader->pDecodedFrameBGRA)
-    {
-      result = slapError_MemoryAllocation;
-      goto epilogue;
-    }
+  jpeg_mem_src(pInfo, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize);
+  jpeg_read_header(pInfo, TRUE);
+
+  const int quality = _slapJpegDecompressor_GetQuality(pDecompressor);
+
+  if (quality == 0 || pInfo->image_width != width || pInfo->image_height != height || pInfo->num_components != 1)
+  {
+    jpeg_abort_decompress(pInfo);
+    return slapError_Compress_Internal;
   }
 
-  const int error = tjDecodeYUV(pFileReader->pDecoder->pDecoders[0], (unsigned char *)pFileReader->pDecodedFrameYUV, 1, TJSAMP_420, (unsigned char *)pFileReader->pDecodedFrameBGRA, (int)pFileReader->pDecoder->resX, (int)pFileReader->pDecoder->resX * sizeof(uint32_t), (int)pFileReader->pDecoder->resY, TJPF_BGRA, 0);
+  // The tables are only generated again if the quality has changed since the last datastream.
+  if (quality != pDecompressor->quality)
+    _slapJpegDecompressor_LoadTables(pDecompressor, quality);
 
-  if (error != 0)
+  pInfo->dct_method = JDCT_IFAST;
+  pInfo->out_color_space = JCS_GRAYSCALE;
+  pInfo->scale_num = 1;
+  pInfo->scale_denom = (unsigned int)scale;
+
+  jpeg_start_decompress(pInfo);
+
+  while (pInfo->output_scanline < pInfo->output_height)
   {
-    result = slapError_Compress_Internal;
-    goto epilogue;
+    JSAMPROW row = (JSAMPROW)((uint8_t *)pData + pInfo->output_scanline * pitch);
+    jpeg_read_scanlines(pInfo, &row, 1);
   }
 
-epilogue:
-  return result;
+  jpeg_finish_decompress(pInfo);
+
+  return slapSuccess;
 }
 
-const void * slapFileReader_GetBufferYUV420(IN slapFileReader *pFileReader)
+size_t _slapGetTileOffset(const size_t resolution, const size_t tileCount, const size_t tileIndex)
 {
-  if (pFileReader == NULL)
-    return NULL;
+  if (tileIndex >= tileCount)
+    return resolution;
 
-  return pFileReader->pDecodedFrameYUV;
+  return (resolution / SLAP_TILE_ALIGNMENT) * tileIndex / tileCount * SLAP_TILE_ALIGNMENT;
 }
 
-
-const void * slapFileReader_GetBufferBGRA(IN slapFileReader *pFileReader)
+void _slapGetTileRect(const size_t resX, const size_t resY, const size_t tileColumns, const size_t tileRows, const size_t subFrameIndex, const size_t tileIndex, OUT size_t *pX, OUT size_t *pY, OUT size_t *pSizeX, OUT size_t *pSizeY)
 {
-  if (pFileReader == NULL)
-    return NULL;
-
-  return pFileReader->pDecodedFrameBGRA;
+  const size_t column = tileIndex % tileColumns;
+  const size_t row = tileIndex / tileColumns;
+  const size_t shift = subFrameIndex == 0 ? 0 : 1;
+
+  *pX = _slapGetTileOffset(resX, tileColumns, column) >> shift;
+  *pY = _slapGetTileOffset(resY, tileRows, row) >> shift;
+  *pSizeX = (_slapGetTileOffset(resX, tileColumns, column + 1) >> shift) - *pX;
+  *pSizeY = (_slapGetTileOffset(resY, tileRows, row + 1) >> shift) - *pY;
 }
 
-//////////////////////////////////////////////////////////////////////////
-// Core En- & Decoding Functions
-//////////////////////////////////////////////////////////////////////////
-
-slapResult _slapCompressChannel(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pCompressor)
+slapResult _slapDecompressTile(OUT uint8_t *pPlane, const size_t stride, IN const uint8_t *pSubFrame, const size_t subFrameSize, const size_t resX, const size_t resY, const size_t tileColumns, const size_t tileRows, const size_t subFrameIndex, const size_t tileIndex, const size_t scale, IN void *pDecompressor, const bool_t sharedJpegTables)
 {
-  unsigned long length = (unsigned long)*pCompressedDataSize;
+  const size_t tileCount = tileColumns * tileRows;
+  size_t offset = sizeof(uint32_t) * tileCount;
+  uint32_t tileSize = 0;
+  size_t x, y, sizeX, sizeY;
+
+  if (subFrameSize < offset)
+    return slapError_FileError;
 
-  if (tjCompress2(pCompressor, (unsigned char *)pData, (int)width, (int)width, (int)height, TJPF_GRAY, (unsigned char **)ppCompressedData, &length, TJSAMP_GRAY, quality, TJFLAG_FASTDCT))
+  // The tile size table isn't necessarily aligned.
+  for (size_t i = 0; i < tileIndex; i++)
   {
-    slapLog(tjGetErrorStr2(pCompressor));
-    return slapError_Compress_Internal;
+    memcpy(&tileSize, pSubFrame + i * sizeof(uint32_t), sizeof(uint32_t));
+    offset += tileSize;
   }
 
-  *pCompressedDataSize = length;
+  memcpy(&tileSize, pSubFrame + tileIndex * sizeof(uint32_t), sizeof(uint32_t));
 
-  return slapSuccess;
+  if (offset + tileSize > subFrameSize)
+    return slapError_FileError;
+
+  _slapGetTileRect(resX, resY, tileColumns, tileRows, subFrameIndex, tileIndex, &x, &y, &sizeX, &sizeY);
+
+  // Tiles start at multiples of `SLAP_TILE_ALIGNMENT`, so they stay aligned to the pixels of scaled planes.
+  return _slapDecompressChannel(pPlane + (y / scale) * stride + x / scale, (void *)(pSubFrame + offset), tileSize, sizeX, sizeY, stride, scale, pDecompressor, sharedJpegTables);
 }
 
-slapResult _slapCompressYUV420(IN void *pData, IN_OUT void **ppCompressedData, IN_OUT size_t *pCompressedDataSize, const size_t width, const size_t height, const int quality, IN void *pCompressor)
+bool_t _slapIsYUV420Jpeg(IN void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pDecompressor)
 {
-  unsigned long length = (unsigned long)*pCompressedDataSize;
+  int jpegWidth, jpegHeight, subsampling, colorspace;
 
-  if (tjCompressFromYUV(pCompressor, (unsigned char *)pData, (int)width, 32, (int)height, TJSAMP_420, (unsigned char **)ppCompressedData, &length, quality, TJFLAG_FASTDCT))
+  if (tjDecompressHeader3(pDecompressor, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize, &jpegWidth, &jpegHeight, &subsampling, &colorspace))
+    return 0;
+
+  return (size_t)jpegWidth == width && (size_t)jpegHeight == height && subsampling == TJSAMP_420;
+}
+
+slapResult _slapDecompressYUV420(OUT uint8_t **ppPlanes, const size_t *pStrides, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t scale, IN void *pDecompressor)
+{
+  unsigned char *planes[SLAP_SUB_BUFFER_COUNT];
+  int strides[SLAP_SUB_BUFFER_COUNT];
+
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
   {
-    slapLog(tjGetErrorStr2(pCompressor));
-    return slapError_Compress_Internal;
+    planes[i] = ppPlanes[i];
+    strides[i] = (int)pStrides[i];
   }
 
-  *pCompressedDataSize = length;
+  if (!_slapIsYUV420Jpeg(pCompressedData, compressedDataSize, width, height, pDecompressor))
+    return slapError_Compress_Internal;
+
+  if (tjDecompressToYUVPlanes(pDecompressor, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize, planes, (int)(width / scale), strides, (int)(height / scale), TJFLAG_FASTDCT))
+  {
+    slapLog(tjGetErrorStr2(pDecompressor));
+    return slapError_Compress_Internal;
+  }
 
   return slapSuccess;
 }
 
-slapResult _slapDecompressChannel(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pDecompressor)
+slapResult _slapDecompressYUV420Luma(OUT uint8_t *pPlane, const size_t stride, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t scale, IN void *pDecompressor)
 {
-  if (tjDecompress2(pDecompressor, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize, (unsigned char *)pData, (int)width, (int)width, (int)height, TJPF_GRAY, TJFLAG_FASTDCT))
+  if (!_slapIsYUV420Jpeg(pCompressedData, compressedDataSize, width, height, pDecompressor))
+    return slapError_Compress_Internal;
+
+  if (tjDecompress2(pDecompressor, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize, pPlane, (int)(width / scale), (int)stride, (int)(height / scale), TJPF_GRAY, TJFLAG_FASTDCT))
   {
     slapLog(tjGetErrorStr2(pDecompressor));
     return slapError_Compress_Internal;
@@ -1222,9 +6012,12 @@ slapResult _slapDecompressChannel(IN void *pData, IN_OUT void *pCompressedData,
   return slapSuccess;
 }
 
-slapResult _slapDecompressYUV420(IN void *pData, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, IN void *pDecompressor)
+slapResult _slapDecompressYUV420ToBGRA(OUT void *pBGRA, const size_t stride, IN_OUT void *pCompressedData, const size_t compressedDataSize, const size_t width, const size_t height, const size_t scale, IN void *pDecompressor)
 {
-  if (tjDecompressToYUV2(pDecompressor, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize, (unsigned char *)pData, (int)width, 32, (int)height, TJFLAG_FASTDCT))
+  if (!_slapIsYUV420Jpeg(pCompressedData, compressedDataSize, width, height, pDecompressor))
+    return slapError_Compress_Internal;
+
+  if (tjDecompress2(pDecompressor, (unsigned char *)pCompressedData, (unsigned long)compressedDataSize, (unsigned char *)pBGRA, (int)(width / scale), (int)stride, (int)(height / scale), TJPF_BGRA, TJFLAG_FASTDCT))
   {
     slapLog(tjGetErrorStr2(pDecompressor));
     return slapError_Compress_Internal;
@@ -1277,6 +6070,32 @@ void _slapEncodeLastFrameDiff(IN_OUT void *pLastFrame, IN_OUT void *pData, const
   }
 }
 
+// Like `_slapEncodeLastFrameDiff`, but also replaces the last frame with the current source frame.
+void _slapEncodeLastFrameDiffOpenLoop(IN_OUT void *pLastFrame, IN_OUT void *pData, const size_t resX, const size_t resY)
+{
+  __m128i *pCB0 = (__m128i *)pData;
+  __m128i *pLF0 = (__m128i *)pLastFrame;
+
+  const __m128i half = _mm_set1_epi8(127);
+  const size_t max = (resX * resY * 3 / 2) / sizeof(__m128i);
+
+  for (size_t i = 0; i < max; i++)
+  {
+    __m128i cb0 = _mm_load_si128(pCB0);
+    __m128i lf0 = _mm_load_si128(pLF0);
+
+    _mm_store_si128(pLF0, cb0);
+
+    // last frame diff
+    cb0 = _mm_add_epi8(_mm_sub_epi8(lf0, cb0), half);
+
+    _mm_store_si128(pCB0, cb0);
+
+    pCB0++;
+    pLF0++;
+  }
+}
+
 void _slapCopyToLastFrame(IN_OUT void *pData, OUT void *pLastFrame, const size_t resX, const size_t resY)
 {
   slapMemcpy(pLastFrame, pData, resX * resY * 3 / 2);
@@ -1323,3 +6142,432 @@ void _slapDecodeLastFrameDiff(IN_OUT void *pData, OUT void *pLastFrame, const si
     }
   }
 }
+
+void _slapDecodeLastFrameDiffPlane(IN_OUT uint8_t *pData, const size_t stride, OUT uint8_t *pLastFrame, const size_t lastFrameStride, const size_t sizeX, const size_t sizeY, const uint8_t half)
+{
+  // Rows of caller provided buffers aren't necessarily aligned.
+  const __m128i halfX16 = _mm_set1_epi8((char)half);
+
+  for (size_t y = 0; y < sizeY; y++)
+  {
+    uint8_t *pCB0 = pData + y * stride;
+    uint8_t *pLF0 = pLastFrame + y * lastFrameStride;
+    size_t x = 0;
+
+    for (; x + sizeof(__m128i) <= sizeX; x += sizeof(__m128i))
+    {
+      __m128i cb0 = _mm_loadu_si128((__m128i *)(pCB0 + x));
+      __m128i lf0 = _mm_loadu_si128((__m128i *)(pLF0 + x));
+
+      lf0 = _mm_sub_epi8(lf0, _mm_add_epi8(cb0, halfX16));
+      _mm_storeu_si128((__m128i *)(pCB0 + x), lf0);
+      _mm_storeu_si128((__m128i *)(pLF0 + x), lf0);
+    }
+
+    for (; x < sizeX; x++)
+      pCB0[x] = pLF0[x] = (uint8_t)(pLF0[x] - (uint8_t)(pCB0[x] + half));
+  }
+}
+
+size_t _slapGetChangedBlockBitmapSize(const size_t resX, const size_t resY)
+{
+  return ((resX / SLAP_SKIP_BLOCK_SIZE) * (resY / SLAP_SKIP_BLOCK_SIZE) + 7) / 8;
+}
+
+size_t _slapDetectChangedBlocks(IN const uint8_t *pData, IN const uint8_t *pLastFrame, OUT uint8_t *pChangedBlockBitmap, const size_t resX, const size_t resY, const size_t threshold)
+{
+  const size_t blocksPerRow = resX / SLAP_SKIP_BLOCK_SIZE;
+  const size_t blockCount = blocksPerRow * (resY / SLAP_SKIP_BLOCK_SIZE);
+  const size_t chromaStride = resX >> 1;
+  const uint8_t *pDataU = pData + resX * resY;
+  const uint8_t *pDataV = pData + resX * resY * 5 / 4;
+  const uint8_t *pLastFrameU = pLastFrame + resX * resY;
+  const uint8_t *pLastFrameV = pLastFrame + resX * resY * 5 / 4;
+  size_t changedBlockCount = 0;
+
+  memset(pChangedBlockBitmap, 0, _slapGetChangedBlockBitmapSize(resX, resY));
+
+  for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++)
+  {
+    const size_t lumaOffset = (blockIndex / blocksPerRow) * SLAP_SKIP_BLOCK_SIZE * resX + (blockIndex % blocksPerRow) * SLAP_SKIP_BLOCK_SIZE;
+    const size_t chromaOffset = (blockIndex / blocksPerRow) * (SLAP_SKIP_BLOCK_SIZE / 2) * chromaStride + (blockIndex % blocksPerRow) * (SLAP_SKIP_BLOCK_SIZE / 2);
+    __m128i sad = _mm_cvtsi32_si128((int)_slapGetBlockSAD(pData + lumaOffset, pLastFrame + lumaOffset, resX));
+
+    // U and V rows are combined into one register.
+    for (size_t y = 0; y < SLAP_SKIP_BLOCK_SIZE / 2; y++)
+    {
+      const size_t offset = chromaOffset + y * chromaStride;
+      const __m128i cb0 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(pDataU + offset)), _mm_loadl_epi64((const __m128i *)(pDataV + offset)));
+      const __m128i lf0 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(pLastFrameU + offset)), _mm_loadl_epi64((const __m128i *)(pLastFrameV + offset)));
+
+      sad = _mm_add_epi64(sad, _mm_sad_epu8(cb0, lf0));
+    }
+
+    sad = _mm_add_epi64(sad, _mm_unpackhi_epi64(sad, sad));
+
+    if ((size_t)_mm_cvtsi128_si32(sad) > threshold)
+    {
+      pChangedBlockBitmap[blockIndex >> 3] |= (uint8_t)(1 << (blockIndex & 7));
+      changedBlockCount++;
+    }
+  }
+
+  return changedBlockCount;
+}
+
+void _slapEncodeChangedBlocksDiff(IN const uint8_t *pLastFrame, IN const uint8_t *pData, OUT uint8_t *pBlockFrame, OUT uint8_t *pReference, IN const uint8_t *pChangedBlockBitmap, const size_t changedBlockCount, const size_t resX, const size_t resY)
+{
+  const size_t blocksPerRow = resX / SLAP_SKIP_BLOCK_SIZE;
+  const size_t blockCount = blocksPerRow * (resY / SLAP_SKIP_BLOCK_SIZE);
+  const size_t paddedBlockCount = (changedBlockCount + blocksPerRow - 1) / blocksPerRow * blocksPerRow;
+  const __m128i half = _mm_set1_epi8(127);
+  size_t planeOffset = 0;
+
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  {
+    const size_t blockSize = i == 0 ? SLAP_SKIP_BLOCK_SIZE : SLAP_SKIP_BLOCK_SIZE / 2;
+    const size_t stride = i == 0 ? resX : resX >> 1;
+    size_t packedIndex = 0;
+
+    for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++)
+    {
+      if (!(pChangedBlockBitmap[blockIndex >> 3] & (1 << (blockIndex & 7))))
+        continue;
+
+      const size_t offset = planeOffset + (blockIndex / blocksPerRow) * blockSize * stride + (blockIndex % blocksPerRow) * blockSize;
+      uint8_t *pPacked = pBlockFrame + planeOffset + (packedIndex / blocksPerRow) * blockSize * stride + (packedIndex % blocksPerRow) * blockSize;
+
+      for (size_t y = 0; y < blockSize; y++)
+      {
+        const uint8_t *pCB0 = pData + offset + y * stride;
+        const uint8_t *pLF0 = pLastFrame + offset + y * stride;
+        uint8_t *pRef0 = pReference + offset + y * stride;
+        uint8_t *pPacked0 = pPacked + y * stride;
+
+        if (blockSize == sizeof(__m128i))
+        {
+          const __m128i cb0 = _mm_loadu_si128((const __m128i *)pCB0);
+          const __m128i lf0 = _mm_loadu_si128((const __m128i *)pLF0);
+
+          _mm_storeu_si128((__m128i *)pPacked0, _mm_add_epi8(_mm_sub_epi8(lf0, cb0), half));
+          _mm_storeu_si128((__m128i *)pRef0, cb0);
+        }
+        else
+        {
+          const __m128i cb0 = _mm_loadl_epi64((const __m128i *)pCB0);
+          const __m128i lf0 = _mm_loadl_epi64((const __m128i *)pLF0);
+
+          _mm_storel_epi64((__m128i *)pPacked0, _mm_add_epi8(_mm_sub_epi8(lf0, cb0), half));
+          _mm_storel_epi64((__m128i *)pRef0, cb0);
+        }
+      }
+
+      packedIndex++;
+    }
+
+    // Fill the rest of the last row of blocks with 'no difference', so it's cheap to compress.
+    for (; packedIndex < paddedBlockCount; packedIndex++)
+    {
+      uint8_t *pPacked = pBlockFrame + planeOffset + (packedIndex / blocksPerRow) * blockSize * stride + (packedIndex % blocksPerRow) * blockSize;
+
+      for (size_t y = 0; y < blockSize; y++)
+        memset(pPacked + y * stride, 127, blockSize);
+    }
+
+    planeOffset += stride * (i == 0 ? resY : resY >> 1);
+  }
+}
+
+// `lumaBlockSize` is the size of the luma blocks in `pLastFrame`, which is smaller than `SLAP_SKIP_BLOCK_SIZE` if the frame has been decoded at a reduced scale.
+void _slapDecodeChangedBlocksDiff(IN const uint8_t *pBlockFrame, IN_OUT uint8_t *pLastFrame, IN const uint8_t *pChangedBlockBitmap, const size_t resX, const size_t resY, const size_t lumaBlockSize, const size_t planeCount)
+{
+  const size_t blocksPerRow = resX / lumaBlockSize;
+  const size_t blockCount = blocksPerRow * (resY / lumaBlockSize);
+  size_t planeOffset = 0;
+
+  for (size_t i = 0; i < planeCount; i++)
+  {
+    const size_t blockSize = i == 0 ? lumaBlockSize : lumaBlockSize / 2;
+    const size_t stride = i == 0 ? resX : resX >> 1;
+    const uint8_t halfX1 = i == 0 ? 129 : 130;
+    const __m128i half = _mm_set1_epi8((char)halfX1);
+    size_t packedIndex = 0;
+
+    for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++)
+    {
+      if (!(pChangedBlockBitmap[blockIndex >> 3] & (1 << (blockIndex & 7))))
+        continue;
+
+      uint8_t *pLF = pLastFrame + planeOffset + (blockIndex / blocksPerRow) * blockSize * stride + (blockIndex % blocksPerRow) * blockSize;
+      const uint8_t *pPacked = pBlockFrame + planeOffset + (packedIndex / blocksPerRow) * blockSize * stride + (packedIndex % blocksPerRow) * blockSize;
+
+      for (size_t y = 0; y < blockSize; y++)
+      {
+        if (blockSize == sizeof(__m128i))
+        {
+          const __m128i cb0 = _mm_loadu_si128((const __m128i *)(pPacked + y * stride));
+          const __m128i lf0 = _mm_loadu_si128((const __m128i *)(pLF + y * stride));
+
+          _mm_storeu_si128((__m128i *)(pLF + y * stride), _mm_sub_epi8(lf0, _mm_add_epi8(cb0, half)));
+        }
+        else if (blockSize == sizeof(uint64_t))
+        {
+          const __m128i cb0 = _mm_loadl_epi64((const __m128i *)(pPacked + y * stride));
+          const __m128i lf0 = _mm_loadl_epi64((const __m128i *)(pLF + y * stride));
+
+          _mm_storel_epi64((__m128i *)(pLF + y * stride), _mm_sub_epi8(lf0, _mm_add_epi8(cb0, half)));
+        }
+        else
+        {
+          for (size_t x = 0; x < blockSize; x++)
+            pLF[y * stride + x] = (uint8_t)(pLF[y * stride + x] - (uint8_t)(pPacked[y * stride + x] + halfX1));
+        }
+      }
+
+      packedIndex++;
+    }
+
+    planeOffset += stride * (i == 0 ? resY : resY >> 1);
+  }
+}
+
+uint32_t _slapGetBlockSAD(IN const uint8_t *pA, IN const uint8_t *pB, const size_t stride)
+{
+  __m128i sad = _mm_setzero_si128();
+
+  for (size_t y = 0; y < 16; y++)
+    sad = _mm_add_epi64(sad, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(pA + y * stride)), _mm_loadu_si128((const __m128i *)(pB + y * stride))));
+
+  sad = _mm_add_epi64(sad, _mm_unpackhi_epi64(sad, sad));
+
+  return (uint32_t)_mm_cvtsi128_si32(sad);
+}
+
+size_t _slapGetMotionVectorsSize(const size_t resX, const size_t resY)
+{
+  return (resX / SLAP_MOTION_BLOCK_SIZE) * (resY / SLAP_MOTION_BLOCK_SIZE) * 2;
+}
+
+void _slapSearchMotionVectors(IN const uint8_t *pData, IN const uint8_t *pLastFrame, OUT int8_t *pMotionVectors, const size_t resX, const size_t resY)
+{
+  const size_t blocksPerRow = resX / SLAP_MOTION_BLOCK_SIZE;
+  const size_t blockCount = blocksPerRow * (resY / SLAP_MOTION_BLOCK_SIZE);
+
+  for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++)
+  {
+    const int64_t x = (int64_t)((blockIndex % blocksPerRow) * SLAP_MOTION_BLOCK_SIZE);
+    const int64_t y = (int64_t)((blockIndex / blocksPerRow) * SLAP_MOTION_BLOCK_SIZE);
+    const uint8_t *pBlock = pData + y * resX + x;
+
+    int64_t bestX = 0;
+    int64_t bestY = 0;
+    uint32_t bestSAD = _slapGetBlockSAD(pBlock, pLastFrame + y * resX + x, resX);
+
+    // The vectors of the left and upper neighbour are good starting points, since most motion is shared by many blocks.
+    int64_t candidates[2][2] = { { 0, 0 }, { 0, 0 } };
+    size_t candidateCount = 0;
+
+    if (blockIndex % blocksPerRow > 0)
+    {
+      candidates[candidateCount][0] = pMotionVectors[(blockIndex - 1) * 2];
+      candidates[candidateCount][1] = pMotionVectors[(blockIndex - 1) * 2 + 1];
+      candidateCount++;
+    }
+
+    if (blockIndex >= blocksPerRow)
+    {
+      candidates[candidateCount][0] = pMotionVectors[(blockIndex - blocksPerRow) * 2];
+      candidates[candidateCount][1] = pMotionVectors[(blockIndex - blocksPerRow) * 2 + 1];
+      candidateCount++;
+    }
+
+    for (size_t i = 0; i < candidateCount && bestSAD > 0; i++)
+    {
+      const int64_t vectorX = candidates[i][0];
+      const int64_t vectorY = candidates[i][1];
+
+      if (x + vectorX < 0 || y + vectorY < 0 || x + vectorX > (int64_t)(resX - SLAP_MOTION_BLOCK_SIZE) || y + vectorY > (int64_t)(resY - SLAP_MOTION_BLOCK_SIZE))
+        continue;
+
+      const uint32_t sad = _slapGetBlockSAD(pBlock, pLastFrame + (y + vectorY) * resX + x + vectorX, resX);
+
+      if (sad < bestSAD)
+      {
+        bestSAD = sad;
+        bestX = vectorX;
+        bestY = vectorY;
+      }
+    }
+
+    // Logarithmic search around the best vector so far.
+    for (int64_t step = SLAP_MOTION_SEARCH_STEP; step > 0 && bestSAD > 0; step >>= 1)
+    {
+      const int64_t centerX = bestX;
+      const int64_t centerY = bestY;
+
+      for (int64_t offsetY = -step; offsetY <= step; offsetY += step)
+      {
+        for (int64_t offsetX = -step; offsetX <= step; offsetX += step)
+        {
+          const int64_t vectorX = centerX + offsetX;
+          const int64_t vectorY = centerY + offsetY;
+
+          if ((offsetX == 0 && offsetY == 0) || vectorX < -SLAP_MOTION_VECTOR_MAX || vectorY < -SLAP_MOTION_VECTOR_MAX || vectorX > SLAP_MOTION_VECTOR_MAX || vectorY > SLAP_MOTION_VECTOR_MAX)
+            continue;
+
+          if (x + vectorX < 0 || y + vectorY < 0 || x + vectorX > (int64_t)(resX - SLAP_MOTION_BLOCK_SIZE) || y + vectorY > (int64_t)(resY - SLAP_MOTION_BLOCK_SIZE))
+            continue;
+
+          const uint32_t sad = _slapGetBlockSAD(pBlock, pLastFrame + (y + vectorY) * resX + x + vectorX, resX);
+
+          if (sad < bestSAD)
+          {
+            bestSAD = sad;
+            bestX = vectorX;
+            bestY = vectorY;
+          }
+        }
+      }
+    }
+
+    pMotionVectors[blockIndex * 2] = (int8_t)bestX;
+    pMotionVectors[blockIndex * 2 + 1] = (int8_t)bestY;
+  }
+}
+
+void _slapEncodeLastFrameDiffMotion(IN const uint8_t *pLastFrame, IN_OUT uint8_t *pData, IN const int8_t *pMotionVectors, const size_t resX, const size_t resY)
+{
+  const size_t blocksPerRow = resX / SLAP_MOTION_BLOCK_SIZE;
+  const size_t blockCount = blocksPerRow * (resY / SLAP_MOTION_BLOCK_SIZE);
+  const __m128i half = _mm_set1_epi8(127);
+  size_t planeOffset = 0;
+
+  for (size_t i = 0; i < SLAP_SUB_BUFFER_COUNT; i++)
+  {
+    const size_t blockSize = i == 0 ? SLAP_MOTION_BLOCK_SIZE : SLAP_MOTION_BLOCK_SIZE / 2;
+    const size_t stride = i == 0 ? resX : resX >> 1;
+    const int64_t vectorScale = i == 0 ? 1 : 2;
+
+    for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++)
+    {
+      const size_t offset = planeOffset + (blockIndex / blocksPerRow) * blockSize * stride + (blockIndex % blocksPerRow) * blockSize;
+      const int64_t vectorOffset = (pMotionVectors[blockIndex * 2 + 1] / vectorScale) * (int64_t)stride + pMotionVectors[blockIndex * 2] / vectorScale;
+
+      for (size_t y = 0; y < blockSize; y++)
+      {
+        uint8_t *pCB0 = pData + offset + y * stride;
+        const uint8_t *pLF0 = pLastFrame + offset + y * stride + vectorOffset;
+
+        // last frame diff
+        if (blockSize == sizeof(__m128i))
+          _mm_storeu_si128((__m128i *)pCB0, _mm_add_epi8(_mm_sub_epi8(_mm_loadu_si128((const __m128i *)pLF0), _mm_loadu_si128((const __m128i *)pCB0)), half));
+        else
+          _mm_storel_epi64((__m128i *)pCB0, _mm_add_epi8(_mm_sub_epi8(_mm_loadl_epi64((const __m128i *)pLF0), _mm_loadl_epi64((const __m128i *)pCB0)), half));
+      }
+    }
+
+    planeOffset += stride * (i == 0 ? resY : resY >> 1);
+  }
+}
+
+// `blockSize` is the size of the blocks at full resolution. Planes that have been decoded at `1 / scale` of the resolution are predicted with bilinear interpolation, because the scaled down motion vectors don't point at whole pixels.
+void _slapDecodeLastFrameDiffMotionPlane(IN_OUT uint8_t *pData, const size_t stride, IN const uint8_t *pLastFramePlane, IN const int8_t *pMotionVectors, const size_t sizeX, const size_t sizeY, const size_t blockSize, const size_t scale, const uint8_t half)
+{
+  const size_t decodedBlockSize = blockSize / scale;
+  const size_t blocksPerRow = sizeX / decodedBlockSize;
+  const size_t blockCount = blocksPerRow * (sizeY / decodedBlockSize);
+  const int64_t vectorScale = SLAP_MOTION_BLOCK_SIZE / blockSize;
+  const __m128i halfX16 = _mm_set1_epi8((char)half);
+
+  for (size_t blockIndex = 0; blockIndex < blockCount; blockIndex++)
+  {
+    const size_t blockX = (blockIndex % blocksPerRow) * decodedBlockSize;
+    const size_t blockY = (blockIndex / blocksPerRow) * decodedBlockSize;
+    const int64_t vectorX = pMotionVectors[blockIndex * 2] / vectorScale;
+    const int64_t vectorY = pMotionVectors[blockIndex * 2 + 1] / vectorScale;
+
+    if (scale == 1)
+    {
+      const int64_t vectorOffset = vectorY * (int64_t)sizeX + vectorX;
+
+      for (size_t y = 0; y < blockSize; y++)
+      {
+        uint8_t *pCB0 = pData + (blockY + y) * stride + blockX;
+        const uint8_t *pLF0 = pLastFramePlane + (blockY + y) * sizeX + blockX + vectorOffset;
+
+        if (blockSize == sizeof(__m128i))
+          _mm_storeu_si128((__m128i *)pCB0, _mm_sub_epi8(_mm_loadu_si128((const __m128i *)pLF0), _mm_add_epi8(_mm_loadu_si128((const __m128i *)pCB0), halfX16)));
+        else
+          _mm_storel_epi64((__m128i *)pCB0, _mm_sub_epi8(_mm_loadl_epi64((const __m128i *)pLF0), _mm_add_epi8(_mm_loadl_epi64((const __m128i *)pCB0), halfX16)));
+      }
+
+      continue;
+    }
+
+    // Split the vectors into whole decoded pixels (rounded towards negative infinity) and a fraction of `scale`.
+    const int64_t wholeX = (vectorX >= 0 ? vectorX : vectorX - (int64_t)scale + 1) / (int64_t)scale;
+    const int64_t wholeY = (vectorY >= 0 ? vectorY : vectorY - (int64_t)scale + 1) / (int64_t)scale;
+    const uint32_t fractionX = (uint32_t)(vectorX - wholeX * (int64_t)scale);
+    const uint32_t fractionY = (uint32_t)(vectorY - wholeY * (int64_t)scale);
+    uint32_t weights[4];
+
+    weights[0] = ((uint32_t)scale - fractionX) * ((uint32_t)scale - fractionY);
+    weights[1] = fractionX * ((uint32_t)scale - fractionY);
+    weights[2] = ((uint32_t)scale - fractionX) * fractionY;
+    weights[3] = fractionX * fractionY;
+
+    for (size_t y = 0; y < decodedBlockSize; y++)
+    {
+      uint8_t *pCB0 = pData + (blockY + y) * stride + blockX;
+      const int64_t referenceY = (int64_t)(blockY + y) + wholeY;
+
+      // The interpolated pixels can reach one pixel past the border of the plane.
+      const size_t row0 = (size_t)(referenceY < 0 ? 0 : (referenceY >= (int64_t)sizeY ? (int64_t)sizeY - 1 : referenceY));
+      const size_t row1 = (size_t)(referenceY + 1 < 0 ? 0 : (referenceY + 1 >= (int64_t)sizeY ? (int64_t)sizeY - 1 : referenceY + 1));
+
+      for (size_t x = 0; x < decodedBlockSize; x++)
+      {
+        const int64_t referenceX = (int64_t)(blockX + x) + wholeX;
+        const size_t column0 = (size_t)(referenceX < 0 ? 0 : (referenceX >= (int64_t)sizeX ? (int64_t)sizeX - 1 : referenceX));
+        const size_t column1 = (size_t)(referenceX + 1 < 0 ? 0 : (referenceX + 1 >= (int64_t)sizeX ? (int64_t)sizeX - 1 : referenceX + 1));
+
+        const uint32_t prediction = (weights[0] * pLastFramePlane[row0 * sizeX + column0] + weights[1] * pLastFramePlane[row0 * sizeX + column1] + weights[2] * pLastFramePlane[row1 * sizeX + column0] + weights[3] * pLastFramePlane[row1 * sizeX + column1] + (uint32_t)(scale * scale / 2)) / (uint32_t)(scale * scale);
+
+        pCB0[x] = (uint8_t)((uint8_t)prediction - (uint8_t)(pCB0[x] + half));
+      }
+    }
+  }
+}
+
+uint64_t _slapGetQuantizationScale(const int quality)
+{
+  if (quality < 50)
+    return 5000 / quality;
+
+  return quality < 100 ? 200 - 2 * quality : 1;
+}
+
+int _slapScaleQuality(const int quality, const size_t size, const size_t targetSize)
+{
+  uint64_t scale = _slapGetQuantizationScale(quality);
+  uint64_t clampedTargetSize = targetSize;
+
+  if (clampedTargetSize < size / 4)
+    clampedTargetSize = size / 4;
+  else if (clampedTargetSize > size * 4)
+    clampedTargetSize = size * 4;
+
+  if (clampedTargetSize == 0)
+    return quality;
+
+  scale = (scale * size + clampedTargetSize / 2) / clampedTargetSize;
+
+  if (scale >= 5000)
+    return 1;
+  else if (scale > 100)
+    return (int)(5000 / scale);
+  else if (scale > 0)
+    return (int)((200 - scale) / 2);
+  else
+    return 100;
+}